@@ -21,6 +21,11 @@ Config::Config()
     redis_max_conns = 100;
     redis_lock_timeout = 2000; //ms
     redis_lock_try_time = 1000;
+    redis_lock_mode = "legacy";
+    redis_record_format = "json";
+    redis_hot_fields = "inline";
+    redis_cluster = false;
+    redis_replica_max_lag = 2;
 
     rabbitmq_username = "linmin";
     rabbitmq_passwd = "linmin";
@@ -29,12 +34,21 @@ Config::Config()
     rabbitmq_timeout = 1000;
     uniquecast_exchange = "erizo_uniquecast_exchange";
     boardcast_exchange = "erizo_boardcast_exchange";
+    rabbitmq_sender_num = 1;
+    rabbitmq_confirm = false;
+    rabbitmq_persistent = false;
 
     erizo_controller_worker_num = 5;
     socket_io_thread_num = 20;
     erizo_agent_timeout = 10000;
     erizo_controller_update_interval = 1000;
     erizo_controller_timeout = 3000;
+    room_cache_ttl = 5000;
+    placement_strategy = "least_loaded";
+    placement_process_weight = 1;
+    placement_cpu_weight = 0;
+    placement_bandwidth_weight = 0;
+    placement_affinity_limit = 90;
 }
 
 Config *Config::getInstance()
@@ -108,6 +122,42 @@ int Config::init(const std::string &config_file)
         ELOG_ERROR("redis config check error");
         return 1;
     }
+    //lock_mode可选,所有erizo_controller必须使用同一种
+    if (redis.isMember("lock_mode") &&
+        (redis["lock_mode"].type() != Json::stringValue ||
+         (redis["lock_mode"].asString() != "legacy" && redis["lock_mode"].asString() != "fenced")))
+    {
+        ELOG_ERROR("redis lock_mode config check error");
+        return 1;
+    }
+    //所有erizo_controller都能读二进制记录之后才能切到binary
+    if (redis.isMember("record_format") &&
+        (redis["record_format"].type() != Json::stringValue ||
+         (redis["record_format"].asString() != "json" && redis["record_format"].asString() != "binary")))
+    {
+        ELOG_ERROR("redis record_format config check error");
+        return 1;
+    }
+    if (redis.isMember("hot_fields") &&
+        (redis["hot_fields"].type() != Json::stringValue ||
+         (redis["hot_fields"].asString() != "inline" && redis["hot_fields"].asString() != "split")))
+    {
+        ELOG_ERROR("redis hot_fields config check error");
+        return 1;
+    }
+    //key的格式随之改变,所有erizo_controller必须一致
+    if (redis.isMember("cluster") && redis["cluster"].type() != Json::booleanValue)
+    {
+        ELOG_ERROR("redis cluster config check error");
+        return 1;
+    }
+    if ((redis.isMember("replicas") && redis["replicas"].type() != Json::arrayValue) ||
+        (redis.isMember("replica_max_lag") &&
+         (redis["replica_max_lag"].type() != Json::intValue || redis["replica_max_lag"].asInt() < 0)))
+    {
+        ELOG_ERROR("redis replicas config check error");
+        return 1;
+    }
 
     Json::Value rabbitmq = root["rabbitmq"];
     if (!root.isMember("rabbitmq") ||
@@ -130,6 +180,14 @@ int Config::init(const std::string &config_file)
         ELOG_ERROR("rabbitmq config check error");
         return 1;
     }
+    if ((rabbitmq.isMember("sender_num") &&
+         (rabbitmq["sender_num"].type() != Json::intValue || rabbitmq["sender_num"].asInt() < 1)) ||
+        (rabbitmq.isMember("confirm") && rabbitmq["confirm"].type() != Json::booleanValue) ||
+        (rabbitmq.isMember("persistent") && rabbitmq["persistent"].type() != Json::booleanValue))
+    {
+        ELOG_ERROR("rabbitmq sender config check error");
+        return 1;
+    }
 
     Json::Value other = root["other"];
     if (!root.isMember("other") ||
@@ -150,6 +208,28 @@ int Config::init(const std::string &config_file)
         ELOG_ERROR("other config check error");
         return 1;
     }
+    if (other.isMember("room_cache_ttl") &&
+        (other["room_cache_ttl"].type() != Json::intValue || other["room_cache_ttl"].asInt() < 0))
+    {
+        ELOG_ERROR("other room_cache_ttl config check error");
+        return 1;
+    }
+    Json::Value placement = other["placement"];
+    if (other.isMember("placement") &&
+        (placement.type() != Json::objectValue ||
+         (placement.isMember("strategy") &&
+          (placement["strategy"].type() != Json::stringValue ||
+           (placement["strategy"].asString() != "least_loaded" &&
+            placement["strategy"].asString() != "two_choices" &&
+            placement["strategy"].asString() != "room_affinity"))) ||
+         (placement.isMember("process_weight") && (!placement["process_weight"].isNumeric() || placement["process_weight"].asDouble() < 0)) ||
+         (placement.isMember("cpu_weight") && (!placement["cpu_weight"].isNumeric() || placement["cpu_weight"].asDouble() < 0)) ||
+         (placement.isMember("bandwidth_weight") && (!placement["bandwidth_weight"].isNumeric() || placement["bandwidth_weight"].asDouble() < 0)) ||
+         (placement.isMember("affinity_limit") && placement["affinity_limit"].type() != Json::intValue)))
+    {
+        ELOG_ERROR("other placement config check error");
+        return 1;
+    }
 
     port = websocket["port"].asInt();
     ssl = websocket["ssl"].asBool();
@@ -166,6 +246,26 @@ int Config::init(const std::string &config_file)
     redis_max_conns = redis["max_conns"].asInt();
     redis_lock_timeout = redis["lock_timeout"].asInt();
     redis_lock_try_time = redis["lock_try_time"].asInt();
+    if (redis.isMember("lock_mode"))
+        redis_lock_mode = redis["lock_mode"].asString();
+    if (redis.isMember("record_format"))
+        redis_record_format = redis["record_format"].asString();
+    if (redis.isMember("hot_fields"))
+        redis_hot_fields = redis["hot_fields"].asString();
+    if (redis.isMember("cluster"))
+        redis_cluster = redis["cluster"].asBool();
+    if (redis.isMember("replica_max_lag"))
+        redis_replica_max_lag = redis["replica_max_lag"].asInt();
+    Json::Value replica_items = redis["replicas"];
+    for (size_t i = 0; i < replica_items.size(); i++)
+    {
+        Json::Value item = replica_items[(int)i];
+        if (item.type() != Json::objectValue ||
+            !item.isMember("ip") || item["ip"].type() != Json::stringValue ||
+            !item.isMember("port") || item["port"].type() != Json::intValue)
+            continue;
+        redis_replicas.push_back(item["ip"].asString() + ":" + std::to_string(item["port"].asInt()));
+    }
 
     rabbitmq_hostname = rabbitmq["host"].asString();
     rabbitmq_port = rabbitmq["port"].asInt();
@@ -174,12 +274,30 @@ int Config::init(const std::string &config_file)
     rabbitmq_timeout = rabbitmq["timeout"].asInt();
     uniquecast_exchange = rabbitmq["uniquecast_exchange"].asString();
     boardcast_exchange = rabbitmq["boardcast_exchange"].asString();
+    if (rabbitmq.isMember("sender_num"))
+        rabbitmq_sender_num = rabbitmq["sender_num"].asInt();
+    if (rabbitmq.isMember("confirm"))
+        rabbitmq_confirm = rabbitmq["confirm"].asBool();
+    if (rabbitmq.isMember("persistent"))
+        rabbitmq_persistent = rabbitmq["persistent"].asBool();
 
     erizo_controller_worker_num = other["erizo_controller_worker_num"].asInt();
     socket_io_thread_num = other["socket_io_thread_num"].asInt();
     erizo_agent_timeout = other["erizo_agent_timeout"].asInt();
     erizo_controller_timeout = other["erizo_controller_timeout"].asInt();
     erizo_controller_update_interval = other["erizo_controller_update_interval"].asInt();
+    if (other.isMember("room_cache_ttl"))
+        room_cache_ttl = other["room_cache_ttl"].asInt();
+    if (placement.isMember("strategy"))
+        placement_strategy = placement["strategy"].asString();
+    if (placement.isMember("process_weight"))
+        placement_process_weight = placement["process_weight"].asDouble();
+    if (placement.isMember("cpu_weight"))
+        placement_cpu_weight = placement["cpu_weight"].asDouble();
+    if (placement.isMember("bandwidth_weight"))
+        placement_bandwidth_weight = placement["bandwidth_weight"].asDouble();
+    if (placement.isMember("affinity_limit"))
+        placement_affinity_limit = placement["affinity_limit"].asInt();
 
     Json::Value server_items = other["server"];
     for (size_t i = 0; i < server_items.size(); i++)
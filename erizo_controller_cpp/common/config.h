@@ -3,6 +3,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 #include <json/json.h>
 
@@ -33,6 +34,12 @@ public:
   int redis_max_conns;
   int redis_lock_timeout;
   int redis_lock_try_time;
+  std::string redis_lock_mode; //legacy: SETNX/GETSET时间戳; fenced: SET NX PX + fencing token
+  std::string redis_record_format; //json/binary,只影响写入,读取两种都支持;默认json,全部erizo_controller升级后再改为binary
+  std::string redis_hot_fields; //inline: ssrc/subscribe_count写在记录里; split: 单独的hash字段,原子更新;默认inline,切换需要整个集群一起改
+  bool redis_cluster; //redis集群模式,房间的key带{room_id}哈希标签
+  std::vector<std::string> redis_replicas; //从库ip:port,只读扫描使用,集群模式下不使用
+  int redis_replica_max_lag; //s,从库与主库断开超过此时间不再读取
 
   std::string rabbitmq_username;
   std::string rabbitmq_passwd;
@@ -41,13 +48,22 @@ public:
   int rabbitmq_timeout;
   std::string uniquecast_exchange;
   std::string boardcast_exchange;
+  int rabbitmq_sender_num; //发送连接数,同一个routing key总是由同一个连接发送,保证顺序
+  bool rabbitmq_confirm;   //publisher confirms,每批消息发送后等待broker确认
+  bool rabbitmq_persistent; //delivery_mode,信令消息不需要持久化
 
   int socket_io_thread_num;
   int erizo_controller_worker_num;
   int erizo_agent_timeout;
   int erizo_controller_update_interval;
   int erizo_controller_timeout;
+  int room_cache_ttl; //ms,本地房间缓存的最长有效期,0表示不缓存
   std::map<int, std::string> server_mapping;
+  std::string placement_strategy; //least_loaded: 加权负载最小; two_choices: 随机两个取负载小的; room_affinity: 优先房间内publisher所在的agent
+  double placement_process_weight; //负载 = process_weight*erizo_process_num + cpu_weight*cpu_usage + bandwidth_weight*bandwidth_usage
+  double placement_cpu_weight;
+  double placement_bandwidth_weight;
+  int placement_affinity_limit; //%,cpu或带宽使用率超过此值时不再按房间聚集
 
 private:
   Config();
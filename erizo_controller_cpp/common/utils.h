@@ -9,13 +9,13 @@
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
-#include <boost/regex.hpp>
 
 #include <json/json.h>
 
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
+#include <arpa/inet.h>
 
 #include "logger.h"
 #include "route/IP_TABLE.h"
@@ -51,25 +51,34 @@ class Utils
         return str;
     }
 
-    static bool searchAddress(const std::string &str, std::string &ip)
+    //在str中查找第一个内嵌的IPv4地址(如::ffff:1.2.3.4),ip为网络字节序
+    //规则与原正则一致:首尾段1-254,中间段0-255,不允许前导0,多个候选时取最左边、每段最长的
+    static bool searchAddress(const char *str, size_t len, uint32_t &ip)
     {
-        boost::regex reg("(25[0-4]|2[0-4][0-9]|1[0-9][0-9]|[1-9][0-9]|[1-9])[.](25[0-5]|2[0-4][0-9]|1[0-9][0-9]|[1-9][0-9]|[0-9])[.](25[0-5]|2[0-4][0-9]|1[0-9][0-9]|[1-9][0-9]|[0-9])[.](25[0-4]|2[0-4][0-9]|1[0-9][0-9]|[1-9][0-9]|[1-9])");
-
-        std::string::const_iterator start, end;
-        start = str.begin();
-        end = str.end();
-
-        boost::match_results<std::string::const_iterator> what;
-        boost::match_flag_type flags = boost::match_default;
-
-        while (regex_search(start, end, what, reg, flags))
+        for (size_t i = 0; i < len; i++)
         {
-            ip = std::string(what[0].first, what[0].second);
-            return true;
+            if (str[i] >= '1' && str[i] <= '9' && matchAddress(str + i, str + len, 0, 0, ip))
+            {
+                ip = htonl(ip);
+                return true;
+            }
         }
         return false;
     }
 
+    static bool searchAddress(const std::string &str, std::string &ip)
+    {
+        uint32_t addr;
+        if (!searchAddress(str.data(), str.size(), addr))
+            return false;
+
+        char buf[INET_ADDRSTRLEN];
+        struct in_addr in;
+        in.s_addr = addr;
+        ip = inet_ntop(AF_INET, &in, buf, sizeof(buf));
+        return true;
+    }
+
     static uint64_t getCurrentMs()
     {
         auto now = std::chrono::steady_clock::now();
@@ -137,6 +146,38 @@ class Utils
         return writer.write(root);
     }
 
+  private:
+    //从p开始匹配第index段,依次尝试3/2/1位,和正则的回溯顺序相同
+    static bool matchAddress(const char *p, const char *end, int index, uint32_t prefix, uint32_t &ip)
+    {
+        static const int kOctetMin[4] = {1, 0, 0, 1};
+        static const int kOctetMax[4] = {254, 255, 255, 254};
+
+        for (int n = 3; n >= 1; n--)
+        {
+            if (end - p < n || (n > 1 && p[0] == '0'))
+                continue;
+
+            int value = 0;
+            int i = 0;
+            for (; i < n && p[i] >= '0' && p[i] <= '9'; i++)
+                value = value * 10 + (p[i] - '0');
+            if (i < n || value < kOctetMin[index] || value > kOctetMax[index])
+                continue;
+
+            uint32_t addr = (prefix << 8) | (uint32_t)value;
+            if (index == 3)
+            {
+                ip = addr;
+                return true;
+            }
+            if (p + n < end && p[n] == '.' && matchAddress(p + n + 1, end, index + 1, addr, ip))
+                return true;
+        }
+        return false;
+    }
+
+  public:
     static std::string isp2String(edu::iptable::ISPType isp)
     {
         switch (isp)
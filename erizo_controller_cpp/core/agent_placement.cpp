@@ -0,0 +1,80 @@
+#include "agent_placement.h"
+
+#include <map>
+
+#include "agent_registry.h"
+#include "common/config.h"
+
+DEFINE_LOGGER(AgentPlacement, "AgentPlacement");
+
+AgentPlacement::AgentPlacement(AgentRegistry &registry) : registry_(registry),
+                                                          strategy_(Config::getInstance()->placement_strategy),
+                                                          affinity_limit_(Config::getInstance()->placement_affinity_limit)
+{
+}
+
+double AgentPlacement::score(const ErizoAgent &agent)
+{
+    Config *config = Config::getInstance();
+    return config->placement_process_weight * agent.erizo_process_num +
+           config->placement_cpu_weight * agent.cpu_usage +
+           config->placement_bandwidth_weight * agent.bandwidth_usage;
+}
+
+int AgentPlacement::place(const std::string &area, const std::vector<std::string> &room_agents, std::string &agent_id)
+{
+    if (strategy_ == "two_choices")
+        return twoChoices(area, agent_id);
+    if (strategy_ == "room_affinity")
+        return roomAffinity(area, room_agents, agent_id);
+    return leastLoaded(area, agent_id);
+}
+
+int AgentPlacement::leastLoaded(const std::string &area, std::string &agent_id)
+{
+    ErizoAgent agent;
+    if (registry_.least(area, agent))
+        return 1;
+    agent_id = agent.id;
+    return 0;
+}
+
+int AgentPlacement::twoChoices(const std::string &area, std::string &agent_id)
+{
+    std::vector<ErizoAgent> agents;
+    if (registry_.sample(area, 2, agents))
+        return 1;
+    if (agents.size() == 2 && score(agents[1]) < score(agents[0]))
+        agent_id = agents[1].id;
+    else
+        agent_id = agents[0].id;
+    return 0;
+}
+
+int AgentPlacement::roomAffinity(const std::string &area, const std::vector<std::string> &room_agents, std::string &agent_id)
+{
+    std::map<std::string, int> counts;
+    for (const std::string &id : room_agents)
+        counts[id]++;
+
+    int best_count = 0;
+    double best_score = 0;
+    for (auto &it : counts)
+    {
+        ErizoAgent agent;
+        if (registry_.get(area, it.first, agent) ||
+            agent.cpu_usage >= affinity_limit_ ||
+            agent.bandwidth_usage >= affinity_limit_)
+            continue;
+        double s = score(agent);
+        if (it.second > best_count || (it.second == best_count && s < best_score))
+        {
+            agent_id = agent.id;
+            best_count = it.second;
+            best_score = s;
+        }
+    }
+    if (best_count > 0)
+        return 0;
+    return leastLoaded(area, agent_id);
+}
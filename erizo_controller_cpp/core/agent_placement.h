@@ -0,0 +1,40 @@
+#ifndef AGENT_PLACEMENT_H
+#define AGENT_PLACEMENT_H
+
+#include <string>
+#include <vector>
+
+#include "common/logger.h"
+#include "model/erizo_agent.h"
+
+class AgentRegistry;
+
+//为新加入的client选择agent,策略见Config::placement_strategy
+//erizo由agent的getErizo按roomID分配,同一个房间的client落在同一个agent上时才可能共用erizo,减少BridgeStream
+class AgentPlacement
+{
+  DECLARE_LOGGER();
+
+public:
+  explicit AgentPlacement(AgentRegistry &registry);
+
+  //加权负载,越小越空闲
+  static double score(const ErizoAgent &agent);
+
+  //room_agents: 房间内已有publisher所在的agent,可以有重复
+  int place(const std::string &area, const std::vector<std::string> &room_agents, std::string &agent_id);
+
+private:
+  int leastLoaded(const std::string &area, std::string &agent_id);
+  //随机两个取负载小的,避免所有controller根据同一份旧数据都选中同一个agent
+  int twoChoices(const std::string &area, std::string &agent_id);
+  //房间内publisher最多的agent,负载过高或都已失效时按least_loaded
+  int roomAffinity(const std::string &area, const std::vector<std::string> &room_agents, std::string &agent_id);
+
+private:
+  AgentRegistry &registry_;
+  std::string strategy_;
+  int affinity_limit_;
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include "agent_registry.h"
+
+#include "agent_placement.h"
+#include "redis/redis_helper.h"
+#include "common/utils.h"
+#include "common/config.h"
+
+DEFINE_LOGGER(AgentRegistry, "AgentRegistry");
+
+AgentRegistry::AgentRegistry() : timeout_((uint64_t)Config::getInstance()->erizo_agent_timeout),
+                                 random_(std::random_device()())
+{
+}
+
+void AgentRegistry::refresh()
+{
+    //多个isp/area可以映射到同一个区域,每个区域只读一次
+    std::set<std::string> names;
+    for (auto &it : Config::getInstance()->server_mapping)
+        names.insert(it.second);
+
+    for (const std::string &name : names)
+    {
+        //agent每秒更新心跳,从库上落后的部分远小于erizo_agent_timeout
+        std::vector<ErizoAgent> agents;
+        if (RedisHelper::getAllErizoAgent(name, agents, true))
+        {
+            ELOG_ERROR("getall erizo-agent of %s from redis failed", name);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mux_);
+        Area &area = areas_[name];
+        //redis中已经没有的agent移出
+        std::set<std::string> ids;
+        for (const ErizoAgent &agent : agents)
+        {
+            ids.insert(agent.id);
+            update(area, agent);
+        }
+        std::vector<std::string> removed;
+        for (auto &a : area.agents)
+        {
+            if (!ids.count(a.first))
+                removed.push_back(a.first);
+        }
+        for (const std::string &id : removed)
+            remove(area, id);
+    }
+}
+
+bool AgentRegistry::alive(const ErizoAgent &agent, uint64_t now)
+{
+    return now < agent.last_update + timeout_;
+}
+
+int AgentRegistry::least(const std::string &area_name, ErizoAgent &agent)
+{
+    uint64_t now = Utils::getSystemMs();
+    std::unique_lock<std::mutex> lock(mux_);
+    auto it = areas_.find(area_name);
+    if (it == areas_.end())
+        return 1;
+
+    Area &area = it->second;
+    while (!area.by_score.empty())
+    {
+        std::string id = area.by_score.begin()->second;
+        const ErizoAgent &a = area.agents[id].agent;
+        if (alive(a, now))
+        {
+            agent = a;
+            return 0;
+        }
+        ELOG_WARN("erizo-agent %s expire", id);
+        remove(area, id);
+    }
+    return 1;
+}
+
+int AgentRegistry::sample(const std::string &area_name, size_t n, std::vector<ErizoAgent> &agents)
+{
+    uint64_t now = Utils::getSystemMs();
+    agents.clear();
+    std::unique_lock<std::mutex> lock(mux_);
+    auto it = areas_.find(area_name);
+    if (it == areas_.end())
+        return 1;
+
+    //部分Fisher-Yates,选中的交换到ids前部
+    Area &area = it->second;
+    size_t i = 0;
+    while (i < n && i < area.ids.size())
+    {
+        size_t j = i + random_() % (area.ids.size() - i);
+        std::string id = area.ids[j];
+        Entry &entry = area.agents[id];
+        if (!alive(entry.agent, now))
+        {
+            ELOG_WARN("erizo-agent %s expire", id);
+            remove(area, id);
+            continue;
+        }
+        std::swap(area.ids[i], area.ids[j]);
+        area.agents[area.ids[i]].pos = i;
+        area.agents[area.ids[j]].pos = j;
+        agents.push_back(entry.agent);
+        i++;
+    }
+    return agents.empty() ? 1 : 0;
+}
+
+int AgentRegistry::get(const std::string &area_name, const std::string &agent_id, ErizoAgent &agent)
+{
+    uint64_t now = Utils::getSystemMs();
+    std::unique_lock<std::mutex> lock(mux_);
+    auto it = areas_.find(area_name);
+    if (it == areas_.end())
+        return 1;
+    auto entry = it->second.agents.find(agent_id);
+    if (entry == it->second.agents.end() || !alive(entry->second.agent, now))
+        return 1;
+    agent = entry->second.agent;
+    return 0;
+}
+
+void AgentRegistry::applyChange(const Json::Value &change)
+{
+    if (!change.isMember("area") || change["area"].type() != Json::stringValue ||
+        !change.isMember("op") || change["op"].type() != Json::stringValue)
+    {
+        ELOG_ERROR("json parse [area/op] failed,dump %s", Utils::dumpJson(change));
+        return;
+    }
+
+    std::string op = change["op"].asString();
+    if (op == "update")
+    {
+        ErizoAgent agent;
+        if (!change.isMember("agent") || change["agent"].type() != Json::objectValue ||
+            ErizoAgent::fromJSON(Utils::dumpJson(change["agent"]), agent))
+        {
+            ELOG_ERROR("json parse agent failed,dump %s", Utils::dumpJson(change));
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mux_);
+        update(areas_[change["area"].asString()], agent);
+    }
+    else if (op == "remove")
+    {
+        if (!change.isMember("agentId") || change["agentId"].type() != Json::stringValue)
+        {
+            ELOG_ERROR("json parse agentId failed,dump %s", Utils::dumpJson(change));
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mux_);
+        auto it = areas_.find(change["area"].asString());
+        if (it != areas_.end())
+            remove(it->second, change["agentId"].asString());
+    }
+}
+
+void AgentRegistry::update(Area &area, const ErizoAgent &agent)
+{
+    double score = AgentPlacement::score(agent);
+    auto it = area.agents.find(agent.id);
+    if (it != area.agents.end())
+    {
+        //乱序到达的旧数据
+        if (agent.last_update < it->second.agent.last_update)
+            return;
+        area.by_score.erase({it->second.score, agent.id});
+        it->second.agent = agent;
+        it->second.score = score;
+    }
+    else
+    {
+        area.agents[agent.id] = {agent, score, area.ids.size()};
+        area.ids.push_back(agent.id);
+    }
+    area.by_score.insert({score, agent.id});
+}
+
+void AgentRegistry::remove(Area &area, const std::string &agent_id)
+{
+    auto it = area.agents.find(agent_id);
+    if (it == area.agents.end())
+        return;
+    area.by_score.erase({it->second.score, agent_id});
+    //和最后一个交换后删除
+    size_t pos = it->second.pos;
+    area.ids[pos] = area.ids.back();
+    area.agents[area.ids[pos]].pos = pos;
+    area.ids.pop_back();
+    area.agents.erase(it);
+}
@@ -0,0 +1,67 @@
+#ifndef AGENT_REGISTRY_H
+#define AGENT_REGISTRY_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <random>
+
+#include <json/json.h>
+
+#include "common/logger.h"
+#include "model/erizo_agent.h"
+
+//进程内的erizo_agent表,按区域(server_mapping)保存,分配agent时不访问redis
+//心跳线程定期从redis(可以是从库)整表刷新,agent在boardcast_exchange上广播的心跳即时更新(applyChange)
+//同一个agent只接受last_update更新的数据;遇到过期的agent顺便移出,收到新的心跳后重新加入
+class AgentRegistry
+{
+  DECLARE_LOGGER();
+
+  struct Entry
+  {
+    ErizoAgent agent;
+    double score; //AgentPlacement::score
+    size_t pos;   //在Area::ids中的位置
+  };
+
+  struct Area
+  {
+    std::map<std::string, Entry> agents;
+    std::set<std::pair<double, std::string>> by_score; //begin()是负载最小的
+    std::vector<std::string> ids;                      //随机选择使用
+  };
+
+public:
+  AgentRegistry();
+
+  //从redis重新加载所有区域
+  void refresh();
+
+  //负载最小的存活agent,O(log n)
+  int least(const std::string &area, ErizoAgent &agent);
+  //随机选择最多n个不同的存活agent
+  int sample(const std::string &area, size_t n, std::vector<ErizoAgent> &agents);
+  //指定的agent,不存在或已过期时返回1
+  int get(const std::string &area, const std::string &agent_id, ErizoAgent &agent);
+
+  //{"type":"agent_change","area":"...","op":"update","agent":{ErizoAgent}}
+  //{"type":"agent_change","area":"...","op":"remove","agentId":"..."}
+  void applyChange(const Json::Value &change);
+
+private:
+  bool alive(const ErizoAgent &agent, uint64_t now);
+
+  void update(Area &area, const ErizoAgent &agent);
+  void remove(Area &area, const std::string &agent_id);
+
+private:
+  uint64_t timeout_;
+  std::mutex mux_;
+  std::map<std::string, Area> areas_;
+  std::mt19937 random_;
+};
+
+#endif
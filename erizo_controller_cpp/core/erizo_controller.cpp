@@ -1,7 +1,10 @@
 #include "erizo_controller.h"
 
+#include <algorithm>
+
 #include "redis/redis_helper.h"
 #include "redis/redis_locker.h"
+#include "redis/async_redis.h"
 #include "rabbitmq/amqp_rpc.h"
 #include "rabbitmq/amqp_recv.h"
 #include "common/utils.h"
@@ -9,6 +12,9 @@
 #include "websocket/socket_io_server.h"
 #include "websocket/socket_io_client_handler.h"
 #include "thread/thread_pool.h"
+#include "room_cache.h"
+#include "agent_registry.h"
+#include "agent_placement.h"
 
 DEFINE_LOGGER(ErizoController, "ErizoController");
 
@@ -26,6 +32,10 @@ ErizoController::ErizoController() : id_(""),
                                      socket_io_(nullptr),
                                      amqp_(nullptr),
                                      amqp_signaling_(nullptr),
+                                     amqp_boardcast_(nullptr),
+                                     room_cache_(nullptr),
+                                     agent_registry_(nullptr),
+                                     agent_placement_(nullptr),
                                      thread_pool_(nullptr),
                                      init_(false)
 {
@@ -44,6 +54,11 @@ void ErizoController::asyncTask(const std::function<void()> &func)
     }
 }
 
+const ErizoController::WorkerContext &ErizoController::getContext(const std::string &client_id)
+{
+    return contexts_[std::hash<std::string>()(client_id) % contexts_.size()];
+}
+
 int ErizoController::init()
 {
     if (init_)
@@ -55,6 +70,13 @@ int ErizoController::init()
 
     thread_pool_ = std::unique_ptr<erizo::ThreadPool>(new erizo::ThreadPool(Config::getInstance()->erizo_controller_worker_num));
     thread_pool_->start();
+    for (size_t i = 0; i < thread_pool_->size(); i++)
+    {
+        WorkerContext context;
+        context.worker = thread_pool_->getWorker(i);
+        context.redis = std::make_shared<AsyncRedis>(context.worker->getIOService());
+        contexts_.push_back(context);
+    }
 
     std::string amqp_binding_key = id_ + "_rpc";
     amqp_ = std::make_shared<AMQPRPC>();
@@ -65,7 +87,7 @@ int ErizoController::init()
     }
 
     amqp_signaling_ = std::make_shared<AMQPRecv>();
-    if (amqp_signaling_->init(id_, [this](const std::string &msg) {
+    if (amqp_signaling_->init(Config::getInstance()->uniquecast_exchange, "direct", id_, [this](const std::string &msg) {
             onSignalingMessage(msg);
         }))
     {
@@ -73,14 +95,27 @@ int ErizoController::init()
         return 1;
     }
 
+    room_cache_ = std::unique_ptr<RoomCache>(new RoomCache(id_));
+    agent_registry_ = std::unique_ptr<AgentRegistry>(new AgentRegistry);
+    agent_registry_->refresh();
+    agent_placement_ = std::unique_ptr<AgentPlacement>(new AgentPlacement(*agent_registry_));
+    amqp_boardcast_ = std::make_shared<AMQPRecv>();
+    if (amqp_boardcast_->init(Config::getInstance()->boardcast_exchange, "fanout", "", [this](const std::string &msg) {
+            onBoardcastMessage(msg);
+        }))
+    {
+        ELOG_ERROR("amqp-boardcast initialize failed");
+        return 1;
+    }
+
     socket_io_ = std::make_shared<SocketIOServer>();
     if (socket_io_->init())
     {
         ELOG_ERROR("socket-io-server initialize failed");
         return 1;
     }
-    socket_io_->onMessage([this](SocketIOClientHandler *hdl, const std::string &msg) {
-        return onMessage(hdl, msg);
+    socket_io_->onMessage([this](SocketIOClientHandler *hdl, int mid, const std::string &msg) {
+        return onMessage(hdl, mid, msg);
     });
     socket_io_->onClose([this](SocketIOClientHandler *hdl) {
         onClose(hdl);
@@ -95,13 +130,7 @@ int ErizoController::init()
         {
             uint64_t now = Utils::getSystemMs();
 
-            RedisLocker redis_locker;
-            if (!redis_locker.lock("erizo_controller_heartbeat_locker"))
-            {
-                ELOG_ERROR("get redis locker failed when remove-erizo-controller");
-                return;
-            }
-
+            //只写自己的字段,不需要加锁
             if (now - heartbeat_.last_update > update_interval)
             {
                 heartbeat_.last_update = now;
@@ -110,30 +139,49 @@ int ErizoController::init()
                     ELOG_ERROR("add heartbeat-data to redis failed");
                     return;
                 }
+                //兜底没有广播心跳的agent和丢失的广播
+                agent_registry_->refresh();
             }
+
+            //先从从库扫描,发现过期的再加锁从主库确认后删除
             std::vector<HEARTBEAT> heartbeats;
-            if (RedisHelper::getAllHeartbeatData(heartbeats))
+            if (RedisHelper::getAllHeartbeatData(heartbeats, true))
             {
                 ELOG_ERROR("get all heartbeat-data from redis failed");
                 return;
             }
-
-            for (const HEARTBEAT &data : heartbeats)
+            auto expired = [this, now, timeout](const HEARTBEAT &data) {
+                return data.id != id_ && now > data.last_update && now - data.last_update > timeout;
+            };
+            if (std::any_of(heartbeats.begin(), heartbeats.end(), expired))
             {
-                if (data.id == id_)
-                    continue;
-                if (data.last_update - now > timeout)
+                RedisLocker redis_locker;
+                if (!redis_locker.lock("erizo_controller_heartbeat_locker"))
                 {
-                    //过期
-                    RedisHelper::removeHeartbeatData(data.id);
-                    asyncTask([this, data]() {
-                        //清除过期的erizo_controller
-                        ELOG_WARN("erizo-controller %s expire", data.id);
-                        removeExpireErizoController(data.id);
-                    });
+                    ELOG_ERROR("get redis locker failed when remove-erizo-controller");
+                    return;
                 }
+                if (RedisHelper::getAllHeartbeatData(heartbeats))
+                {
+                    ELOG_ERROR("get all heartbeat-data from redis failed");
+                    return;
+                }
+
+                for (const HEARTBEAT &data : heartbeats)
+                {
+                    if (expired(data))
+                    {
+                        //过期
+                        RedisHelper::removeHeartbeatData(data.id);
+                        getContext(data.id).worker->task([this, data]() {
+                            //清除过期的erizo_controller
+                            ELOG_WARN("erizo-controller %s expire", data.id);
+                            removeExpireErizoController(data.id);
+                        });
+                    }
+                }
+                redis_locker.unlock();
             }
-            redis_locker.unlock();
             usleep(500000); //500ms
         }
         RedisHelper::removeHeartbeatData(id_);
@@ -150,19 +198,30 @@ void ErizoController::close()
     if (!init_)
         return;
 
-    thread_pool_->close();
-    thread_pool_.reset();
-    thread_pool_ = nullptr;
-
     run_ = false;
+
     heartbeat_thread_->join();
     heartbeat_thread_.reset();
     heartbeat_thread_ = nullptr;
 
+    //剩余连接的onClose把删除交给worker,所以要在worker之前关闭
     socket_io_->close();
     socket_io_.reset();
     socket_io_ = nullptr;
 
+    //redis连接上有未完成的读操作,不关闭的话worker无法退出;等已经发出的删除完成后再关闭
+    for (const WorkerContext &context : contexts_)
+    {
+        std::shared_ptr<AsyncRedis> redis = context.redis;
+        context.worker->task([redis]() {
+            redis->closeWhenIdle();
+        });
+    }
+    thread_pool_->close();
+    thread_pool_.reset();
+    thread_pool_ = nullptr;
+    contexts_.clear();
+
     amqp_->close();
     amqp_.reset();
     amqp_ = nullptr;
@@ -171,112 +230,101 @@ void ErizoController::close()
     amqp_signaling_.reset();
     amqp_signaling_ = nullptr;
 
+    amqp_boardcast_->close();
+    amqp_boardcast_.reset();
+    amqp_boardcast_ = nullptr;
+
+    room_cache_.reset();
+    room_cache_ = nullptr;
+
+    agent_placement_.reset();
+    agent_placement_ = nullptr;
+
+    agent_registry_.reset();
+    agent_registry_ = nullptr;
+
     id_ = "";
     init_ = false;
 }
 
 int testtest = 1;
-int ErizoController::allocAgent(Client &client)
+void ErizoController::allocAgent(const std::shared_ptr<Client> &client, const std::function<void(int err)> &cb)
 {
-    std::vector<ErizoAgent> agents;
-    auto it = Config::getInstance()->server_mapping.find((int)client.ip_info.area);
+    auto it = Config::getInstance()->server_mapping.find((int)client->ip_info.area);
     if (it == Config::getInstance()->server_mapping.end())
     {
-        ELOG_ERROR("not server deploy on field %d", (int)client.ip_info.area);
-        return 1;
+        ELOG_ERROR("not server deploy on field %d", (int)client->ip_info.area);
+        cb(1);
+        return;
     }
 
     std::string area_name = it->second;
-
-    // std::string locker_name = "erizo_agent_" + area_name + "_heartbeat_locker";
-    // RedisLocker redis_locker;
-    // if (!redis_locker.lock(locker_name))
-    // {
-    //     ELOG_ERROR("get redis locker failed when alloc-agent");
-    //     return 1;
-    // }
-
-    if (RedisHelper::getAllErizoAgent(area_name, agents))
+    if (Config::getInstance()->placement_strategy != "room_affinity")
     {
-        ELOG_ERROR("getall erizo-agent from redis failed");
-        return 1;
-    }
-
-    uint64_t now = Utils::getSystemMs();
-    std::vector<ErizoAgent> agents_alive;
-    for (const ErizoAgent &agent : agents)
-    {
-        if (now - agent.last_update < (uint64_t)Config::getInstance()->erizo_agent_timeout)
-        {
-            agents_alive.push_back(agent);
-        }
-        // else
-        // {
-        //     //ErizoAgent 过期,从redis删除记录
-        //     ELOG_WARN("erizo-agent %s expire", agent.id);
-        //     RedisHelper::removeErizoAgent(area_name, agent);
-        //     RedisHelper::removeAllErizo(agent);
-        // }
+        cb(placeAgent(*client, area_name, {}));
+        return;
     }
+    room_cache_->getAllPublisher(getContext(client->id).redis, client->room_id,
+                                 [this, client, area_name, cb](int err, std::vector<Publisher> &publishers) {
+        if (err)
+            ELOG_WARN("getall publisher of %s failed,ignore room affinity", client->room_id);
+        std::vector<std::string> room_agents;
+        for (const Publisher &publisher : publishers)
+            room_agents.push_back(publisher.agent_id);
+        cb(placeAgent(*client, area_name, room_agents));
+    });
+}
 
-    if (agents_alive.size() == 0)
+int ErizoController::placeAgent(Client &client, const std::string &area_name, const std::vector<std::string> &room_agents)
+{
+    if (agent_placement_->place(area_name, room_agents, client.agent_id))
     {
         ELOG_ERROR("not erizo-agent alive on field %d", (int)client.ip_info.area);
         return 1;
     }
-
-    std::sort(agents_alive.begin(), agents_alive.end(), [](ErizoAgent &a, ErizoAgent &b) {
-        return a.erizo_process_num < b.erizo_process_num;
-    });
-    client.agent_id = agents_alive[0].id;
     return 0;
 }
 
-int ErizoController::allocErizo(Client &client)
+void ErizoController::allocErizo(const std::shared_ptr<Client> &client, const std::function<void(int err)> &cb)
 {
     Json::Value data;
     data["method"] = "getErizo";
-    data["roomID"] = client.room_id;
-    std::string queuename = client.agent_id;
-
-    int ret;
-    std::atomic<bool> callback_done;
-    int try_time = 3;
+    data["roomID"] = client->room_id;
+
+    //回复在amqp线程里到达,回到client对应的worker再修改client
+    //等待期间client断开并且已经从redis删除时放弃,避免再写入redis
+    std::shared_ptr<erizo::Worker> worker = getContext(client->id).worker;
+    std::weak_ptr<Client> weak_client = client;
+    std::string agent_id = client->agent_id;
+    amqp_->rpc(agent_id, data, 3, [worker, weak_client, cb, agent_id](const Json::Value &root) {
+        if (root.type() == Json::nullValue ||
+            !root.isMember("erizoID") ||
+            root["erizoID"].type() != Json::stringValue ||
+            !root.isMember("bridgeIP") ||
+            root["bridgeIP"].type() != Json::stringValue ||
+            !root.isMember("bridgePort") ||
+            root["bridgePort"].type() != Json::intValue)
+        {
+            ELOG_ERROR("get erizo from agent %s failed", agent_id);
+            worker->task([cb]() {
+                cb(1);
+            });
+            return;
+        }
 
-    do
-    {
-        try_time--;
-        callback_done = false;
-        amqp_->rpc(Config::getInstance()->uniquecast_exchange, queuename, queuename, data, [this, &client, &ret, &callback_done](const Json::Value &root) {
-            if (root.type() == Json::nullValue)
-            {
-                ret = 1;
-                callback_done = true;
+        std::string erizo_id = root["erizoID"].asString();
+        std::string bridge_ip = root["bridgeIP"].asString();
+        uint16_t bridge_port = root["bridgePort"].asInt();
+        worker->task([weak_client, cb, erizo_id, bridge_ip, bridge_port]() {
+            std::shared_ptr<Client> client = weak_client.lock();
+            if (client == nullptr)
                 return;
-            }
-            if (!root.isMember("erizoID") ||
-                root["erizoID"].type() != Json::stringValue ||
-                !root.isMember("bridgeIP") ||
-                root["bridgeIP"].type() != Json::stringValue ||
-                !root.isMember("bridgePort") ||
-                root["bridgePort"].type() != Json::intValue)
-            {
-                ret = 1;
-                callback_done = true;
-                return;
-            }
-
-            ret = 0;
-            client.erizo_id = root["erizoID"].asString();
-            client.bridge_ip = root["bridgeIP"].asString();
-            client.bridge_port = root["bridgePort"].asInt();
-
-            callback_done = true;
+            client->erizo_id = erizo_id;
+            client->bridge_ip = bridge_ip;
+            client->bridge_port = bridge_port;
+            cb(0);
         });
-        while (!callback_done)
-            usleep(0);
-    } while (ret && try_time);
-    return ret;
+    });
 }
 
 void ErizoController::onSignalingMessage(const std::string &msg)
@@ -362,27 +410,6 @@ void ErizoController::onSignalingMessage(const std::string &msg)
             uint32_t video_ssrc = data["videoSSRC"].asUInt();
             uint32_t audio_ssrc = data["audioSSRC"].asUInt();
 
-            RedisLocker redis_locker;
-            if (!redis_locker.lock(room_id))
-            {
-                ELOG_ERROR("get redis locker failed when publisher-answer");
-                return;
-            }
-
-            Publisher publisher;
-            if (RedisHelper::getPublisher(room_id, stream_id, publisher))
-            {
-                ELOG_ERROR("get publisher from redis failed");
-                return;
-            }
-            publisher.video_ssrc = video_ssrc;
-            publisher.audio_ssrc = audio_ssrc;
-            if (RedisHelper::addPublisher(room_id, publisher))
-            {
-                ELOG_ERROR("add publisher to redis failed");
-                return;
-            }
-
             Json::Value event;
             event[0] = "signaling_message_erizo";
             Json::Value mess;
@@ -392,7 +419,22 @@ void ErizoController::onSignalingMessage(const std::string &msg)
             event_data["streamId"] = stream_id;
             event_data["mess"] = mess;
             event[1] = event_data;
-            events.push_back(writer.write(event));
+            std::string answer = writer.write(event);
+
+            //ssrc写入redis之后再把answer发给客户端
+            WorkerContext context = getContext(client_id);
+            context.worker->task([=]() {
+                RedisHelper::asyncSetPublisherSsrc(context.redis, room_id, stream_id, video_ssrc, audio_ssrc, [=](int err) {
+                    if (err)
+                    {
+                        ELOG_ERROR("set publisher ssrc on redis failed");
+                        return;
+                    }
+                    amqp_->broadcast(room_cache_->setPublisherSsrc(room_id, stream_id, video_ssrc, audio_ssrc));
+                    socket_io_->sendEvent(client_id, answer);
+                });
+            });
+            return;
         }
         else if (type == "subscriber_answer")
         {
@@ -431,12 +473,6 @@ void ErizoController::onSignalingMessage(const std::string &msg)
             if (data.isMember("roomId") || data["roomId"].type() == Json::stringValue)
             {
                 std::string room_id = data["roomId"].asString();
-                RedisLocker redis_locker;
-                if (!redis_locker.lock(room_id))
-                {
-                    ELOG_ERROR("get redis locker failed when ready");
-                    return;
-                }
                 notifyToSubscribe(room_id, client_id, stream_id);
             }
         }
@@ -490,6 +526,31 @@ void ErizoController::onSignalingMessage(const std::string &msg)
     });
 }
 
+void ErizoController::onBoardcastMessage(const std::string &msg)
+{
+    Json::Value root;
+    Json::Reader reader(Json::Features::strictMode());
+    if (!reader.parse(msg, root))
+    {
+        ELOG_ERROR("json parse root failed,dump %s", msg);
+        return;
+    }
+    if (!root.isMember("data") ||
+        root["data"].type() != Json::objectValue ||
+        !root["data"].isMember("type") ||
+        root["data"]["type"].type() != Json::stringValue)
+    {
+        ELOG_ERROR("json parse [data/type] failed,dump %s", msg);
+        return;
+    }
+
+    const Json::Value &data = root["data"];
+    if (data["type"].asString() == "room_change")
+        room_cache_->applyChange(data);
+    else if (data["type"].asString() == "agent_change")
+        agent_registry_->applyChange(data);
+}
+
 void ErizoController::removePublisher(const Publisher &publisher)
 {
     std::string queuename = publisher.erizo_id;
@@ -516,32 +577,36 @@ void ErizoController::removeSubscriber(const Subscriber &subscriber)
 
 void ErizoController::notifyToSubscribe(const std::string &room_id, const std::string &client_id, const std::string &stream_id)
 {
-    asyncTask([=]() {
-        Publisher publisher;
-        if (RedisHelper::getPublisher(room_id, stream_id, publisher))
-        {
-            ELOG_ERROR("get publisher from redis failed");
-            return;
-        }
-
-        std::vector<Client> clients;
-        if (RedisHelper::getAllClient(room_id, clients))
-        {
-            ELOG_ERROR("getall client from redis failed");
-            return;
-        }
+    //在发布者对应的worker上通过其AsyncRedis查询,缓存未命中时也不阻塞
+    WorkerContext context = getContext(client_id);
+    context.worker->task([=]() {
+        room_cache_->getPublisher(context.redis, room_id, stream_id, [=](int err, Publisher &publisher) {
+            if (err)
+            {
+                ELOG_ERROR("get publisher from redis failed");
+                return;
+            }
+            std::string label = publisher.label;
+            room_cache_->getAllClient(context.redis, room_id, [=](int err, std::vector<Client> &clients) {
+                if (err)
+                {
+                    ELOG_ERROR("getall client from redis failed");
+                    return;
+                }
 
-        for (const Client &client : clients)
-        {
-            if (client.id == client_id)
-                continue;
-            Json::Value root;
-            root["type"] = "new_publisher";
-            root["streamId"] = stream_id;
-            root["clientId"] = client.id;
-            root["label"] = publisher.label;
-            amqp_->rpcNotReply(client.reply_to, root);
-        }
+                for (const Client &client : clients)
+                {
+                    if (client.id == client_id)
+                        continue;
+                    Json::Value root;
+                    root["type"] = "new_publisher";
+                    root["streamId"] = stream_id;
+                    root["clientId"] = client.id;
+                    root["label"] = label;
+                    amqp_->rpcNotReply(client.reply_to, root);
+                }
+            });
+        });
     });
 }
 
@@ -633,12 +698,17 @@ void ErizoController::notifyToRemoveSubscriber(const Subscriber &subscriber)
 
 void ErizoController::onClose(SocketIOClientHandler *hdl)
 {
-    removeClient(hdl->getClient());
+    //handler随后被删除,Client由任务持有
+    //close()先关闭socket-io再关闭worker,这里总是可以交给worker
+    std::shared_ptr<Client> client = hdl->getClientPtr();
+    getContext(client->id).worker->task([this, client]() {
+        removeClient(*client);
+    });
 }
 
-std::string ErizoController::onMessage(SocketIOClientHandler *hdl, const std::string &msg)
+std::string ErizoController::onMessage(SocketIOClientHandler *hdl, int mid, const std::string &msg)
 {
-    Client &client = hdl->getClient();
+    std::shared_ptr<Client> client = hdl->getClientPtr();
     Json::Value root;
     Json::Reader reader(Json::Features::strictMode());
     if (!reader.parse(msg, root))
@@ -655,245 +725,222 @@ std::string ErizoController::onMessage(SocketIOClientHandler *hdl, const std::st
         ELOG_ERROR("json parse args[num/type] failed,dump %s", msg);
         return "disconnect";
     }
-    Json::Value reply = Json::nullValue;
     std::string event = root[0].asString();
     Json::Value data = root[1];
-    if (event == "token")
-        reply = handleToken(client, data);
-    else if (event == "publish")
-        reply = handlePublish(client, data);
-    else if (event == "subscribe")
-    {
-        reply = handleSubscribe(client, data);
-        if (reply == Json::nullValue)
-            return "keep";
-    }
-    else if (event == "signaling_message")
-    {
-        handleSignaling(client, data);
-        return "keep";
-    }
-    if (reply != Json::nullValue)
-    {
+    if (event != "token" && event != "publish" && event != "subscribe" && event != "signaling_message")
+        return "disconnect";
+
+    //hub线程不做任何网络I/O,交给client对应的worker,处理完成后再回复
+    std::string client_id = client->id;
+    bool keep_on_error = (event == "subscribe");
+    Reply reply = [this, client_id, mid, keep_on_error](const Json::Value &res) {
+        if (res == Json::nullValue)
+        {
+            if (!keep_on_error)
+                socket_io_->closeConnection(client_id);
+            return;
+        }
         Json::FastWriter writer;
-        return writer.write(reply);
-    }
-    return "disconnect";
+        socket_io_->sendAck(client_id, mid, writer.write(res));
+    };
+
+    getContext(client_id).worker->task([this, client, event, data, reply]() {
+        if (event == "token")
+            handleToken(client, data, reply);
+        else if (event == "publish")
+            handlePublish(client, data, reply);
+        else if (event == "subscribe")
+            handleSubscribe(client, data, reply);
+        else
+            handleSignaling(*client, data);
+    });
+    return "keep";
 }
 
-Json::Value ErizoController::handleToken(Client &client, const Json::Value &root)
+void ErizoController::handleToken(const std::shared_ptr<Client> &client, const Json::Value &root, const Reply &reply)
 {
-    client.room_id = "test_room_id";
-    client.reply_to = amqp_signaling_->getReplyTo();
-
-    if (allocAgent(client))
-        return Json::nullValue;
-
-    if (allocErizo(client))
-        return Json::nullValue;
-
-    if (RedisHelper::addClient(client.room_id, client))
-    {
-        ELOG_ERROR("add client to redis failed");
-        return Json::nullValue;
-    }
+    client->room_id = "test_room_id";
+    client->reply_to = amqp_signaling_->getReplyTo();
 
-    //新的用户加入,将其写入此erizo_controller维护的redis集合
-    if (RedisHelper::addClientToEC(id_, client))
-    {
-        ELOG_ERROR("add client to redis failed(ec)");
-        return Json::nullValue;
-    }
+    std::weak_ptr<Client> weak_client = client;
+    allocAgent(client, [this, weak_client, reply](int err) {
+        std::shared_ptr<Client> client = weak_client.lock();
+        if (err || client == nullptr)
+        {
+            reply(Json::nullValue);
+            return;
+        }
+        allocErizo(client, [this, weak_client, reply](int err) {
+            std::shared_ptr<Client> client = weak_client.lock();
+            if (err || client == nullptr)
+            {
+                reply(Json::nullValue);
+                return;
+            }
+            //新的用户加入,将其写入房间和此erizo_controller维护的redis集合,同时取回房间内的流
+            addClientAndReply(client, reply);
+        });
+    });
+}
 
-    std::vector<Publisher> publishers;
-    if (RedisHelper::getAllPublisher(client.room_id, publishers))
-    {
-        ELOG_ERROR("getall publisher from redis failed");
-        return Json::nullValue;
-    }
+void ErizoController::addClientAndReply(const std::shared_ptr<Client> &client, const Reply &reply)
+{
+    RedisHelper::asyncAddClientAndGetAllPublisher(getContext(client->id).redis, client->room_id, id_, *client,
+                                                  [this, client, reply](int err, std::vector<Publisher> &publishers) {
+        if (err)
+        {
+            ELOG_ERROR("add client/getall publisher on redis failed");
+            reply(Json::nullValue);
+            return;
+        }
+        amqp_->broadcast(room_cache_->addClient(client->room_id, *client));
 
-    Json::Value data;
-    for (const Publisher &publisher : publishers)
-    {
-        Json::Value temp;
-        temp["id"] = publisher.id;
-        temp["audio"] = true;
-        temp["video"] = true;
-        temp["data"] = true;
-        temp["label"] = publisher.label;
-        temp["screen"] = Json::stringValue;
-        data["streams"].append(temp);
-    }
-    data["id"] = client.room_id;
-    data["clientId"] = client.id;
-    data["singlePC"] = false;
-    data["defaultVideoBW"] = 300;
-    data["maxVideoBW"] = 300;
-    Json::Value ice_data;
-    ice_data["url"] = "stun:stun.l.google.com:19302";
-    Json::Value ice;
-    ice[0] = ice_data;
-    data["iceServers"] = ice;
-    Json::Value reply;
-    reply[0] = "success";
-    reply[1] = data;
-    return reply;
+        Json::Value data;
+        for (const Publisher &publisher : publishers)
+        {
+            Json::Value temp;
+            temp["id"] = publisher.id;
+            temp["audio"] = true;
+            temp["video"] = true;
+            temp["data"] = true;
+            temp["label"] = publisher.label;
+            temp["screen"] = Json::stringValue;
+            data["streams"].append(temp);
+        }
+        data["id"] = client->room_id;
+        data["clientId"] = client->id;
+        data["singlePC"] = false;
+        data["defaultVideoBW"] = 300;
+        data["maxVideoBW"] = 300;
+        Json::Value ice_data;
+        ice_data["url"] = "stun:stun.l.google.com:19302";
+        Json::Value ice;
+        ice[0] = ice_data;
+        data["iceServers"] = ice;
+        Json::Value res;
+        res[0] = "success";
+        res[1] = data;
+        reply(res);
+    });
 }
 
-Json::Value ErizoController::handlePublish(Client &client, const Json::Value &root)
+void ErizoController::handlePublish(const std::shared_ptr<Client> &client, const Json::Value &root, const Reply &reply)
 {
     if (!root.isMember("label") ||
         root["label"].type() != Json::stringValue)
     {
         ELOG_ERROR("Publish data format error");
-        return Json::nullValue;
+        reply(Json::nullValue);
+        return;
     }
 
     std::string label = root["label"].asString();
     Publisher publisher;
     publisher.id = Utils::getStreamID();
-    publisher.erizo_id = client.erizo_id;
-    publisher.bridge_ip = client.bridge_ip;
-    publisher.bridge_port = client.bridge_port;
-    publisher.agent_id = client.agent_id;
-    publisher.client_id = client.id;
+    publisher.erizo_id = client->erizo_id;
+    publisher.bridge_ip = client->bridge_ip;
+    publisher.bridge_port = client->bridge_port;
+    publisher.agent_id = client->agent_id;
+    publisher.client_id = client->id;
     publisher.label = label;
 
-    RedisLocker redis_locker;
-    if (!redis_locker.lock(client.room_id))
-    {
-        ELOG_ERROR("get redis locker failed when handle-publish");
-        return Json::nullValue;
-    }
-
-    if (RedisHelper::addPublisher(client.room_id, publisher))
-    {
-        ELOG_ERROR("add publisher to redis failed");
-        return Json::nullValue;
-    }
+    RedisHelper::asyncAddPublisher(getContext(client->id).redis, client->room_id, publisher,
+                                   [this, client, publisher, reply](int err) {
+        if (err)
+        {
+            ELOG_ERROR("add publisher to redis failed");
+            reply(Json::nullValue);
+            return;
+        }
+        amqp_->broadcast(room_cache_->addPublisher(client->room_id, publisher));
 
-    addPublisher(client, publisher);
+        addPublisher(*client, publisher);
 
-    Json::Value reply;
-    reply[0] = publisher.id;
-    reply[1] = publisher.erizo_id;
-    return reply;
+        Json::Value res;
+        res[0] = publisher.id;
+        res[1] = publisher.erizo_id;
+        reply(res);
+    });
 }
 
-Json::Value ErizoController::handleSubscribe(Client &client, const Json::Value &root)
+void ErizoController::handleSubscribe(const std::shared_ptr<Client> &client, const Json::Value &root, const Reply &reply)
 {
     if (!root.isMember("streamId") ||
         root["streamId"].type() != Json::stringValue)
     {
         ELOG_ERROR("json parse streamId failed,dump %s", Utils::dumpJson(root));
-        return Json::nullValue;
-    }
-
-    int try_time = 10;
-again:
-    RedisLocker redis_locker;
-    if (!redis_locker.lock(client.room_id))
-    {
-        ELOG_ERROR("get redis locker failed when handle-subscribe");
-        return Json::nullValue;
+        reply(Json::nullValue);
+        return;
     }
 
     std::string stream_id = root["streamId"].asString();
-    Publisher publisher;
-    if (RedisHelper::getPublisher(client.room_id, stream_id, publisher))
-    {
-        ELOG_ERROR("get publisher from redis failed");
-        return Json::nullValue;
-    }
-
-    if (publisher.video_ssrc == 0 || publisher.audio_ssrc == 0)
-    {
-        if (try_time--)
-        {
-            usleep(100000); //100ms
-            goto again;
-        }
-        return Json::nullValue;
-    }
-
-    bool is_bridge = !(client.agent_id == publisher.agent_id);
     Subscriber subscriber;
     subscriber.id = Utils::getStreamID();
-    subscriber.client_id = client.id;
-    subscriber.erizo_id = client.erizo_id;
-    subscriber.agent_id = client.agent_id;
+    subscriber.client_id = client->id;
+    subscriber.erizo_id = client->erizo_id;
+    subscriber.agent_id = client->agent_id;
     subscriber.subscribe_to = stream_id;
     subscriber.reply_to = amqp_signaling_->getReplyTo();
-    subscriber.is_bridge = is_bridge;
+    subscriber.is_bridge = false;
+
+    //跨agent订阅时使用,sender_*由脚本按publisher填写
+    BridgeStream bridge_stream;
+    bridge_stream.id = Utils::getStreamID();
+    bridge_stream.sender_port = 0;
+    bridge_stream.recver_erizo_id = client->erizo_id;
+    bridge_stream.recver_ip = client->bridge_ip;
+    bridge_stream.recver_port = client->bridge_port;
+    bridge_stream.src_stream_id = stream_id;
+    bridge_stream.subscribe_count = 0;
+
+    trySubscribe(client, stream_id, subscriber, bridge_stream, 10, reply);
+}
 
-    if (RedisHelper::addSubscriber(client.room_id, subscriber))
-    {
-        ELOG_ERROR("add subscriber to redis failed");
-        return Json::nullValue;
-    }
+void ErizoController::trySubscribe(const std::weak_ptr<Client> &weak_client, const std::string &stream_id, const Subscriber &subscriber,
+                                   const BridgeStream &bridge_stream, int try_time, const Reply &reply)
+{
+    std::shared_ptr<Client> client = weak_client.lock();
+    if (client == nullptr)
+        return;
 
-    if (is_bridge)
-    {
-        std::vector<BridgeStream> bridge_streams;
-        if (RedisHelper::getAllBridgeStream(client.room_id, bridge_streams))
+    //publisher的ssrc由publisher_answer写入,之前不能订阅
+    const WorkerContext &context = getContext(client->id);
+    std::shared_ptr<erizo::Worker> worker = context.worker;
+    RedisHelper::asyncSubscribe(context.redis, client->room_id, stream_id, subscriber, bridge_stream,
+                                [=](int err, RedisHelper::SubscribeResult &result) {
+        if (err)
         {
-            redis_locker.unlock();
-            ELOG_ERROR("getall bridge-stream from redis failed");
-            return Json::nullValue;
+            ELOG_ERROR("subscribe on redis failed");
+            reply(Json::nullValue);
+            return;
         }
-
-        auto it = std::find_if(bridge_streams.begin(), bridge_streams.end(), [&stream_id, &subscriber](const BridgeStream &bridge_stream) {
-            if (bridge_stream.src_stream_id == subscriber.subscribe_to && bridge_stream.recver_erizo_id == subscriber.erizo_id)
-                return true;
-            return false;
-        });
-        if (it == bridge_streams.end())
+        if (!result.ready)
         {
-            BridgeStream bridge_stream;
-            bridge_stream.id = Utils::getStreamID();
-            bridge_stream.sender_erizo_id = publisher.erizo_id;
-            bridge_stream.sender_ip = publisher.bridge_ip;
-            bridge_stream.sender_port = publisher.bridge_port;
-            bridge_stream.recver_erizo_id = client.erizo_id;
-            bridge_stream.recver_ip = client.bridge_ip;
-            bridge_stream.recver_port = client.bridge_port;
-            bridge_stream.src_stream_id = stream_id;
-            bridge_stream.subscribe_count = 1;
-
-            Publisher publisher;
-            if (RedisHelper::getPublisher(client.room_id, bridge_stream.src_stream_id, publisher))
+            if (!try_time)
             {
-                ELOG_ERROR("get publisher from redis failed");
-                return Json::nullValue;
-            }
-
-            if (RedisHelper::addBridgeStream(client.room_id, bridge_stream))
-            {
-                ELOG_ERROR("add bridge-stream to redis failed");
-                return Json::nullValue;
+                reply(Json::nullValue);
+                return;
             }
-
-            addVirtualPublisher(publisher, bridge_stream);
-            addVirtualSubscriber(bridge_stream);
+            worker->scheduleFromNow([=]() {
+                trySubscribe(weak_client, stream_id, subscriber, bridge_stream, try_time - 1, reply);
+            }, std::chrono::milliseconds(100));
+            return;
         }
-        else
+
+        const Publisher &publisher = result.publisher;
+        if (result.bridge_stream_created)
         {
-            BridgeStream bridge_stream = *it;
-            bridge_stream.subscribe_count++;
-            if (RedisHelper::addBridgeStream(client.room_id, bridge_stream))
-            {
-                ELOG_ERROR("add bridge-stream to redis failed");
-                return Json::nullValue;
-            }
+            addVirtualPublisher(publisher, result.bridge_stream);
+            addVirtualSubscriber(result.bridge_stream);
         }
-    }
 
-    addSubscriber(client, publisher, subscriber);
+        addSubscriber(*client, publisher, result.subscriber);
 
-    Json::Value reply;
-    reply[0] = true;
-    reply[1] = subscriber.erizo_id;
-    return reply;
+        Json::Value res;
+        res[0] = true;
+        res[1] = result.subscriber.erizo_id;
+        reply(res);
+    });
 }
 
 void ErizoController::handleSignaling(Client &client, const Json::Value &root)
@@ -936,164 +983,57 @@ void ErizoController::removeVirtualSubscriber(const BridgeStream &bridge_stream)
     amqp_->rpcNotReply(queuename, data);
 }
 
-int ErizoController::removeBridgeStreamSub(const std::string &room_id, const std::string &subscribe_to, const std::string &erizo_id)
+void ErizoController::removeExpireErizoController(const std::string &erizo_controller_id)
 {
-    std::vector<BridgeStream> bridge_streams;
-    if (RedisHelper::getAllBridgeStream(room_id, bridge_streams))
-    {
-        ELOG_ERROR("getall bridge-stream from redis failed");
-        return 1;
-    }
-
-    auto it = std::find_if(bridge_streams.begin(), bridge_streams.end(), [&subscribe_to, &erizo_id](const BridgeStream &s) {
-        if (s.src_stream_id == subscribe_to && s.recver_erizo_id == erizo_id)
-            return true;
-        return false;
-    });
-
-    if (it != bridge_streams.end())
-    {
-        BridgeStream bridge_stream = *it;
-        bridge_stream.subscribe_count--;
-        if (bridge_stream.subscribe_count <= 0)
+    RedisHelper::asyncGetAllClientFromEC(getContext(erizo_controller_id).redis, erizo_controller_id,
+                                         [this, erizo_controller_id](int err, std::vector<Client> &clients) {
+        if (err)
         {
-            removeVirtualSubscriber(bridge_stream);
-            removeVirtualPublisher(bridge_stream);
-
-            if (RedisHelper::removeBridgeStream(room_id, bridge_stream.id))
-            {
-                ELOG_ERROR("remove bridge-stream on redis failed");
-                return 1;
-            }
+            ELOG_ERROR("getall client of %s from redis failed", erizo_controller_id);
+            return;
         }
-        else
+        for (const Client &client : clients)
         {
-            if (RedisHelper::addBridgeStream(room_id, bridge_stream))
-            {
-                ELOG_ERROR("add bridge-stream to redis failed");
-                return 1;
-            }
+            getContext(client.id).worker->task([this, client]() {
+                removeClient(client);
+            });
         }
-    }
-    return 0;
+    });
 }
 
-int ErizoController::removeBridgeStreamPub(const std::string &room_id, const std::string &stream_id, const std::string &erizo_id)
+void ErizoController::removeClient(const Client &client)
 {
-    std::vector<BridgeStream> bridge_streams;
-    if (RedisHelper::getAllBridgeStream(room_id, bridge_streams))
-    {
-        ELOG_ERROR("getall bridge-stream from redis failed");
-        return 1;
-    }
-
-    auto it = std::find_if(bridge_streams.begin(), bridge_streams.end(), [&stream_id, &erizo_id](const BridgeStream &s) {
-        if (s.src_stream_id == stream_id && s.sender_erizo_id == erizo_id)
-            return true;
-        return false;
-    });
-
-    if (it != bridge_streams.end())
-    {
-        BridgeStream bridge_stream = *it;
-        removeVirtualSubscriber(bridge_stream);
-        removeVirtualPublisher(bridge_stream);
-        if (RedisHelper::removeBridgeStream(room_id, bridge_stream.id))
+    //删除此客户端订阅的流、其他客户端订阅此客户端的流和此客户端推送的流,
+    //同时从此erizo_controller维护的redis集合中删除该用户信息
+    RedisHelper::asyncRemoveClientFromRoom(getContext(client.id).redis, client.room_id, client.reply_to, client.id,
+                                           [this, client](int err, RedisHelper::RemovedRecords &removed) {
+        if (err)
         {
-            ELOG_ERROR("remove bridge-stream on redis failed");
-            return 1;
+            ELOG_ERROR("remove client from redis failed");
+            return;
         }
-    }
-    return 0;
-}
-
-void ErizoController::removeExpireErizoController(const std::string &erizo_controller_id)
-{
-    std::vector<Client> clients;
-    if (RedisHelper::getAllClientFromEC(erizo_controller_id, clients))
-        return;
-
-    for (const Client &client : clients)
-        removeClient(client);
+        onClientRemoved(client, removed.subscribers, removed.publishers, removed.bridge_streams);
+    });
 }
 
-void ErizoController::removeClient(const Client &client)
+void ErizoController::onClientRemoved(const Client &client, const std::vector<Subscriber> &subscribers,
+                                      const std::vector<Publisher> &publishers, const std::vector<BridgeStream> &bridge_streams)
 {
-    std::vector<Subscriber> subscribers;
-    std::vector<Publisher> publishers;
-    std::vector<std::string> subscribers_to_del;
-    std::vector<std::string> publishers_to_del;
+    amqp_->broadcast(room_cache_->removeClient(client.room_id, client.id, publishers));
 
-    RedisLocker redis_locker;
-    if (!redis_locker.lock(client.room_id))
-    {
-        ELOG_ERROR("get redis locker failed when on-close");
-        return;
-    }
-    if (RedisHelper::getAllSubscriber(client.room_id, subscribers))
+    //引用计数归零或源流被删除的bridge-stream
+    for (const BridgeStream &bridge_stream : bridge_streams)
     {
-        ELOG_ERROR("getall subscriber from redis failed");
-        return;
+        removeVirtualSubscriber(bridge_stream);
+        removeVirtualPublisher(bridge_stream);
     }
 
-    if (RedisHelper::getAllPublisher(client.room_id, publishers))
-    {
-        ELOG_ERROR("getall publisher from redis failed");
-        return;
-    }
     for (const Subscriber &subscriber : subscribers)
     {
-        for (const Publisher &publisher : publishers)
-        {
-            //删除其他客户端订阅此客户端的流
-            if (publisher.client_id == client.id && subscriber.subscribe_to == publisher.id)
-            {
-                subscribers_to_del.push_back(subscriber.id);
-                if (subscriber.is_bridge && removeBridgeStreamSub(client.room_id, subscriber.subscribe_to, subscriber.erizo_id))
-                {
-                    ELOG_ERROR("remove bridge-stream-sub on redis failed");
-                    return;
-                }
-                removeSubscriber(subscriber);
-                notifyToRemoveSubscriber(subscriber);
-            }
-        }
-        //删除此客户端订阅的流
-        if (subscriber.client_id == client.id)
-        {
-            subscribers_to_del.push_back(subscriber.id);
-            if (subscriber.is_bridge && removeBridgeStreamSub(client.room_id, subscriber.subscribe_to, subscriber.erizo_id))
-            {
-                ELOG_ERROR(" remove bridge-stream-sub on redis failed");
-                return;
-            }
-            removeSubscriber(subscriber);
-            notifyToRemoveSubscriber(subscriber);
-        }
+        removeSubscriber(subscriber);
+        notifyToRemoveSubscriber(subscriber);
     }
 
     for (const Publisher &publisher : publishers)
-    {
-        //删除此客户端推送的流
-        if (publisher.client_id == client.id)
-        {
-            publishers_to_del.push_back(publisher.id);
-            if (removeBridgeStreamPub(client.room_id, publisher.id, publisher.erizo_id))
-            {
-                ELOG_ERROR("remove bridge-stream-pub on redis failed");
-                return;
-            }
-            removePublisher(publisher);
-        }
-    }
-
-    if (!subscribers_to_del.empty())
-        RedisHelper::removeSubscribers(client.room_id, subscribers_to_del);
-
-    if (!publishers_to_del.empty())
-        RedisHelper::removePublishers(client.room_id, publishers_to_del);
-
-    RedisHelper::removeClient(client.room_id, client.id);
-    //从此erizo_controller维护的redis集合中删除该用户信息
-    RedisHelper::removeClientFromEC(client.reply_to, client.id);
-}
\ No newline at end of file
+        removePublisher(publisher);
+}
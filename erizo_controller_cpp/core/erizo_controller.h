@@ -5,6 +5,7 @@
 #include <memory>
 #include <atomic>
 #include <functional>
+#include <vector>
 
 #include <json/json.h>
 
@@ -18,10 +19,15 @@ class AMQPRPC;
 class AMQPRecv;
 class SocketIOServer;
 class SocketIOClientHandler;
+class RoomCache;
+class AgentRegistry;
+class AgentPlacement;
+class AsyncRedis;
 
 namespace erizo
 {
 class ThreadPool;
+class Worker;
 }
 
 class ErizoController
@@ -70,17 +76,32 @@ public:
   void close();
 
 private:
+  //每个worker一条非阻塞redis连接,同一个client的消息总是由同一个worker处理,保证顺序
+  struct WorkerContext
+  {
+    std::shared_ptr<erizo::Worker> worker;
+    std::shared_ptr<AsyncRedis> redis;
+  };
+
+  //异步处理完成后回复客户端,nullValue表示断开连接
+  typedef std::function<void(const Json::Value &reply)> Reply;
+
   ErizoController();
 
+  const WorkerContext &getContext(const std::string &client_id);
+
   void notifyToSubscribe(const std::string &room_id,
                          const std::string &client_id,
                          const std::string &stream_id);
 
   void asyncTask(const std::function<void()> &func);
 
-  int allocAgent(Client &client);
+  //在client对应的worker线程里调用,cb也在该线程里调用
+  void allocAgent(const std::shared_ptr<Client> &client, const std::function<void(int err)> &cb);
+  int placeAgent(Client &client, const std::string &area_name, const std::vector<std::string> &room_agents);
 
-  int allocErizo(Client &client);
+  //cb在client对应的worker线程里调用
+  void allocErizo(const std::shared_ptr<Client> &client, const std::function<void(int err)> &cb);
 
   void addPublisher(const Client &client, const Publisher &publisher);
   void removePublisher(const Publisher &publisher);
@@ -103,23 +124,31 @@ private:
 
   void onSignalingMessage(const std::string &msg);
 
-  std::string onMessage(SocketIOClientHandler *hdl, const std::string &msg);
+  void onBoardcastMessage(const std::string &msg);
+
+  std::string onMessage(SocketIOClientHandler *hdl, int mid, const std::string &msg);
 
   void onClose(SocketIOClientHandler *hdl);
 
-  Json::Value handleToken(Client &client, const Json::Value &root);
+  //以下在client对应的worker线程里执行
+  void handleToken(const std::shared_ptr<Client> &client, const Json::Value &root, const Reply &reply);
+  void addClientAndReply(const std::shared_ptr<Client> &client, const Reply &reply);
 
-  Json::Value handlePublish(Client &client, const Json::Value &root);
+  void handlePublish(const std::shared_ptr<Client> &client, const Json::Value &root, const Reply &reply);
 
-  Json::Value handleSubscribe(Client &client, const Json::Value &root);
+  void handleSubscribe(const std::shared_ptr<Client> &client, const Json::Value &root, const Reply &reply);
+  //publisher还没有ssrc时每100ms重试,client断开后放弃
+  void trySubscribe(const std::weak_ptr<Client> &weak_client, const std::string &stream_id, const Subscriber &subscriber,
+                    const BridgeStream &bridge_stream, int try_time, const Reply &reply);
 
   void handleSignaling(Client &client, const Json::Value &root);
 
-  int removeBridgeStreamPub(const std::string &room_id, const std::string &stream_id, const std::string &erizo_id);
-  int removeBridgeStreamSub(const std::string &room_id, const std::string &subscribe_to, const std::string &erizo_id);
-
   void removeExpireErizoController(const std::string &erizo_controller_id);
+  //在client对应的worker线程里调用
   void removeClient(const Client &client);
+  //通知erizo删除redis中已经删除的记录
+  void onClientRemoved(const Client &client, const std::vector<Subscriber> &subscribers,
+                       const std::vector<Publisher> &publishers, const std::vector<BridgeStream> &bridge_streams);
 
 private:
   std::string id_;
@@ -129,7 +158,12 @@ private:
   std::shared_ptr<SocketIOServer> socket_io_;
   std::shared_ptr<AMQPRPC> amqp_;
   std::shared_ptr<AMQPRecv> amqp_signaling_;
+  std::shared_ptr<AMQPRecv> amqp_boardcast_;
+  std::unique_ptr<RoomCache> room_cache_;
+  std::unique_ptr<AgentRegistry> agent_registry_;
+  std::unique_ptr<AgentPlacement> agent_placement_;
   std::unique_ptr<erizo::ThreadPool> thread_pool_;
+  std::vector<WorkerContext> contexts_;
   bool init_;
 
   static ErizoController *instance_;
@@ -0,0 +1,294 @@
+#include "room_cache.h"
+
+#include "redis/redis_helper.h"
+#include "common/utils.h"
+#include "common/config.h"
+
+DEFINE_LOGGER(RoomCache, "RoomCache");
+
+RoomCache::RoomCache(const std::string &origin) : origin_(origin),
+                                                  ttl_((uint64_t)Config::getInstance()->room_cache_ttl),
+                                                  epoch_(0)
+{
+}
+
+template <typename T>
+void RoomCache::load(const std::string &room_id, Slot<T> Room::*slot,
+                     const std::function<void(const Callback<T> &)> &fetch, const Callback<T> &cb)
+{
+    if (ttl_ == 0)
+    {
+        fetch(cb);
+        return;
+    }
+
+    uint64_t version, epoch;
+    {
+        std::unique_lock<std::mutex> lock(mux_);
+        Slot<T> &s = rooms_[room_id].*slot;
+        if (s.valid && Utils::getCurrentMs() - s.load_time < ttl_)
+        {
+            std::vector<T> items;
+            for (auto &it : s.items)
+                items.push_back(it.second);
+            lock.unlock();
+            cb(0, items);
+            return;
+        }
+        version = s.version;
+        epoch = epoch_;
+    }
+
+    fetch([this, room_id, slot, version, epoch, cb](int err, std::vector<T> &items) {
+        {
+            std::unique_lock<std::mutex> lock(mux_);
+            //房间已经释放(epoch变化)时不重新创建
+            auto room = rooms_.find(room_id);
+            if (room != rooms_.end() && epoch_ == epoch)
+            {
+                Slot<T> &s = room->second.*slot;
+                //加载期间有变更,结果可能已经过时,不放入缓存
+                if (!err && s.version == version)
+                {
+                    s.items.clear();
+                    for (const T &item : items)
+                        s.items[item.id] = item;
+                    s.valid = true;
+                    s.load_time = Utils::getCurrentMs();
+                }
+                else
+                {
+                    releaseIfUnused(room);
+                }
+            }
+        }
+        cb(err, items);
+    });
+}
+
+void RoomCache::getAllClient(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id, const Callback<Client> &cb)
+{
+    load<Client>(room_id, &Room::clients, [redis, room_id](const Callback<Client> &done) {
+        RedisHelper::asyncGetAllClient(redis, room_id, done);
+    }, cb);
+}
+
+void RoomCache::getAllPublisher(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id, const Callback<Publisher> &cb)
+{
+    load<Publisher>(room_id, &Room::publishers, [redis, room_id](const Callback<Publisher> &done) {
+        RedisHelper::asyncGetAllPublisher(redis, room_id, done);
+    }, cb);
+}
+
+void RoomCache::getPublisher(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id, const std::string &publisher_id,
+                             const std::function<void(int err, Publisher &publisher)> &cb)
+{
+    getAllPublisher(redis, room_id, [redis, room_id, publisher_id, cb](int err, std::vector<Publisher> &publishers) {
+        if (err)
+        {
+            Publisher publisher;
+            cb(err, publisher);
+            return;
+        }
+        for (Publisher &p : publishers)
+        {
+            if (p.id == publisher_id)
+            {
+                cb(0, p);
+                return;
+            }
+        }
+        //可能是其他erizo_controller刚写入、广播还没到,直接查redis
+        RedisHelper::asyncGetPublisher(redis, room_id, publisher_id, cb);
+    });
+}
+
+Json::Value RoomCache::makeChange(const std::string &room_id, const std::string &op)
+{
+    Json::Value change;
+    change["type"] = "room_change";
+    change["origin"] = origin_;
+    change["roomId"] = room_id;
+    change["op"] = op;
+    return change;
+}
+
+Json::Value RoomCache::addClient(const std::string &room_id, const Client &client)
+{
+    doAddClient(room_id, client);
+    Json::Value change = makeChange(room_id, "add_client");
+    change["client"] = client.toJSON();
+    return change;
+}
+
+Json::Value RoomCache::addPublisher(const std::string &room_id, const Publisher &publisher)
+{
+    doAddPublisher(room_id, publisher);
+    Json::Value change = makeChange(room_id, "add_publisher");
+    change["publisher"] = publisher.toJSON();
+    return change;
+}
+
+Json::Value RoomCache::setPublisherSsrc(const std::string &room_id, const std::string &publisher_id, uint32_t video_ssrc, uint32_t audio_ssrc)
+{
+    doSetPublisherSsrc(room_id, publisher_id, video_ssrc, audio_ssrc);
+    Json::Value change = makeChange(room_id, "set_publisher_ssrc");
+    change["publisherId"] = publisher_id;
+    change["videoSSRC"] = video_ssrc;
+    change["audioSSRC"] = audio_ssrc;
+    return change;
+}
+
+Json::Value RoomCache::removeClient(const std::string &room_id, const std::string &client_id, const std::vector<Publisher> &publishers)
+{
+    std::vector<std::string> publisher_ids;
+    Json::Value ids = Json::arrayValue;
+    for (const Publisher &p : publishers)
+    {
+        publisher_ids.push_back(p.id);
+        ids.append(p.id);
+    }
+    doRemoveClient(room_id, client_id, publisher_ids);
+
+    Json::Value change = makeChange(room_id, "remove_client");
+    change["clientId"] = client_id;
+    change["publisherIds"] = ids;
+    return change;
+}
+
+void RoomCache::applyChange(const Json::Value &change)
+{
+    if (!change.isMember("origin") || change["origin"].type() != Json::stringValue ||
+        !change.isMember("roomId") || change["roomId"].type() != Json::stringValue ||
+        !change.isMember("op") || change["op"].type() != Json::stringValue)
+    {
+        ELOG_ERROR("json parse [origin/roomId/op] failed,dump %s", Utils::dumpJson(change));
+        return;
+    }
+    if (change["origin"].asString() == origin_)
+        return;
+
+    std::string room_id = change["roomId"].asString();
+    std::string op = change["op"].asString();
+    if (op == "add_client")
+    {
+        Client client;
+        if (!change.isMember("client") || change["client"].type() != Json::stringValue ||
+            Client::fromJSON(change["client"].asString(), client))
+        {
+            ELOG_ERROR("json parse client failed,dump %s", Utils::dumpJson(change));
+            return;
+        }
+        doAddClient(room_id, client);
+    }
+    else if (op == "add_publisher")
+    {
+        Publisher publisher;
+        if (!change.isMember("publisher") || change["publisher"].type() != Json::stringValue ||
+            Publisher::fromJSON(change["publisher"].asString(), publisher))
+        {
+            ELOG_ERROR("json parse publisher failed,dump %s", Utils::dumpJson(change));
+            return;
+        }
+        doAddPublisher(room_id, publisher);
+    }
+    else if (op == "set_publisher_ssrc")
+    {
+        if (!change.isMember("publisherId") || change["publisherId"].type() != Json::stringValue ||
+            !change.isMember("videoSSRC") || !change.isMember("audioSSRC"))
+        {
+            ELOG_ERROR("json parse [publisherId/videoSSRC/audioSSRC] failed,dump %s", Utils::dumpJson(change));
+            return;
+        }
+        doSetPublisherSsrc(room_id, change["publisherId"].asString(),
+                           change["videoSSRC"].asUInt(), change["audioSSRC"].asUInt());
+    }
+    else if (op == "remove_client")
+    {
+        if (!change.isMember("clientId") || change["clientId"].type() != Json::stringValue ||
+            !change.isMember("publisherIds") || change["publisherIds"].type() != Json::arrayValue)
+        {
+            ELOG_ERROR("json parse [clientId/publisherIds] failed,dump %s", Utils::dumpJson(change));
+            return;
+        }
+        std::vector<std::string> publisher_ids;
+        const Json::Value &ids = change["publisherIds"];
+        for (Json::Value::ArrayIndex i = 0; i < ids.size(); i++)
+            publisher_ids.push_back(ids[i].asString());
+        doRemoveClient(room_id, change["clientId"].asString(), publisher_ids);
+    }
+}
+
+//修改时总是增加版本号,正在进行的加载会被丢弃;缓存无效时不需要修改内容
+//广播会发给所有erizo_controller,没有缓存也没有在加载的房间(不在rooms_中)直接跳过,不创建
+void RoomCache::doAddClient(const std::string &room_id, const Client &client)
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    auto room = rooms_.find(room_id);
+    if (room == rooms_.end())
+        return;
+    Slot<Client> &s = room->second.clients;
+    s.version++;
+    if (s.valid)
+        s.items[client.id] = client;
+}
+
+void RoomCache::doAddPublisher(const std::string &room_id, const Publisher &publisher)
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    auto room = rooms_.find(room_id);
+    if (room == rooms_.end())
+        return;
+    Slot<Publisher> &s = room->second.publishers;
+    s.version++;
+    if (s.valid)
+        s.items[publisher.id] = publisher;
+}
+
+void RoomCache::doSetPublisherSsrc(const std::string &room_id, const std::string &publisher_id, uint32_t video_ssrc, uint32_t audio_ssrc)
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    auto room = rooms_.find(room_id);
+    if (room == rooms_.end())
+        return;
+    Slot<Publisher> &s = room->second.publishers;
+    s.version++;
+    auto it = s.items.find(publisher_id);
+    if (s.valid && it != s.items.end())
+    {
+        it->second.video_ssrc = video_ssrc;
+        it->second.audio_ssrc = audio_ssrc;
+    }
+}
+
+void RoomCache::doRemoveClient(const std::string &room_id, const std::string &client_id, const std::vector<std::string> &publisher_ids)
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    auto room = rooms_.find(room_id);
+    if (room == rooms_.end())
+        return;
+
+    Slot<Client> &clients = room->second.clients;
+    Slot<Publisher> &publishers = room->second.publishers;
+    clients.version++;
+    clients.items.erase(client_id);
+    publishers.version++;
+    for (const std::string &id : publisher_ids)
+        publishers.items.erase(id);
+
+    //房间已空,释放缓存
+    if (clients.valid && clients.items.empty())
+    {
+        rooms_.erase(room);
+        epoch_++;
+    }
+}
+
+//两类数据都没有缓存时释放房间,正在进行的加载因epoch变化不会再放入
+void RoomCache::releaseIfUnused(std::map<std::string, Room>::iterator room)
+{
+    if (room->second.clients.valid || room->second.publishers.valid)
+        return;
+    rooms_.erase(room);
+    epoch_++;
+}
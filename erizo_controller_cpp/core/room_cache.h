@@ -0,0 +1,88 @@
+#ifndef ROOM_CACHE_H
+#define ROOM_CACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <functional>
+
+#include <json/json.h>
+
+#include "common/logger.h"
+#include "model/client.h"
+#include "model/publisher.h"
+
+class AsyncRedis;
+
+//进程内的房间状态缓存(client/publisher),减少信令路径上对redis的整房间读取
+//本进程写redis之后同步更新缓存,并把变更广播给其他erizo_controller(applyChange)
+//每类数据带版本号,加载期间有变更时丢弃加载结果;超过room_cache_ttl重新加载,兜底丢失的广播
+//bridge-stream的查询和修改都在RoomScripts里完成,不在这里缓存
+class RoomCache
+{
+  DECLARE_LOGGER();
+
+  template <typename T>
+  struct Slot
+  {
+    bool valid;
+    uint64_t version;
+    uint64_t load_time;
+    std::map<std::string, T> items;
+    Slot() : valid(false),
+             version(0),
+             load_time(0) {}
+  };
+
+  struct Room
+  {
+    Slot<Client> clients;
+    Slot<Publisher> publishers;
+  };
+
+  template <typename T>
+  using Callback = std::function<void(int err, std::vector<T> &items)>;
+
+public:
+  explicit RoomCache(const std::string &origin);
+
+  //在worker线程里调用,命中时直接回调,未命中时通过该worker的AsyncRedis加载,回调在同一个线程里执行
+  void getAllClient(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id, const Callback<Client> &cb);
+  void getAllPublisher(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id, const Callback<Publisher> &cb);
+  void getPublisher(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id, const std::string &publisher_id,
+                    const std::function<void(int err, Publisher &publisher)> &cb);
+
+  //以下在redis写入成功后调用,返回需要广播的变更
+  Json::Value addClient(const std::string &room_id, const Client &client);
+  Json::Value addPublisher(const std::string &room_id, const Publisher &publisher);
+  Json::Value setPublisherSsrc(const std::string &room_id, const std::string &publisher_id, uint32_t video_ssrc, uint32_t audio_ssrc);
+  Json::Value removeClient(const std::string &room_id, const std::string &client_id, const std::vector<Publisher> &publishers);
+
+  //其他erizo_controller广播的变更,自己发出的忽略
+  void applyChange(const Json::Value &change);
+
+private:
+  template <typename T>
+  void load(const std::string &room_id, Slot<T> Room::*slot,
+            const std::function<void(const Callback<T> &)> &fetch, const Callback<T> &cb);
+
+  Json::Value makeChange(const std::string &room_id, const std::string &op);
+  //持有mux_时调用
+  void releaseIfUnused(std::map<std::string, Room>::iterator room);
+
+  void doAddClient(const std::string &room_id, const Client &client);
+  void doAddPublisher(const std::string &room_id, const Publisher &publisher);
+  void doSetPublisherSsrc(const std::string &room_id, const std::string &publisher_id, uint32_t video_ssrc, uint32_t audio_ssrc);
+  void doRemoveClient(const std::string &room_id, const std::string &client_id, const std::vector<std::string> &publisher_ids);
+
+private:
+  std::string origin_;
+  uint64_t ttl_;
+  std::mutex mux_;
+  std::map<std::string, Room> rooms_;
+  uint64_t epoch_; //每次释放房间时增加,释放后重建的Slot版本号从0开始
+};
+
+#endif
@@ -1,25 +1,26 @@
 #include <signal.h>
+#include <pthread.h>
 
 #include "common/utils.h"
 #include "common/logger.h"
 #include "common/config.h"
 #include "route/route.h"
 #include "redis/acl_redis.h"
+#include "redis/redis_helper.h"
+#include "model/binary_codec.h"
 #include "core/erizo_controller.h"
 
 LOGGER_DECLARE()
 
-static bool run = true;
-
-void signal_handler(int signo)
-{
-  run = false;
-}
-
 int main()
 {
   srand(time(0));
-  signal(SIGINT, signal_handler);
+  //先屏蔽信号再创建线程,之后创建的线程都继承该掩码,信号只由主线程sigwait处理
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
 
   LOGGER_INIT();
 
@@ -41,20 +42,35 @@ int main()
     return 1;
   }
 
+  BinaryCodec::enabled() = (Config::getInstance()->redis_record_format == "binary");
+
   if (ACLRedis::getInstance()->init())
   {
     ELOG_ERROR("acl-redis initialize failed");
     return 1;
   }
 
+  if (RedisHelper::loadScripts())
+  {
+    ELOG_ERROR("load redis scripts failed");
+    return 1;
+  }
+
   if (ErizoController::getInstance()->init())
   {
     ELOG_ERROR("erizo-controller initialize failed");
     return 1;
   }
 
-  while (run)
-    sleep(10000);
+  while (true)
+  {
+    int signo = 0;
+    if (sigwait(&sigs, &signo))
+      continue;
+    if (signo != SIGHUP)
+      break;
+    Route::getInstance()->reload();
+  }
 
   ErizoController::getInstance()->close();
   ACLRedis::getInstance()->close();
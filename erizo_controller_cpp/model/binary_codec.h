@@ -0,0 +1,156 @@
+#ifndef BINARY_CODEC_H
+#define BINARY_CODEC_H
+
+#include <string>
+#include <stdint.h>
+
+//redis中记录的紧凑二进制格式
+//头部: magic(1字节) version(1字节) kind(1字节)
+//之后按结构体声明顺序排列字段,整数为大端定长,字符串为2字节长度前缀加内容,bool为1字节
+//room_scripts.cpp中的Lua编解码使用同样的布局,修改字段时两边要同时改
+//旧的JSON记录以'{'开头,读取时按第一个字节区分
+namespace BinaryCodec
+{
+enum Kind
+{
+    KIND_CLIENT = 1,
+    KIND_PUBLISHER = 2,
+    KIND_SUBSCRIBER = 3,
+    KIND_BRIDGE_STREAM = 4
+};
+
+const uint8_t kMagic = 0xEC;
+const uint8_t kVersion = 1;
+
+//写redis时是否使用二进制格式,读取总是两种都支持
+inline bool &enabled()
+{
+    static bool enabled = false;
+    return enabled;
+}
+
+inline bool isBinary(const std::string &data)
+{
+    return !data.empty() && (uint8_t)data[0] == kMagic;
+}
+
+class Writer
+{
+public:
+    explicit Writer(Kind kind)
+    {
+        buf_.reserve(128);
+        putU8(kMagic);
+        putU8(kVersion);
+        putU8(kind);
+    }
+
+    void putU8(uint8_t v)
+    {
+        buf_.push_back((char)v);
+    }
+
+    void putBool(bool v)
+    {
+        putU8(v ? 1 : 0);
+    }
+
+    void putU16(uint16_t v)
+    {
+        putU8(v >> 8);
+        putU8(v & 0xff);
+    }
+
+    void putU32(uint32_t v)
+    {
+        putU16(v >> 16);
+        putU16(v & 0xffff);
+    }
+
+    void putI32(int32_t v)
+    {
+        putU32((uint32_t)v);
+    }
+
+    //超过65535字节的字符串截断,记录中的字段都是id/ip一类的短字符串
+    void putString(const std::string &v)
+    {
+        size_t len = v.size() > 0xffff ? 0xffff : v.size();
+        putU16((uint16_t)len);
+        buf_.append(v, 0, len);
+    }
+
+    const std::string &str() const { return buf_; }
+
+private:
+    std::string buf_;
+};
+
+//任何读取越界都会置失败,调用方最后检查ok()
+class Reader
+{
+public:
+    Reader(const std::string &data, Kind kind) : data_(data),
+                                                 pos_(0),
+                                                 ok_(true)
+    {
+        if (getU8() != kMagic || getU8() != kVersion || getU8() != kind)
+            ok_ = false;
+    }
+
+    uint8_t getU8()
+    {
+        if (pos_ + 1 > data_.size())
+        {
+            ok_ = false;
+            return 0;
+        }
+        return (uint8_t)data_[pos_++];
+    }
+
+    bool getBool()
+    {
+        return getU8() != 0;
+    }
+
+    uint16_t getU16()
+    {
+        uint16_t hi = getU8();
+        return (hi << 8) | getU8();
+    }
+
+    uint32_t getU32()
+    {
+        uint32_t hi = getU16();
+        return (hi << 16) | getU16();
+    }
+
+    int32_t getI32()
+    {
+        return (int32_t)getU32();
+    }
+
+    std::string getString()
+    {
+        size_t len = getU16();
+        if (!ok_ || pos_ + len > data_.size())
+        {
+            ok_ = false;
+            return "";
+        }
+        std::string v = data_.substr(pos_, len);
+        pos_ += len;
+        return v;
+    }
+
+    //所有字段读完且没有多余字节
+    bool ok() const { return ok_ && pos_ == data_.size(); }
+
+private:
+    const std::string &data_;
+    size_t pos_;
+    bool ok_;
+};
+} // namespace BinaryCodec
+
+#endif
@@ -5,6 +5,8 @@
 
 #include <json/json.h>
 
+#include "binary_codec.h"
+
 struct BridgeStream
 {
     std::string id;
@@ -75,6 +77,51 @@ struct BridgeStream
         bridge_stream.subscribe_count = root["subscribe_count"].asInt();
         return 0;
     };
+
+    std::string toBinary() const
+    {
+        BinaryCodec::Writer w(BinaryCodec::KIND_BRIDGE_STREAM);
+        w.putString(id);
+        w.putString(sender_erizo_id);
+        w.putString(sender_ip);
+        w.putU16(sender_port);
+        w.putString(recver_erizo_id);
+        w.putString(recver_ip);
+        w.putU16(recver_port);
+        w.putString(src_stream_id);
+        w.putString(label);
+        w.putI32(subscribe_count);
+        return w.str();
+    }
+
+    static int fromBinary(const std::string &data, BridgeStream &bridge_stream)
+    {
+        BinaryCodec::Reader r(data, BinaryCodec::KIND_BRIDGE_STREAM);
+        bridge_stream.id = r.getString();
+        bridge_stream.sender_erizo_id = r.getString();
+        bridge_stream.sender_ip = r.getString();
+        bridge_stream.sender_port = r.getU16();
+        bridge_stream.recver_erizo_id = r.getString();
+        bridge_stream.recver_ip = r.getString();
+        bridge_stream.recver_port = r.getU16();
+        bridge_stream.src_stream_id = r.getString();
+        bridge_stream.label = r.getString();
+        bridge_stream.subscribe_count = r.getI32();
+        return r.ok() ? 0 : 1;
+    }
+
+    //写入redis的格式由BinaryCodec::enabled()决定,读取两种格式都支持
+    std::string serialize() const
+    {
+        return BinaryCodec::enabled() ? toBinary() : toJSON();
+    }
+
+    static int parse(const std::string &data, BridgeStream &bridge_stream)
+    {
+        if (BinaryCodec::isBinary(data))
+            return fromBinary(data, bridge_stream);
+        return fromJSON(data, bridge_stream);
+    }
 };
 
 #endif
\ No newline at end of file
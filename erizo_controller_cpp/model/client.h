@@ -6,6 +6,8 @@
 
 #include <json/json.h>
 
+#include "binary_codec.h"
+
 #include "route/IpTable.h"
 
 struct Client
@@ -81,6 +83,51 @@ struct Client
         client.reply_to = root["reply_to"].asString();
         return 0;
     }
+
+    std::string toBinary() const
+    {
+        BinaryCodec::Writer w(BinaryCodec::KIND_CLIENT);
+        w.putString(id);
+        w.putString(agent_id);
+        w.putString(erizo_id);
+        w.putString(bridge_ip);
+        w.putU16(bridge_port);
+        w.putString(room_id);
+        w.putString(ip);
+        w.putU16(port);
+        w.putString(family);
+        w.putString(reply_to);
+        return w.str();
+    }
+
+    static int fromBinary(const std::string &data, Client &client)
+    {
+        BinaryCodec::Reader r(data, BinaryCodec::KIND_CLIENT);
+        client.id = r.getString();
+        client.agent_id = r.getString();
+        client.erizo_id = r.getString();
+        client.bridge_ip = r.getString();
+        client.bridge_port = r.getU16();
+        client.room_id = r.getString();
+        client.ip = r.getString();
+        client.port = r.getU16();
+        client.family = r.getString();
+        client.reply_to = r.getString();
+        return r.ok() ? 0 : 1;
+    }
+
+    //写入redis的格式由BinaryCodec::enabled()决定,读取两种格式都支持
+    std::string serialize() const
+    {
+        return BinaryCodec::enabled() ? toBinary() : toJSON();
+    }
+
+    static int parse(const std::string &data, Client &client)
+    {
+        if (BinaryCodec::isBinary(data))
+            return fromBinary(data, client);
+        return fromJSON(data, client);
+    }
 };
 
 #endif
\ No newline at end of file
@@ -10,6 +10,8 @@ struct ErizoAgent
     std::string id;
     uint64_t last_update;
     int erizo_process_num;
+    int cpu_usage;       //%,旧版本agent不上报时为0
+    int bandwidth_usage; //%,出口带宽使用率,旧版本agent不上报时为0
 
     std::string toJSON() const
     {
@@ -17,6 +19,8 @@ struct ErizoAgent
         root["id"] = id;
         root["last_update"] = last_update;
         root["erizo_process_num"] = erizo_process_num;
+        root["cpu_usage"] = cpu_usage;
+        root["bandwidth_usage"] = bandwidth_usage;
 
         Json::FastWriter writer;
         return writer.write(root);
@@ -38,6 +42,8 @@ struct ErizoAgent
         agent.id = root["id"].asString();
         agent.last_update = root["last_update"].asUInt64();
         agent.erizo_process_num = root["erizo_process_num"].asInt();
+        agent.cpu_usage = root["cpu_usage"].isNumeric() ? root["cpu_usage"].asInt() : 0;
+        agent.bandwidth_usage = root["bandwidth_usage"].isNumeric() ? root["bandwidth_usage"].asInt() : 0;
         return 0;
     }
 };
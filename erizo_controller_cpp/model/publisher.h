@@ -6,6 +6,8 @@
 
 #include <json/json.h>
 
+#include "binary_codec.h"
+
 struct Publisher
 {
     std::string id;
@@ -71,5 +73,48 @@ struct Publisher
 
         return 0;
     }
+
+    std::string toBinary() const
+    {
+        BinaryCodec::Writer w(BinaryCodec::KIND_PUBLISHER);
+        w.putString(id);
+        w.putString(client_id);
+        w.putString(erizo_id);
+        w.putString(bridge_ip);
+        w.putU16(bridge_port);
+        w.putString(agent_id);
+        w.putString(label);
+        w.putU32(video_ssrc);
+        w.putU32(audio_ssrc);
+        return w.str();
+    }
+
+    static int fromBinary(const std::string &data, Publisher &publisher)
+    {
+        BinaryCodec::Reader r(data, BinaryCodec::KIND_PUBLISHER);
+        publisher.id = r.getString();
+        publisher.client_id = r.getString();
+        publisher.erizo_id = r.getString();
+        publisher.bridge_ip = r.getString();
+        publisher.bridge_port = r.getU16();
+        publisher.agent_id = r.getString();
+        publisher.label = r.getString();
+        publisher.video_ssrc = r.getU32();
+        publisher.audio_ssrc = r.getU32();
+        return r.ok() ? 0 : 1;
+    }
+
+    //写入redis的格式由BinaryCodec::enabled()决定,读取两种格式都支持
+    std::string serialize() const
+    {
+        return BinaryCodec::enabled() ? toBinary() : toJSON();
+    }
+
+    static int parse(const std::string &data, Publisher &publisher)
+    {
+        if (BinaryCodec::isBinary(data))
+            return fromBinary(data, publisher);
+        return fromJSON(data, publisher);
+    }
 };
 #endif
\ No newline at end of file
@@ -6,6 +6,8 @@
 
 #include <json/json.h>
 
+#include "binary_codec.h"
+
 struct Subscriber
 {
     std::string id;
@@ -62,6 +64,45 @@ struct Subscriber
         subscriber.is_bridge = root["is_bridge"].asBool();
         return 0;
     }
+
+    std::string toBinary() const
+    {
+        BinaryCodec::Writer w(BinaryCodec::KIND_SUBSCRIBER);
+        w.putString(id);
+        w.putString(client_id);
+        w.putString(erizo_id);
+        w.putString(agent_id);
+        w.putString(subscribe_to);
+        w.putString(reply_to);
+        w.putBool(is_bridge);
+        return w.str();
+    }
+
+    static int fromBinary(const std::string &data, Subscriber &subscriber)
+    {
+        BinaryCodec::Reader r(data, BinaryCodec::KIND_SUBSCRIBER);
+        subscriber.id = r.getString();
+        subscriber.client_id = r.getString();
+        subscriber.erizo_id = r.getString();
+        subscriber.agent_id = r.getString();
+        subscriber.subscribe_to = r.getString();
+        subscriber.reply_to = r.getString();
+        subscriber.is_bridge = r.getBool();
+        return r.ok() ? 0 : 1;
+    }
+
+    //写入redis的格式由BinaryCodec::enabled()决定,读取两种格式都支持
+    std::string serialize() const
+    {
+        return BinaryCodec::enabled() ? toBinary() : toJSON();
+    }
+
+    static int parse(const std::string &data, Subscriber &subscriber)
+    {
+        if (BinaryCodec::isBinary(data))
+            return fromBinary(data, subscriber);
+        return fromJSON(data, subscriber);
+    }
 };
 
 #endif
\ No newline at end of file
@@ -55,11 +55,8 @@ int AMQPCli::checkError(amqp_rpc_reply_t x)
     return 1;
 }
 
-int AMQPCli::init(const std::string &exchange, const std::string &type, const std::string &binding_key)
+int AMQPCli::connect()
 {
-    if (init_)
-        return 0;
-
     amqp_rpc_reply_t res;
     conn_ = amqp_new_connection();
     amqp_socket_t *socket = amqp_tcp_socket_new(conn_);
@@ -91,7 +88,18 @@ int AMQPCli::init(const std::string &exchange, const std::string &type, const st
         ELOG_ERROR("open channel failed");
         return 1;
     }
+    return 0;
+}
 
+int AMQPCli::init(const std::string &exchange, const std::string &type, const std::string &binding_key)
+{
+    if (init_)
+        return 0;
+
+    if (connect())
+        return 1;
+
+    amqp_rpc_reply_t res;
     amqp_exchange_declare(conn_, 1, amqp_cstring_bytes(exchange.c_str()),
                           amqp_cstring_bytes(type.c_str()), 0, 1, 0, 0,
                           amqp_empty_table);
@@ -151,6 +159,28 @@ int AMQPCli::init(const std::string &exchange, const std::string &type, const st
     return 0;
 }
 
+int AMQPCli::initPublisher(bool confirm)
+{
+    if (init_)
+        return 0;
+
+    if (connect())
+        return 1;
+
+    if (confirm)
+    {
+        amqp_confirm_select(conn_, 1);
+        if (checkError(amqp_get_rpc_reply(conn_)))
+        {
+            ELOG_ERROR("confirm select failed");
+            return 1;
+        }
+    }
+    init_ = true;
+
+    return 0;
+}
+
 std::string AMQPCli::stringifyBytes(amqp_bytes_t bytes)
 {
     std::ostringstream oss;
@@ -180,6 +210,9 @@ const std::string &AMQPCli::getReplyTo()
 
 void AMQPCli::close()
 {
+    if (conn_ == nullptr)
+        return;
+
     amqp_channel_close(conn_, 1, AMQP_REPLY_SUCCESS);
     amqp_connection_close(conn_, AMQP_REPLY_SUCCESS);
     amqp_destroy_connection(conn_);
@@ -15,12 +15,16 @@ public:
   ~AMQPCli();
 
   int init(const std::string &exchange, const std::string &type = "direct", const std::string &binding_key = "");
+  //只用于发送,不声明exchange和queue;confirm时开启publisher confirms
+  int initPublisher(bool confirm);
   void close();
 
   amqp_connection_state_t getConnection();
   const std::string &getReplyTo();
 
 private:
+  //建立连接、登录并打开channel 1
+  int connect();
   int checkError(amqp_rpc_reply_t x);
   std::string stringifyBytes(amqp_bytes_t bytes);
 
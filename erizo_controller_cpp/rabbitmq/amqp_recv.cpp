@@ -17,13 +17,14 @@ AMQPRecv::AMQPRecv() : reply_to_(""),
 
 AMQPRecv::~AMQPRecv() {}
 
-int AMQPRecv::init(const std::string &binding_key, const std::function<void(const std::string &msg)> &func)
+int AMQPRecv::init(const std::string &exchange, const std::string &type, const std::string &binding_key,
+                   const std::function<void(const std::string &msg)> &func)
 {
     if (init_)
         return 0;
 
     amqp_cli_ = std::unique_ptr<AMQPCli>(new AMQPCli());
-    if (amqp_cli_->init(Config::getInstance()->uniquecast_exchange, "direct", binding_key))
+    if (amqp_cli_->init(exchange, type, binding_key))
     {
         ELOG_ERROR("amqp-cli initialize failed");
         return 1;
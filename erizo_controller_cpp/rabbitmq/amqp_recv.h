@@ -19,7 +19,8 @@ public:
   AMQPRecv();
   ~AMQPRecv();
 
-  int init(const std::string &binding_key, const std::function<void(const std::string &msg)> &func);
+  int init(const std::string &exchange, const std::string &type, const std::string &binding_key,
+           const std::function<void(const std::string &msg)> &func);
   void close();
   const std::string &getReplyTo();
 
@@ -1,19 +1,28 @@
 #include "amqp_rpc.h"
 
+#include <future>
+#include <random>
+
 #include "common/config.h"
 #include "common/utils.h"
 #include "amqp_cli.h"
+#include "thread/timing_wheel.h"
 
-constexpr int kQueueSize = 256;
+constexpr int kGenerationBits = 7;
+constexpr int kSequenceBits = 24; //共31位,序号回绕前的rpc早已超时
+constexpr int kTimerTick = 5;      //ms,超时最多晚一个tick
+constexpr int kTimerSlots = 1024; //一圈约5s,rabbitmq_timeout通常在一圈以内
 
 DEFINE_LOGGER(AMQPRPC, "AMQPRPC");
 
 AMQPRPC::AMQPRPC() : reply_to_(""),
+                     generation_(std::random_device()()),
                      index_(0),
                      recv_thread_(nullptr),
-                     send_thread_(nullptr),
-                     check_thread_(nullptr),
+                     timer_(nullptr),
                      run_(false),
+                     producers_(0),
+                     sender_run_(false),
                      init_(false) {}
 
 AMQPRPC::~AMQPRPC() {}
@@ -30,8 +39,32 @@ int AMQPRPC::init(const std::string &binding_key)
         return 1;
     }
     reply_to_ = amqp_cli_->getReplyTo();
-    cb_queue_.resize(kQueueSize);
+    generation_ = (generation_ + 1) & ((1ULL << kGenerationBits) - 1);
+
+    //接收和发送不能共用连接,rabbitmq-c的连接不是线程安全的
+    for (int i = 0; i < Config::getInstance()->rabbitmq_sender_num; i++)
+    {
+        std::unique_ptr<Sender> sender(new Sender);
+        if (!sender->queue.valid())
+        {
+            ELOG_ERROR("amqp sender queue create eventfd failed");
+            return 1;
+        }
+        sender->cli = std::unique_ptr<AMQPCli>(new AMQPCli);
+        if (sender->cli->initPublisher(Config::getInstance()->rabbitmq_confirm))
+        {
+            ELOG_ERROR("amqp-cli(sender) initialize failed");
+            return 1;
+        }
+        sender->connected = true;
+        sender->delivery_tag = 0;
+        senders_.push_back(std::move(sender));
+    }
 
+    timer_ = std::unique_ptr<erizo::TimingWheel>(new erizo::TimingWheel(std::chrono::milliseconds(kTimerTick), kTimerSlots));
+    timer_->start();
+
+    sender_run_ = true;
     run_ = true;
     recv_thread_ = std::unique_ptr<std::thread>(new std::thread([this]() {
         amqp_connection_state_t conn = amqp_cli_->getConnection();
@@ -59,40 +92,13 @@ int AMQPRPC::init(const std::string &binding_key)
         }
     }));
 
-    send_thread_ = std::unique_ptr<std::thread>(new std::thread([this]() {
-        while (run_)
-        {
-            std::unique_lock<std::mutex> lock(send_queue_mux_);
-            while (!send_queue_.empty())
-            {
-                AMQPData data = send_queue_.front();
-                send_queue_.pop();
-                send(data.exchange, data.queuename, data.binding_key, data.msg);
-            }
-            send_cond_.wait(lock);
-        }
-    }));
-
-    check_thread_ = std::unique_ptr<std::thread>(new std::thread([this]() {
-        while (run_)
-        {
-            for (AMQPCallback &cb : cb_queue_)
-            {
-                uint64_t now = Utils::getCurrentMs();
-                std::unique_lock<std::mutex>(cb.mux);
-                if (cb.ts > 0)
-                {
-                    if (now - cb.ts > (uint64_t)Config::getInstance()->rabbitmq_timeout)
-                    {
-                        cb.func(Json::nullValue);
-                        cb.ts = 0;
-                        ELOG_WARN("rpc timeout,dump %s", cb.dump.c_str());
-                    }
-                }
-            }
-            usleep(500000);
-        }
-    }));
+    for (std::unique_ptr<Sender> &sender : senders_)
+    {
+        Sender *s = sender.get();
+        s->thread = std::unique_ptr<std::thread>(new std::thread([this, s]() {
+            sendLoop(*s);
+        }));
+    }
 
     init_ = true;
     return 0;
@@ -103,31 +109,83 @@ void AMQPRPC::close()
     if (!init_)
         return;
 
+    //之后的rpc/enqueue直接失败,等已经进入的调用退出,它们入队的消息仍会发出
     run_ = false;
-    check_thread_->join();
-    check_thread_.reset();
-    check_thread_ = nullptr;
+    while (producers_ != 0)
+        std::this_thread::yield();
 
     recv_thread_->join();
     recv_thread_.reset();
     recv_thread_ = nullptr;
 
-    send_cond_.notify_all();
-    send_thread_->join();
-    send_thread_.reset();
-    send_thread_ = nullptr;
+    //发送线程发完已经入队的消息后退出
+    sender_run_ = false;
+    for (std::unique_ptr<Sender> &sender : senders_)
+    {
+        if (sender->thread == nullptr)
+            continue;
+        sender->queue.notify();
+        sender->thread->join();
+        sender->thread.reset();
+    }
+    for (std::unique_ptr<Sender> &sender : senders_)
+        sender->cli->close();
+    senders_.clear();
+
+    timer_->stop();
+    timer_.reset();
+    timer_ = nullptr;
 
     amqp_cli_->close();
     amqp_cli_.reset();
     amqp_cli_ = nullptr;
 
-    cb_queue_.clear();
-    while (!send_queue_.empty())
-        send_queue_.pop();
+    //还在等待的rpc按超时处理,不再重发
+    std::vector<AMQPCallback> pending;
+    for (Shard &shard : shards_)
+    {
+        std::unique_lock<std::mutex> lock(shard.mux);
+        for (auto &it : shard.callbacks)
+            pending.push_back(std::move(it.second));
+        shard.callbacks.clear();
+    }
+    for (AMQPCallback &cb : pending)
+        cb.func(Json::nullValue);
 
     init_ = false;
 }
 
+bool AMQPRPC::enterProducer()
+{
+    producers_++;
+    if (run_)
+        return true;
+    producers_--;
+    return false;
+}
+
+void AMQPRPC::leaveProducer()
+{
+    producers_--;
+}
+
+AMQPRPC::Shard &AMQPRPC::getShard(uint64_t corrid)
+{
+    return shards_[corrid % kShardNum];
+}
+
+int AMQPRPC::takeCallback(uint64_t corrid, AMQPCallback &cb)
+{
+    Shard &shard = getShard(corrid);
+    std::unique_lock<std::mutex> lock(shard.mux);
+    auto it = shard.callbacks.find(corrid);
+    if (it == shard.callbacks.end())
+        return 1;
+    cb = std::move(it->second);
+    shard.callbacks.erase(it);
+    return 0;
+}
+
 void AMQPRPC::handleCallback(const std::string &msg)
 {
     Json::Value root;
@@ -136,33 +194,42 @@ void AMQPRPC::handleCallback(const std::string &msg)
         return;
 
     if (!root.isMember("corrID") ||
-        root["corrID"].type() != Json::intValue ||
+        (root["corrID"].type() != Json::intValue && root["corrID"].type() != Json::uintValue) ||
+        !root["corrID"].isInt() ||
+        root["corrID"].asInt() < 0 ||
         !root.isMember("data") ||
         root["data"].type() != Json::objectValue)
     {
         ELOG_ERROR("json parse [corrID/data] failed,dump %s", msg);
         return;
     }
-    int corrid = root["corrID"].asInt();
+    uint64_t corrid = (uint64_t)root["corrID"].asInt();
     Json::Value data = root["data"];
 
-    if (corrid < 0 || corrid > kQueueSize)
+    if ((corrid >> kSequenceBits) != generation_)
     {
-        ELOG_ERROR("rpc callback corrid error");
+        ELOG_WARN("rpc callback from previous generation,dump %s", msg);
         return;
     }
 
-    AMQPCallback &cb = cb_queue_[corrid];
-    std::unique_lock<std::mutex>(cb.mux);
-    if (cb.ts > 0)
-    {
-        cb.func(data);
-        cb.ts = 0;
-    }
-    else
+    AMQPCallback cb;
+    if (takeCallback(corrid, cb))
     {
+        //已经超时
         ELOG_ERROR("rpc callback not exist");
+        return;
     }
+    timer_->cancel(cb.timer_id);
+    cb.func(data);
+}
+
+void AMQPRPC::onTimeout(uint64_t corrid)
+{
+    AMQPCallback cb;
+    if (takeCallback(corrid, cb))
+        return;
+    ELOG_WARN("rpc timeout,dump %s", cb.dump);
+    cb.func(Json::nullValue);
 }
 
 void AMQPRPC::rpc(const std::string &exchange,
@@ -171,66 +238,74 @@ void AMQPRPC::rpc(const std::string &exchange,
                   const Json::Value &data,
                   const std::function<void(const Json::Value &)> &func)
 {
-    int corrid = index_++ % kQueueSize;
+    if (!enterProducer())
+    {
+        ELOG_WARN("amqp rpc closed,dump %s", Utils::dumpJson(data));
+        func(Json::nullValue);
+        return;
+    }
+
+    uint64_t corrid = (generation_ << kSequenceBits) | (index_++ & ((1U << kSequenceBits) - 1));
 
+    //先放入回调再设置定时器,定时器不会早于回调触发
+    Shard &shard = getShard(corrid);
     {
-        AMQPCallback &cb = cb_queue_[corrid];
-        std::unique_lock<std::mutex> lock(cb.mux);
-        if (cb.ts == 0)
-        {
-            cb.dump = Utils::dumpJson(data);
-            cb.ts = Utils::getCurrentMs();
-            cb.func = func;
-        }
+        std::unique_lock<std::mutex> lock(shard.mux);
+        shard.callbacks[corrid] = {0, func, Utils::dumpJson(data)};
+    }
+    uint64_t timer_id = timer_->schedule([this, corrid]() {
+        onTimeout(corrid);
+    }, std::chrono::milliseconds(Config::getInstance()->rabbitmq_timeout));
+    {
+        std::unique_lock<std::mutex> lock(shard.mux);
+        auto it = shard.callbacks.find(corrid);
+        if (it != shard.callbacks.end())
+            it->second.timer_id = timer_id;
         else
-        {
-            ELOG_ERROR("rpc callback queue fill");
-            func(Json::nullValue);
-        }
+            timer_->cancel(timer_id);
     }
 
     Json::Value root;
-    root["corrID"] = corrid;
+    root["corrID"] = (Json::Int)corrid;
     root["replyTo"] = reply_to_;
     root["data"] = data;
     Json::FastWriter writer;
     std::string msg = writer.write(root);
 
-    std::unique_lock<std::mutex> lock(send_queue_mux_);
-    send_queue_.push({exchange, queuename, binding_key, msg});
-    send_cond_.notify_one();
+    enqueue(exchange, binding_key, msg);
+    leaveProducer();
+}
+
+void AMQPRPC::rpc(const std::string &queuename,
+                  const Json::Value &data,
+                  int try_time,
+                  const std::function<void(const Json::Value &)> &func)
+{
+    rpc(Config::getInstance()->uniquecast_exchange, queuename, queuename, data, [this, queuename, data, try_time, func](const Json::Value &root) {
+        if (root.type() == Json::nullValue && try_time > 1 && run_)
+        {
+            rpc(queuename, data, try_time - 1, func);
+            return;
+        }
+        func(root);
+    });
 }
 
 int AMQPRPC::rpc(const std::string &queuename, const Json::Value &data)
 {
-    int ret;
-    std::atomic<bool> callback_done;
-    int try_time = 3;
-    do
-    {
-        try_time--;
-        callback_done = false;
-        rpc(Config::getInstance()->uniquecast_exchange, queuename, queuename, data, [this, &ret, &callback_done](const Json::Value &root) {
-            if (root.type() == Json::nullValue)
-            {
-                ret = 1;
-                callback_done = true;
-                return;
-            }
-            if (!root.isMember("ret") ||
-                root["ret"].type() != Json::intValue)
-            {
-                ret = 1;
-                callback_done = true;
-                return;
-            }
-            ret = root["ret"].asInt();
-            callback_done = true;
-        });
-        while (!callback_done)
-            usleep(0);
-    } while (ret && try_time);
-    return ret;
+    std::shared_ptr<std::promise<int>> promise = std::make_shared<std::promise<int>>();
+    std::future<int> future = promise->get_future();
+    rpc(queuename, data, 3, [promise](const Json::Value &root) {
+        if (root.type() == Json::nullValue ||
+            !root.isMember("ret") ||
+            root["ret"].type() != Json::intValue)
+        {
+            promise->set_value(1);
+            return;
+        }
+        promise->set_value(root["ret"].asInt());
+    });
+    return future.get();
 }
 
 void AMQPRPC::rpcNotReply(const std::string &queuename, const Json::Value &data)
@@ -240,29 +315,160 @@ void AMQPRPC::rpcNotReply(const std::string &queuename, const Json::Value &data)
     Json::FastWriter writer;
     std::string msg = writer.write(root);
 
-    std::unique_lock<std::mutex> lock(send_queue_mux_);
-    send_queue_.push({Config::getInstance()->uniquecast_exchange, queuename, queuename, msg});
-    send_cond_.notify_one();
+    enqueue(Config::getInstance()->uniquecast_exchange, queuename, msg);
+}
+
+void AMQPRPC::broadcast(const Json::Value &data)
+{
+    Json::Value root;
+    root["data"] = data;
+    Json::FastWriter writer;
+    std::string msg = writer.write(root);
+
+    enqueue(Config::getInstance()->boardcast_exchange, "", msg);
+}
+
+void AMQPRPC::enqueue(const std::string &exchange, const std::string &binding_key, const std::string &msg)
+{
+    if (!enterProducer())
+    {
+        ELOG_ERROR("amqp sender not running,drop message to %s", binding_key);
+        return;
+    }
+    AMQPData *data = new AMQPData;
+    data->exchange = exchange;
+    data->binding_key = binding_key;
+    data->msg = msg;
+    senders_[std::hash<std::string>()(binding_key) % senders_.size()]->queue.push(data);
+    leaveProducer();
+}
+
+void AMQPRPC::sendLoop(Sender &sender)
+{
+    std::vector<std::unique_ptr<AMQPData>> batch;
+    while (true)
+    {
+        AMQPData *data;
+        while ((data = sender.queue.pop()) != nullptr)
+            batch.emplace_back(data);
+        if (batch.empty())
+        {
+            //关闭时发完已经入队的消息再退出
+            if (!sender_run_)
+                return;
+            sender.queue.wait(-1);
+            continue;
+        }
+
+        //发送失败时重连后再发一次,重连失败则丢弃这一批剩下的消息,rpc的回调由超时处理
+        if (!sender.connected)
+            reconnect(sender);
+        for (const std::unique_ptr<AMQPData> &d : batch)
+        {
+            if (sender.connected && publish(sender, *d) == 0)
+                continue;
+            if (sender.connected && reconnect(sender) == 0 && publish(sender, *d) == 0)
+                continue;
+            ELOG_ERROR("drop message to %s", d->binding_key);
+        }
+        if (sender.connected && Config::getInstance()->rabbitmq_confirm && waitConfirm(sender))
+            sender.connected = false;
+        if (sender.connected)
+            amqp_maybe_release_buffers(sender.cli->getConnection());
+        batch.clear();
+    }
 }
 
-int AMQPRPC::send(const std::string &exchange, const std::string &queuename, const std::string &binding_key, const std::string &send_msg)
+int AMQPRPC::publish(Sender &sender, const AMQPData &data)
 {
-    amqp_connection_state_t conn = amqp_cli_->getConnection();
     amqp_basic_properties_t props;
-    props._flags = AMQP_BASIC_CONTENT_TYPE_FLAG;
+    props._flags = AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG;
     props.content_type = amqp_cstring_bytes("application/json");
-    props.delivery_mode = 2;
-    props.correlation_id = amqp_cstring_bytes("1");
-    props.reply_to = amqp_bytes_malloc_dup(amqp_cstring_bytes(queuename.c_str()));
-    if (props.reply_to.bytes == NULL)
+    props.delivery_mode = Config::getInstance()->rabbitmq_persistent ? AMQP_DELIVERY_PERSISTENT : AMQP_DELIVERY_NONPERSISTENT;
+
+    amqp_bytes_t body;
+    body.len = data.msg.size();
+    body.bytes = (void *)data.msg.data();
+    int ret = amqp_basic_publish(sender.cli->getConnection(), 1, amqp_cstring_bytes(data.exchange.c_str()),
+                                 amqp_cstring_bytes(data.binding_key.c_str()), 0, 0,
+                                 &props, body);
+    if (ret != AMQP_STATUS_OK)
     {
-        ELOG_ERROR("out of memory while copying queue name");
+        ELOG_ERROR("publish to %s failed: %s", data.binding_key, amqp_error_string2(ret));
         return 1;
     }
+    if (Config::getInstance()->rabbitmq_confirm)
+        sender.unconfirmed.insert(++sender.delivery_tag);
+    return 0;
+}
+
+int AMQPRPC::waitConfirm(Sender &sender)
+{
+    amqp_connection_state_t conn = sender.cli->getConnection();
+    int timeout_ms = Config::getInstance()->rabbitmq_timeout;
+    while (!sender.unconfirmed.empty())
+    {
+        struct timeval timeout;
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_usec = (timeout_ms % 1000) * 1000;
+        amqp_frame_t frame;
+        int ret = amqp_simple_wait_frame_noblock(conn, &frame, &timeout);
+        if (ret != AMQP_STATUS_OK)
+        {
+            ELOG_ERROR("wait publisher confirm failed: %s, %zu messages unconfirmed", amqp_error_string2(ret), sender.unconfirmed.size());
+            sender.unconfirmed.clear();
+            return 1;
+        }
+        if (frame.frame_type != AMQP_FRAME_METHOD)
+            continue;
+
+        uint64_t delivery_tag;
+        bool multiple;
+        if (frame.payload.method.id == AMQP_BASIC_ACK_METHOD)
+        {
+            amqp_basic_ack_t *ack = (amqp_basic_ack_t *)frame.payload.method.decoded;
+            delivery_tag = ack->delivery_tag;
+            multiple = ack->multiple;
+        }
+        else if (frame.payload.method.id == AMQP_BASIC_NACK_METHOD)
+        {
+            amqp_basic_nack_t *nack = (amqp_basic_nack_t *)frame.payload.method.decoded;
+            delivery_tag = nack->delivery_tag;
+            multiple = nack->multiple;
+            ELOG_ERROR("publish nacked by broker");
+        }
+        else if (frame.payload.method.id == AMQP_CHANNEL_CLOSE_METHOD ||
+                 frame.payload.method.id == AMQP_CONNECTION_CLOSE_METHOD)
+        {
+            ELOG_ERROR("amqp sender closed by broker, %zu messages unconfirmed", sender.unconfirmed.size());
+            sender.unconfirmed.clear();
+            return 1;
+        }
+        else
+        {
+            continue;
+        }
+
+        //multiple表示到delivery_tag为止的全部消息
+        if (multiple)
+            sender.unconfirmed.erase(sender.unconfirmed.begin(), sender.unconfirmed.upper_bound(delivery_tag));
+        else
+            sender.unconfirmed.erase(delivery_tag);
+    }
+    return 0;
+}
 
-    amqp_basic_publish(conn, 1, amqp_cstring_bytes(exchange.c_str()),
-                       amqp_cstring_bytes(binding_key.c_str()), 0, 0,
-                       &props, amqp_cstring_bytes(send_msg.c_str()));
-    amqp_bytes_free(props.reply_to);
+int AMQPRPC::reconnect(Sender &sender)
+{
+    sender.cli->close();
+    sender.delivery_tag = 0;
+    sender.unconfirmed.clear();
+    sender.connected = (sender.cli->initPublisher(Config::getInstance()->rabbitmq_confirm) == 0);
+    if (!sender.connected)
+    {
+        ELOG_ERROR("amqp-cli(sender) reconnect failed");
+        return 1;
+    }
+    ELOG_INFO("amqp-cli(sender) reconnected");
     return 0;
-}
\ No newline at end of file
+}
@@ -11,38 +11,55 @@
 #include <atomic>
 #include <vector>
 #include <functional>
-#include <queue>
-#include <condition_variable>
+#include <set>
 #include <mutex>
+#include <unordered_map>
 
 #include "common/logger.h"
+#include "thread/mpsc_queue.h"
 
 class AMQPCli;
 
+namespace erizo
+{
+class TimingWheel;
+}
+
 class AMQPRPC
 {
     DECLARE_LOGGER();
 
-    struct AMQPData
+    struct AMQPData : public erizo::MpscNode
     {
         std::string exchange;
-        std::string queuename;
         std::string binding_key;
         std::string msg;
     };
 
+    //一条只发送的连接,同一个binding_key总是进入同一个Sender,保证顺序
+    //发送方不加锁入队,发送线程每次取走队列中的全部消息连续发送,confirm模式下整批发完再等待确认
+    struct Sender
+    {
+        std::unique_ptr<AMQPCli> cli;
+        std::unique_ptr<std::thread> thread;
+        erizo::MpscQueue<AMQPData> queue;
+        bool connected;                 //发送或等待确认失败后置为false,下一批消息发送前重连
+        uint64_t delivery_tag;          //confirm模式下最后发送的消息
+        std::set<uint64_t> unconfirmed; //confirm模式下还没有确认的消息
+    };
+
     struct AMQPCallback
     {
-        std::atomic<uint64_t> ts;
+        uint64_t timer_id; //超时定时器,回复到达时取消
         std::function<void(const Json::Value &)> func;
-        std::mutex mux;
         std::string dump;
-        AMQPCallback()
-        {
-            ts = 0;
-            func = std::function<void(const Json::Value &)>([](const Json::Value &) {});
-        }
-        AMQPCallback(const AMQPCallback &a) {}
+    };
+
+    //按corrID分片,rpc/回复/超时检查只锁一个分片,并发数只受内存限制
+    struct Shard
+    {
+        std::mutex mux;
+        std::unordered_map<uint64_t, AMQPCallback> callbacks;
     };
 
   public:
@@ -57,31 +74,53 @@ class AMQPRPC
              const std::string &binding_key,
              const Json::Value &data,
              const std::function<void(const Json::Value &)> &func);
+    //发往uniquecast_exchange,func在amqp线程里调用,不能阻塞;超时(nullValue)时重发,共尝试try_time次
+    void rpc(const std::string &queuename,
+             const Json::Value &data,
+             int try_time,
+             const std::function<void(const Json::Value &)> &func);
+    //同步版本,阻塞等待回复中的ret,不能在hub/worker线程里调用
     int rpc(const std::string &queuename, const Json::Value &data);
     void rpcNotReply(const std::string &queuename, const Json::Value &data);
+    //发往boardcast_exchange(fanout),所有erizo_controller都会收到
+    void broadcast(const Json::Value &data);
 
   private:
-    int send(const std::string &exchange,
-             const std::string &queuename,
-             const std::string &binding_key,
-             const std::string &send_msg);
+    //close时先让新的调用直接失败,再等进行中的调用退出,之后才能停止发送线程和定时器
+    bool enterProducer();
+    void leaveProducer();
+
+    void enqueue(const std::string &exchange, const std::string &binding_key, const std::string &msg);
+    void sendLoop(Sender &sender);
+    int publish(Sender &sender, const AMQPData &data);
+    int waitConfirm(Sender &sender);
+    int reconnect(Sender &sender);
 
     void handleCallback(const std::string &msg);
 
+    Shard &getShard(uint64_t corrid);
+    //取出并删除,不存在时返回1
+    int takeCallback(uint64_t corrid, AMQPCallback &cb);
+
+    void onTimeout(uint64_t corrid);
+
   private:
-    std::mutex send_queue_mux_;
-    std::condition_variable send_cond_;
-    std::queue<AMQPData> send_queue_;
-    std::vector<AMQPCallback> cb_queue_;
+    std::vector<std::unique_ptr<Sender>> senders_;
+    static const size_t kShardNum = 16;
+    Shard shards_[kShardNum];
 
     std::string reply_to_;
+    //corrID = generation_ << kSequenceBits | 序号,不超过int32,和原来0~255的corrID一样按int收发
+    //每次init换一个generation,之前发出的rpc迟到的回复不会匹配到新的回调
+    uint64_t generation_;
     std::atomic<uint32_t> index_;
 
     std::unique_ptr<AMQPCli> amqp_cli_;
     std::unique_ptr<std::thread> recv_thread_;
-    std::unique_ptr<std::thread> send_thread_;
-    std::unique_ptr<std::thread> check_thread_;
+    std::unique_ptr<erizo::TimingWheel> timer_;
     std::atomic<bool> run_;
+    std::atomic<int> producers_;     //正在rpc/enqueue中的调用数
+    std::atomic<bool> sender_run_;   //所有调用退出后才置为false,发送线程发完队列后退出
     bool init_;
 };
 
@@ -1,4 +1,5 @@
 #include "acl_redis.h"
+#include "redis_cluster.h"
 #include "common/config.h"
 
 #include <sstream>
@@ -18,13 +19,31 @@ int ACLRedis::init()
     std::ostringstream oss;
     oss << Config::getInstance()->redis_ip << ":" << Config::getInstance()->redis_port;
 
+    addr_ = oss.str();
     cluster_ = std::make_shared<acl::redis_client_cluster>();
-    cluster_->set(oss.str().c_str(),
-                  Config::getInstance()->redis_max_conns,
-                  Config::getInstance()->redis_conn_timeout,
-                  Config::getInstance()->redis_rw_timeout);
     cluster_->set_password("default", Config::getInstance()->redis_passwd.c_str());
+    if (RedisCluster::enabled())
+    {
+        //acl的命令按slot自动选择节点并处理MOVED,pipeline由RedisCluster分发
+        cluster_->set_all_slot(addr_.c_str(),
+                               Config::getInstance()->redis_max_conns,
+                               Config::getInstance()->redis_conn_timeout,
+                               Config::getInstance()->redis_rw_timeout);
+    }
+    else
+    {
+        cluster_->set(addr_.c_str(),
+                      Config::getInstance()->redis_max_conns,
+                      Config::getInstance()->redis_conn_timeout,
+                      Config::getInstance()->redis_rw_timeout);
+    }
     init_ = true;
+
+    if (RedisCluster::enabled() && RedisCluster::getInstance()->refresh())
+    {
+        close();
+        return 1;
+    }
     return 0;
 }
 
@@ -122,7 +141,7 @@ int ACLRedis::hset(const std::string &key, const std::string &field, const std::
         return false;
     acl::redis_hash cmd;
     cmd.set_cluster(cluster_.get(), Config::getInstance()->redis_max_conns);
-    int res = cmd.hset(key.c_str(), field.c_str(), value.c_str());
+    int res = cmd.hset(key.c_str(), field.c_str(), value.data(), value.size());
     cmd.clear();
     return res;
 }
@@ -137,8 +156,9 @@ int ACLRedis::hget(const std::string &key, const std::string &field, std::string
     int res = cmd.hget(key.c_str(), field.c_str(), buf);
     cmd.clear();
 
+    //二进制记录中可能有'\0'
     if (!buf.empty())
-        value = buf.c_str();
+        value.assign(buf.c_str(), buf.length());
     return res;
 }
 
@@ -180,7 +200,101 @@ int ACLRedis::hvals(const std::string &key, std::vector<std::string> &fields, st
     for (auto it = buf.begin(); it != buf.end(); it++)
     {
         fields.push_back(std::string(it->first.c_str()));
-        values.push_back(std::string(it->second.c_str()));
+        values.push_back(std::string(it->second.c_str(), it->second.length()));
     }
     return res;
-}
\ No newline at end of file
+}
+void ACLRedis::toReply(const acl::redis_result *result, RedisReply &reply)
+{
+    switch (result->get_type())
+    {
+    case acl::REDIS_RESULT_ERROR:
+        reply.type = RedisReply::ERROR;
+        reply.str = result->get_error();
+        break;
+    case acl::REDIS_RESULT_STATUS:
+        reply.type = RedisReply::STATUS;
+        reply.str = result->get_status();
+        break;
+    case acl::REDIS_RESULT_INTEGER:
+        reply.type = RedisReply::INTEGER;
+        reply.integer = result->get_integer64();
+        break;
+    case acl::REDIS_RESULT_STRING:
+    {
+        reply.type = RedisReply::STRING;
+        acl::string buf;
+        result->argv_to_string(buf);
+        reply.str.assign(buf.c_str(), buf.length());
+        break;
+    }
+    case acl::REDIS_RESULT_ARRAY:
+        reply.type = RedisReply::ARRAY;
+        reply.elements.resize(result->get_size());
+        for (size_t i = 0; i < result->get_size(); i++)
+        {
+            const acl::redis_result *child = result->get_child(i);
+            if (child)
+                toReply(child, reply.elements[i]);
+        }
+        break;
+    default:
+        reply.type = RedisReply::NIL;
+        break;
+    }
+}
+
+int ACLRedis::pipeline(const std::string &req, size_t count, std::vector<RedisReply> &replies)
+{
+    return pipeline(addr_, req, count, replies);
+}
+
+int ACLRedis::pipeline(const std::string &addr, const std::string &req, size_t count, std::vector<RedisReply> &replies)
+{
+    if (!init_)
+        return 1;
+
+    acl::connect_pool *pool = cluster_->get(addr.c_str());
+    if (!pool && RedisCluster::enabled())
+    {
+        //集群中新发现的节点
+        cluster_->set(addr.c_str(),
+                      Config::getInstance()->redis_max_conns,
+                      Config::getInstance()->redis_conn_timeout,
+                      Config::getInstance()->redis_rw_timeout);
+        pool = cluster_->get(addr.c_str());
+    }
+    if (!pool)
+        return 1;
+    return pipeline(pool, req, count, replies);
+}
+
+int ACLRedis::pipeline(acl::connect_pool *pool, const std::string &req, size_t count, std::vector<RedisReply> &replies)
+{
+    acl::redis_client *conn = (acl::redis_client *)pool->peek();
+    if (!conn)
+        return 1;
+
+    //nchildren>=1时run按顺序读回nchildren个回复,作为一个数组返回
+    acl::dbuf_pool *dbuf = new acl::dbuf_pool;
+    acl::string buf;
+    buf.copy(req.data(), req.size());
+    const acl::redis_result *result = conn->run(dbuf, buf, count);
+    if (!result || result->get_type() != acl::REDIS_RESULT_ARRAY || result->get_size() != count)
+    {
+        dbuf->destroy();
+        pool->put(conn, false);
+        return 1;
+    }
+
+    replies.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const acl::redis_result *child = result->get_child(i);
+        if (child)
+            toReply(child, replies[i]);
+    }
+    dbuf->destroy();
+    pool->put(conn, true);
+    return 0;
+}
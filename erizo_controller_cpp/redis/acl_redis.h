@@ -5,9 +5,13 @@
 #include <string>
 #include <memory>
 
+#include "redis_pipeline.h"
+
 namespace acl
 {
+class connect_pool;
 class redis_client_cluster;
+class redis_result;
 }
 
 class ACLRedis
@@ -30,11 +34,21 @@ public:
   int hdel(const std::string &key, const std::string &field);
   int hdel(const std::string &key, const std::vector<std::string> &fields);
 
+  //req为count条编码好的命令(见RedisPipeline),在同一个连接上一次发出
+  int pipeline(const std::string &req, size_t count, std::vector<RedisReply> &replies);
+  //发往指定节点(ip:port),集群模式下由RedisCluster按slot选择;非集群模式只能是主库
+  int pipeline(const std::string &addr, const std::string &req, size_t count, std::vector<RedisReply> &replies);
+  //在给定的连接池上执行,从库的连接池由RedisReplicas持有,不放入cluster_,否则acl会把主库命令轮询到从库
+  static int pipeline(acl::connect_pool *pool, const std::string &req, size_t count, std::vector<RedisReply> &replies);
+
 private:
   ACLRedis();
 
+  static void toReply(const acl::redis_result *result, RedisReply &reply);
+
 private:
   std::shared_ptr<acl::redis_client_cluster> cluster_;
+  std::string addr_;
   bool init_;
   static ACLRedis *instance_;
 };
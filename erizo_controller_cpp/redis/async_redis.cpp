@@ -0,0 +1,402 @@
+#include "async_redis.h"
+
+#include <algorithm>
+#include <stdlib.h>
+
+#include "redis_cluster.h"
+#include "common/config.h"
+
+DEFINE_LOGGER(AsyncRedisConnection, "AsyncRedisConnection");
+DEFINE_LOGGER(AsyncRedis, "AsyncRedis");
+
+AsyncRedisConnection::AsyncRedisConnection(boost::asio::io_service &io_service, const std::string &ip, unsigned short port) : io_service_(io_service),
+                                                                                                                           ip_(ip),
+                                                                                                                           port_(port),
+                                                                                                                           socket_(io_service),
+                                                                                                                           timer_(io_service),
+                                                                                                                           state_(DISCONNECTED),
+                                                                                                                           closed_(false),
+                                                                                                                           conn_id_(0),
+                                                                                                                           write_in_progress_(false)
+{
+}
+
+AsyncRedisConnection::~AsyncRedisConnection()
+{
+}
+
+void AsyncRedisConnection::exec(const std::string &req, size_t count, const Callback &cb)
+{
+    if (count == 0 || closed_)
+    {
+        int err = closed_ ? 1 : 0;
+        io_service_.post([cb, err]() {
+            std::vector<RedisReply> replies;
+            cb(err, replies);
+        });
+        return;
+    }
+
+    if (pending_.empty() && state_ == CONNECTED)
+        armTimer(Config::getInstance()->redis_rw_timeout);
+
+    pending_.push_back({count, {}, cb});
+    out_ += req;
+
+    if (state_ == DISCONNECTED)
+        connect();
+    else if (state_ == CONNECTED)
+        write();
+}
+
+void AsyncRedisConnection::close()
+{
+    closed_ = true;
+    fail("closed");
+}
+
+void AsyncRedisConnection::connect()
+{
+    Config *config = Config::getInstance();
+    boost::system::error_code ec;
+    boost::asio::ip::address addr = boost::asio::ip::address::from_string(ip_, ec);
+    if (ec)
+    {
+        fail("invalid redis address " + ip_);
+        return;
+    }
+
+    state_ = CONNECTING;
+    conn_id_++;
+    parser_.reset();
+
+    //AUTH放在所有排队请求之前
+    if (!config->redis_passwd.empty())
+    {
+        RedisPipeline auth;
+        auth.command({"AUTH", config->redis_passwd});
+        std::weak_ptr<AsyncRedisConnection> weak_this = shared_from_this();
+        pending_.push_front({1, {}, [weak_this](int err, std::vector<RedisReply> &replies) {
+                                 auto this_ptr = weak_this.lock();
+                                 if (this_ptr && !err && replies[0].isError())
+                                     this_ptr->fail("auth failed: " + replies[0].str);
+                             }});
+        out_ = auth.request() + out_;
+    }
+
+    armTimer(config->redis_conn_timeout);
+    auto this_ptr = shared_from_this();
+    uint64_t conn_id = conn_id_;
+    socket_.async_connect(boost::asio::ip::tcp::endpoint(addr, port_),
+                          [this_ptr, conn_id](const boost::system::error_code &ec) {
+                              this_ptr->onConnect(conn_id, ec);
+                          });
+}
+
+void AsyncRedisConnection::onConnect(uint64_t conn_id, const boost::system::error_code &ec)
+{
+    if (conn_id != conn_id_ || state_ != CONNECTING)
+        return;
+    if (ec)
+    {
+        fail("connect failed: " + ec.message());
+        return;
+    }
+
+    state_ = CONNECTED;
+    socket_.set_option(boost::asio::ip::tcp::no_delay(true));
+    armTimer(Config::getInstance()->redis_rw_timeout);
+    read();
+    write();
+}
+
+void AsyncRedisConnection::write()
+{
+    if (write_in_progress_ || out_.empty())
+        return;
+
+    write_in_progress_ = true;
+    writing_.swap(out_);
+    out_.clear();
+
+    auto this_ptr = shared_from_this();
+    uint64_t conn_id = conn_id_;
+    boost::asio::async_write(socket_, boost::asio::buffer(writing_),
+                             [this_ptr, conn_id](const boost::system::error_code &ec, size_t) {
+                                 if (conn_id != this_ptr->conn_id_)
+                                     return;
+                                 this_ptr->write_in_progress_ = false;
+                                 if (ec)
+                                 {
+                                     this_ptr->fail("write failed: " + ec.message());
+                                     return;
+                                 }
+                                 this_ptr->write();
+                             });
+}
+
+void AsyncRedisConnection::read()
+{
+    auto this_ptr = shared_from_this();
+    uint64_t conn_id = conn_id_;
+    socket_.async_read_some(boost::asio::buffer(read_buf_, sizeof(read_buf_)),
+                            [this_ptr, conn_id](const boost::system::error_code &ec, size_t len) {
+                                this_ptr->onRead(conn_id, ec, len);
+                            });
+}
+
+void AsyncRedisConnection::onRead(uint64_t conn_id, const boost::system::error_code &ec, size_t len)
+{
+    if (conn_id != conn_id_)
+        return;
+    if (ec)
+    {
+        fail("read failed: " + ec.message());
+        return;
+    }
+
+    parser_.feed(read_buf_, len);
+    RedisReply reply;
+    int res;
+    while ((res = parser_.next(reply)) == 1)
+    {
+        if (pending_.empty())
+        {
+            fail("unexpected reply");
+            return;
+        }
+        Request &front = pending_.front();
+        front.replies.push_back(std::move(reply));
+        if (front.replies.size() < front.count)
+            continue;
+
+        Request req = std::move(front);
+        pending_.pop_front();
+        if (pending_.empty())
+            timer_.cancel();
+        else
+            armTimer(Config::getInstance()->redis_rw_timeout);
+
+        req.cb(0, req.replies);
+        //回调里可能关闭了连接
+        if (conn_id != conn_id_)
+            return;
+    }
+    if (res < 0)
+    {
+        fail("protocol error");
+        return;
+    }
+    read();
+}
+
+void AsyncRedisConnection::armTimer(int seconds)
+{
+    timer_.expires_from_now(boost::posix_time::seconds(seconds));
+    auto this_ptr = shared_from_this();
+    uint64_t conn_id = conn_id_;
+    timer_.async_wait([this_ptr, conn_id](const boost::system::error_code &ec) {
+        this_ptr->onTimer(conn_id, ec);
+    });
+}
+
+void AsyncRedisConnection::onTimer(uint64_t conn_id, const boost::system::error_code &ec)
+{
+    if (ec == boost::asio::error::operation_aborted || conn_id != conn_id_)
+        return;
+    //定时器被重新设置过
+    if (timer_.expires_at() > boost::asio::deadline_timer::traits_type::now())
+        return;
+    if (state_ == DISCONNECTED || pending_.empty())
+        return;
+    fail("timeout");
+}
+
+void AsyncRedisConnection::fail(const std::string &reason)
+{
+    if (state_ == DISCONNECTED && pending_.empty())
+        return;
+
+    if (reason != "closed")
+        ELOG_ERROR("redis connection %s:%d error: %s, %zu requests dropped", ip_, port_, reason, pending_.size());
+
+    boost::system::error_code ignored;
+    socket_.close(ignored);
+    timer_.cancel(ignored);
+    state_ = DISCONNECTED;
+    conn_id_++;
+    write_in_progress_ = false;
+    out_.clear();
+    writing_.clear();
+    parser_.reset();
+
+    //先取出再回调,回调里可能发起新的请求
+    std::deque<Request> pending;
+    pending.swap(pending_);
+    for (Request &req : pending)
+    {
+        req.replies.clear();
+        req.cb(1, req.replies);
+    }
+}
+
+//集群模式下一次exec的状态,所有节点的回复到齐后回调
+struct AsyncRedis::ClusterRequest
+{
+    RedisPipeline pipeline;
+    Callback cb;
+    std::vector<RedisReply> replies;
+    size_t waiting; //还没有回复的节点数
+    int err;
+    bool retried;
+    std::vector<size_t> redirected;
+};
+
+AsyncRedis::AsyncRedis(boost::asio::io_service &io_service) : io_service_(io_service),
+                                                              inflight_(0),
+                                                              close_when_idle_(false),
+                                                              closed_(false)
+{
+    Config *config = Config::getInstance();
+    addr_ = config->redis_ip + ":" + std::to_string(config->redis_port);
+}
+
+AsyncRedis::~AsyncRedis()
+{
+}
+
+std::shared_ptr<AsyncRedisConnection> AsyncRedis::getConnection(const std::string &addr)
+{
+    auto it = conns_.find(addr);
+    if (it != conns_.end())
+        return it->second;
+
+    size_t pos = addr.rfind(':');
+    std::shared_ptr<AsyncRedisConnection> conn = std::make_shared<AsyncRedisConnection>(io_service_, addr.substr(0, pos),
+                                                                                       (unsigned short)atoi(addr.c_str() + pos + 1));
+    conns_[addr] = conn;
+    return conn;
+}
+
+void AsyncRedis::exec(const RedisPipeline &pipeline, const Callback &cb)
+{
+    if (closed_)
+    {
+        io_service_.post([cb]() {
+            std::vector<RedisReply> replies;
+            cb(1, replies);
+        });
+        return;
+    }
+
+    //回调里发出的后续请求先计数,之后才减去本次的计数,closeWhenIdle不会在处理链中途关闭
+    inflight_++;
+    auto this_ptr = shared_from_this();
+    Callback done = [this_ptr, cb](int err, std::vector<RedisReply> &replies) {
+        cb(err, replies);
+        this_ptr->onDone();
+    };
+    if (!RedisCluster::enabled() || pipeline.empty())
+    {
+        getConnection(addr_)->exec(pipeline.request(), pipeline.size(), done);
+        return;
+    }
+
+    std::shared_ptr<ClusterRequest> req = std::make_shared<ClusterRequest>();
+    req->pipeline = pipeline;
+    req->cb = done;
+    req->replies.resize(pipeline.size());
+    req->waiting = 0;
+    req->err = 0;
+    req->retried = false;
+    std::vector<size_t> indexes;
+    for (size_t i = 0; i < pipeline.size(); i++)
+        indexes.push_back(i);
+    dispatch(req, indexes);
+}
+
+void AsyncRedis::dispatch(const std::shared_ptr<ClusterRequest> &req, const std::vector<size_t> &indexes)
+{
+    std::map<std::string, RedisCluster::Batch> batches;
+    if (RedisCluster::getInstance()->split(req->pipeline, indexes, batches))
+    {
+        io_service_.post([req]() {
+            req->cb(1, req->replies);
+        });
+        return;
+    }
+
+    req->waiting = batches.size();
+    req->redirected.clear();
+    auto this_ptr = shared_from_this();
+    for (auto &it : batches)
+    {
+        std::string addr = it.first;
+        std::vector<size_t> batch_indexes = it.second.indexes;
+        getConnection(addr)->exec(it.second.req, batch_indexes.size(), [this_ptr, req, addr, batch_indexes](int err, std::vector<RedisReply> &replies) {
+            if (err)
+            {
+                req->err = 1;
+            }
+            else
+            {
+                for (size_t i = 0; i < replies.size(); i++)
+                {
+                    if (!req->retried && RedisCluster::isRedirect(replies[i]))
+                        req->redirected.push_back(batch_indexes[i]);
+                    req->replies[batch_indexes[i]] = std::move(replies[i]);
+                }
+            }
+            if (--req->waiting > 0)
+                return;
+
+            if (!req->err && !req->redirected.empty())
+            {
+                this_ptr->refreshAndRetry(req, addr);
+                return;
+            }
+            req->cb(req->err, req->replies);
+        });
+    }
+}
+
+void AsyncRedis::refreshAndRetry(const std::shared_ptr<ClusterRequest> &req, const std::string &addr)
+{
+    //slot迁移过,从任意一个节点取新的slot表,只重发一次
+    req->retried = true;
+    RedisPipeline pipeline;
+    pipeline.command({"CLUSTER", "SLOTS"});
+    auto this_ptr = shared_from_this();
+    getConnection(addr)->exec(pipeline.request(), pipeline.size(), [this_ptr, req](int err, std::vector<RedisReply> &replies) {
+        if (err || RedisCluster::getInstance()->load(replies[0]))
+        {
+            //刷新失败,MOVED错误留在对应的reply里
+            ELOG_ERROR("refresh cluster slots failed");
+            req->cb(0, req->replies);
+            return;
+        }
+        std::vector<size_t> indexes = req->redirected;
+        std::sort(indexes.begin(), indexes.end());
+        this_ptr->dispatch(req, indexes);
+    });
+}
+
+void AsyncRedis::onDone()
+{
+    if (--inflight_ == 0 && close_when_idle_)
+        close();
+}
+
+void AsyncRedis::closeWhenIdle()
+{
+    close_when_idle_ = true;
+    if (inflight_ == 0)
+        close();
+}
+
+void AsyncRedis::close()
+{
+    closed_ = true;
+    for (auto &it : conns_)
+        it.second->close();
+}
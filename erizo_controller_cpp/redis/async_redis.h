@@ -0,0 +1,117 @@
+#ifndef ASYNC_REDIS_H
+#define ASYNC_REDIS_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <map>
+
+#include <boost/asio.hpp>
+
+#include "common/logger.h"
+#include "redis_pipeline.h"
+#include "resp_parser.h"
+
+//到一个redis节点的非阻塞连接,基于boost::asio,绑定到一个erizo::Worker的io_service
+//exec和回调都在该io_service的线程里执行,不需要加锁
+//连接断开时所有未完成的请求以错误回调,下一次exec时重新连接
+class AsyncRedisConnection : public std::enable_shared_from_this<AsyncRedisConnection>
+{
+  DECLARE_LOGGER();
+
+public:
+  //err为1表示网络/协议错误,单条命令的错误放在对应的reply里
+  typedef std::function<void(int err, std::vector<RedisReply> &replies)> Callback;
+
+  AsyncRedisConnection(boost::asio::io_service &io_service, const std::string &ip, unsigned short port);
+  ~AsyncRedisConnection();
+
+  //req为count条编码好的命令
+  void exec(const std::string &req, size_t count, const Callback &cb);
+  //断开连接并拒绝之后的请求
+  void close();
+
+private:
+  enum State
+  {
+    DISCONNECTED,
+    CONNECTING,
+    CONNECTED
+  };
+
+  struct Request
+  {
+    size_t count;
+    std::vector<RedisReply> replies;
+    Callback cb;
+  };
+
+  void connect();
+  void onConnect(uint64_t conn_id, const boost::system::error_code &ec);
+  void write();
+  void read();
+  void onRead(uint64_t conn_id, const boost::system::error_code &ec, size_t len);
+  void armTimer(int seconds);
+  void onTimer(uint64_t conn_id, const boost::system::error_code &ec);
+  void fail(const std::string &reason);
+
+private:
+  boost::asio::io_service &io_service_;
+  std::string ip_;
+  unsigned short port_;
+  boost::asio::ip::tcp::socket socket_;
+  boost::asio::deadline_timer timer_;
+  State state_;
+  bool closed_;
+  uint64_t conn_id_; //每次重连增加,忽略旧连接上的回调
+
+  std::deque<Request> pending_; //按发送顺序等待回复
+  std::string out_;             //等待写出
+  std::string writing_;         //正在写出
+  bool write_in_progress_;
+
+  char read_buf_[16384];
+  RespParser parser_;
+};
+
+//worker上的redis客户端,非集群模式只有一个连接
+//集群模式下按slot把pipeline拆分到各个master的连接(RedisCluster),回复按原顺序合并;
+//收到MOVED时异步刷新slot表,只重发被重定向的命令
+class AsyncRedis : public std::enable_shared_from_this<AsyncRedis>
+{
+  DECLARE_LOGGER();
+
+public:
+  typedef AsyncRedisConnection::Callback Callback;
+
+  explicit AsyncRedis(boost::asio::io_service &io_service);
+  ~AsyncRedis();
+
+  void exec(const RedisPipeline &pipeline, const Callback &cb);
+  //断开所有连接并拒绝之后的请求,关闭worker之前必须在其线程里调用,否则未完成的读操作会让io_service一直运行
+  void close();
+  //等所有请求(包括回调中发出的后续请求)完成后再close,在worker线程里调用
+  void closeWhenIdle();
+
+  boost::asio::io_service &getIOService() { return io_service_; }
+
+private:
+  struct ClusterRequest;
+
+  std::shared_ptr<AsyncRedisConnection> getConnection(const std::string &addr);
+  void dispatch(const std::shared_ptr<ClusterRequest> &req, const std::vector<size_t> &indexes);
+  void refreshAndRetry(const std::shared_ptr<ClusterRequest> &req, const std::string &addr);
+  void onDone();
+
+private:
+  boost::asio::io_service &io_service_;
+  std::string addr_;
+  std::map<std::string, std::shared_ptr<AsyncRedisConnection>> conns_; //ip:port -> 连接
+  size_t inflight_; //已经exec、回调还没有返回的请求数
+  bool close_when_idle_;
+  bool closed_;
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include "redis_cluster.h"
+
+#include <algorithm>
+
+#include "acl_redis.h"
+#include "common/config.h"
+
+DEFINE_LOGGER(RedisCluster, "RedisCluster");
+
+RedisCluster *RedisCluster::instance_ = nullptr;
+RedisCluster *RedisCluster::getInstance()
+{
+    if (!instance_)
+        instance_ = new RedisCluster;
+    return instance_;
+}
+
+RedisCluster::RedisCluster() : slots_(kSlotNum, -1)
+{
+}
+
+bool RedisCluster::enabled()
+{
+    return Config::getInstance()->redis_cluster;
+}
+
+int RedisCluster::keySlot(const std::string &key)
+{
+    size_t begin = 0, len = key.size();
+    size_t open = key.find('{');
+    if (open != std::string::npos)
+    {
+        size_t close = key.find('}', open + 1);
+        if (close != std::string::npos && close > open + 1)
+        {
+            begin = open + 1;
+            len = close - open - 1;
+        }
+    }
+
+    uint16_t crc = 0;
+    for (size_t i = begin; i < begin + len; i++)
+    {
+        crc ^= (uint16_t)((unsigned char)key[i] << 8);
+        for (int j = 0; j < 8; j++)
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+    return crc % kSlotNum;
+}
+
+std::string RedisCluster::roomKey(const std::string &prefix, const std::string &room_id)
+{
+    if (enabled())
+        return prefix + "{" + room_id + "}";
+    return prefix + room_id;
+}
+
+std::string RedisCluster::tagKey(const std::string &key)
+{
+    if (enabled())
+        return "{" + key + "}";
+    return key;
+}
+
+bool RedisCluster::isRedirect(const RedisReply &reply)
+{
+    //ASK只在迁移过程中出现,按普通错误返回给调用方
+    return reply.isError() && reply.str.compare(0, 6, "MOVED ") == 0;
+}
+
+int RedisCluster::refresh()
+{
+    std::vector<std::string> seeds = nodes();
+    std::string addr = Config::getInstance()->redis_ip + ":" + std::to_string(Config::getInstance()->redis_port);
+    seeds.push_back(addr);
+
+    RedisPipeline pipeline;
+    pipeline.command({"CLUSTER", "SLOTS"});
+    for (const std::string &seed : seeds)
+    {
+        std::vector<RedisReply> replies;
+        if (ACLRedis::getInstance()->pipeline(seed, pipeline.request(), pipeline.size(), replies) ||
+            replies[0].isError())
+            continue;
+        if (!load(replies[0]))
+            return 0;
+    }
+    ELOG_ERROR("get cluster slots failed");
+    return 1;
+}
+
+int RedisCluster::load(const RedisReply &reply)
+{
+    //[[start, end, [ip, port, id], [replica]...], ...]
+    if (reply.type != RedisReply::ARRAY || reply.elements.empty())
+        return 1;
+
+    std::vector<std::string> nodes;
+    std::vector<int> slots(kSlotNum, -1);
+    for (const RedisReply &range : reply.elements)
+    {
+        if (range.type != RedisReply::ARRAY || range.elements.size() < 3 ||
+            range.elements[0].type != RedisReply::INTEGER ||
+            range.elements[1].type != RedisReply::INTEGER ||
+            range.elements[2].type != RedisReply::ARRAY ||
+            range.elements[2].elements.size() < 2)
+            return 1;
+
+        long long start = range.elements[0].integer;
+        long long end = range.elements[1].integer;
+        const RedisReply &master = range.elements[2];
+        if (start < 0 || end >= kSlotNum || start > end)
+            return 1;
+
+        std::string addr = master.elements[0].str + ":" + std::to_string(master.elements[1].integer);
+        size_t index = 0;
+        while (index < nodes.size() && nodes[index] != addr)
+            index++;
+        if (index == nodes.size())
+            nodes.push_back(addr);
+        for (long long slot = start; slot <= end; slot++)
+            slots[slot] = (int)index;
+    }
+
+    std::unique_lock<std::mutex> lock(mux_);
+    nodes_.swap(nodes);
+    slots_.swap(slots);
+    ELOG_INFO("cluster slots loaded, %zu masters", nodes_.size());
+    return 0;
+}
+
+std::vector<std::string> RedisCluster::nodes()
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    return nodes_;
+}
+
+int RedisCluster::split(const RedisPipeline &pipeline, const std::vector<size_t> &indexes, std::map<std::string, Batch> &batches)
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    if (nodes_.empty())
+        return 1;
+    for (size_t index : indexes)
+    {
+        int slot = pipeline.slot(index);
+        int node = (slot < 0) ? 0 : slots_[slot];
+        if (node < 0)
+        {
+            ELOG_ERROR("slot %d not served", slot);
+            return 1;
+        }
+        Batch &batch = batches[nodes_[node]];
+        batch.req += pipeline.encoded(index);
+        batch.indexes.push_back(index);
+    }
+    return 0;
+}
+
+int RedisCluster::exec(const RedisPipeline &pipeline, std::vector<RedisReply> &replies)
+{
+    std::vector<size_t> indexes;
+    for (size_t i = 0; i < pipeline.size(); i++)
+        indexes.push_back(i);
+    replies.assign(pipeline.size(), RedisReply());
+
+    for (int attempt = 0; !indexes.empty(); attempt++)
+    {
+        std::map<std::string, Batch> batches;
+        if (split(pipeline, indexes, batches))
+            return 1;
+
+        std::vector<size_t> redirected;
+        for (auto &it : batches)
+        {
+            const Batch &batch = it.second;
+            std::vector<RedisReply> sub;
+            if (ACLRedis::getInstance()->pipeline(it.first, batch.req, batch.indexes.size(), sub))
+                return 1;
+            for (size_t i = 0; i < sub.size(); i++)
+            {
+                if (attempt == 0 && isRedirect(sub[i]))
+                    redirected.push_back(batch.indexes[i]);
+                replies[batch.indexes[i]] = std::move(sub[i]);
+            }
+        }
+
+        //slot迁移过,刷新后重发被重定向的命令;刷新失败时MOVED错误留在对应的reply里
+        if (!redirected.empty() && refresh())
+            break;
+        std::sort(redirected.begin(), redirected.end());
+        indexes.swap(redirected);
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef REDIS_CLUSTER_H
+#define REDIS_CLUSTER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+
+#include "common/logger.h"
+#include "redis_pipeline.h"
+
+//redis集群模式下的slot路由(Config::redis_cluster)
+//房间的所有key带相同的{room_id}哈希标签,落在同一个slot,房间内的pipeline和Lua脚本都在一个节点上执行
+//slot表通过CLUSTER SLOTS获取,每个master一个连接池;收到MOVED时刷新slot表,只重发被重定向的命令
+class RedisCluster
+{
+  DECLARE_LOGGER();
+
+public:
+  static const int kSlotNum = 16384;
+
+  //发往同一个节点的命令,indexes为其在原pipeline中的位置
+  struct Batch
+  {
+    std::string req;
+    std::vector<size_t> indexes;
+  };
+
+  static RedisCluster *getInstance();
+  static bool enabled();
+
+  //CRC16(XMODEM) % 16384,key中有非空的{tag}时只计算tag
+  static int keySlot(const std::string &key);
+  //房间的key: 集群模式下为prefix{room_id},否则保持原来的prefix+room_id
+  static std::string roomKey(const std::string &prefix, const std::string &room_id);
+  //整个key作为哈希标签,key加后缀组成的多个key落在同一个slot
+  static std::string tagKey(const std::string &key);
+  static bool isRedirect(const RedisReply &reply);
+
+  //从已知节点(或配置的地址)获取slot表
+  int refresh();
+  //CLUSTER SLOTS的回复
+  int load(const RedisReply &reply);
+  std::vector<std::string> nodes();
+
+  //按节点拆分pipeline中indexes指定的命令,没有key的命令发往第一个节点
+  int split(const RedisPipeline &pipeline, const std::vector<size_t> &indexes, std::map<std::string, Batch> &batches);
+  //同步执行,replies与命令一一对应
+  int exec(const RedisPipeline &pipeline, std::vector<RedisReply> &replies);
+
+private:
+  RedisCluster();
+
+private:
+  std::mutex mux_;
+  std::vector<std::string> nodes_; //ip:port
+  std::vector<int> slots_;         //slot -> nodes_下标,-1表示未分配
+  static RedisCluster *instance_;
+};
+
+#endif
@@ -1,104 +1,369 @@
 #include "redis_helper.h"
 
 #include <algorithm>
+#include <unordered_map>
+#include <stdlib.h>
 
 #include "acl_redis.h"
+#include "async_redis.h"
+#include "redis_pipeline.h"
+#include "room_scripts.h"
+#include "redis_locker.h"
+#include "redis_cluster.h"
+#include "redis_replicas.h"
+#include "common/config.h"
 
-int RedisHelper::addClient(const std::string &room_id, const Client &client)
+namespace
+{
+std::string roomKey(const char *prefix, const std::string &room_id)
 {
-    std::string key = "client_" + room_id;
-    if (ACLRedis::getInstance()->hset(key, client.id, client.toJSON()) == -1)
+    return RedisCluster::roomKey(prefix, room_id);
+}
+
+//allow_stale时优先从可用的从库读取,从库读取失败或没有可用从库时读主库
+int hashValues(const std::string &key, std::vector<std::string> &values, bool allow_stale)
+{
+    std::string replica = allow_stale ? RedisReplicas::getInstance()->pick() : "";
+    if (!replica.empty())
+    {
+        RedisPipeline pipeline;
+        pipeline.command({"HGETALL", key});
+        std::vector<RedisReply> replies;
+        if (!RedisReplicas::getInstance()->pipeline(replica, pipeline.request(), pipeline.size(), replies) &&
+            replies[0].type == RedisReply::ARRAY)
+        {
+            RedisPipeline::hashValues(replies[0], values);
+            return 0;
+        }
+        RedisReplicas::getInstance()->markStale(replica);
+    }
+
+    std::vector<std::string> fields;
+    if (ACLRedis::getInstance()->hvals(key, fields, values) == -1)
         return 1;
     return 0;
 }
 
-int RedisHelper::removeClient(const std::string &room_id, const std::string &client_id)
+template <typename T>
+int parseAll(const RedisReply &reply, std::vector<T> &items)
 {
-    std::string key = "client_" + room_id;
-    if (ACLRedis::getInstance()->hdel(key, client_id) == -1)
+    if (reply.type != RedisReply::ARRAY)
         return 1;
+    std::vector<std::string> values;
+    RedisPipeline::hashValues(reply, values);
+    items.clear();
+    for (std::string &v : values)
+    {
+        T item;
+        if (!T::parse(v, item))
+            items.push_back(item);
+    }
     return 0;
 }
 
-int RedisHelper::getAllClient(const std::string &room_id, std::vector<Client> &clients)
+template <typename T>
+int parseList(const RedisReply &reply, std::vector<T> &items)
 {
-    std::string key = "client_" + room_id;
-    std::vector<std::string> fields, values;
-    if (ACLRedis::getInstance()->hvals(key, fields, values) == -1)
+    if (reply.type != RedisReply::ARRAY)
         return 1;
-    clients.clear();
-    for (std::string &v : values)
+    items.clear();
+    for (const RedisReply &v : reply.elements)
     {
-        Client c;
-        if (!Client::fromJSON(v, c))
-            clients.push_back(c);
+        T item;
+        if (!T::parse(v.str, item))
+            items.push_back(item);
     }
     return 0;
 }
 
-int RedisHelper::addPublisher(const std::string &room_id, const Publisher &pubilsher)
+//ssrc和subscribe_count可能单独存放(见room_scripts.h),存在时覆盖记录中的值
+uint32_t replyToU32(const RedisReply &reply)
+{
+    return (uint32_t)strtoul(reply.str.c_str(), nullptr, 10);
+}
+
+void overlaySsrc(const RedisReply &reply, Publisher &publisher)
+{
+    //HMGET <id>:video <id>:audio
+    if (reply.type != RedisReply::ARRAY || reply.elements.size() != 2)
+        return;
+    if (reply.elements[0].type == RedisReply::STRING)
+        publisher.video_ssrc = replyToU32(reply.elements[0]);
+    if (reply.elements[1].type == RedisReply::STRING)
+        publisher.audio_ssrc = replyToU32(reply.elements[1]);
+}
+
+void overlaySsrc(const RedisReply &reply, std::vector<Publisher> &publishers)
+{
+    //HGETALL
+    if (reply.type != RedisReply::ARRAY || reply.elements.empty())
+        return;
+    std::unordered_map<std::string, uint32_t> ssrcs;
+    for (size_t i = 0; i + 1 < reply.elements.size(); i += 2)
+        ssrcs[reply.elements[i].str] = replyToU32(reply.elements[i + 1]);
+    for (Publisher &p : publishers)
+    {
+        auto it = ssrcs.find(p.id + ":video");
+        if (it != ssrcs.end())
+            p.video_ssrc = it->second;
+        it = ssrcs.find(p.id + ":audio");
+        if (it != ssrcs.end())
+            p.audio_ssrc = it->second;
+    }
+}
+
+void overlayCount(const RedisReply &reply, BridgeStream &bridge_stream)
+{
+    //HGET
+    if (reply.type == RedisReply::STRING)
+        bridge_stream.subscribe_count = atoi(reply.str.c_str());
+}
+
+void overlayCount(const RedisReply &reply, std::vector<BridgeStream> &bridge_streams)
+{
+    //HGETALL
+    if (reply.type != RedisReply::ARRAY || reply.elements.empty())
+        return;
+    std::unordered_map<std::string, int> counts;
+    for (size_t i = 0; i + 1 < reply.elements.size(); i += 2)
+        counts[reply.elements[i].str] = atoi(reply.elements[i + 1].str.c_str());
+    for (BridgeStream &b : bridge_streams)
+    {
+        auto it = counts.find(b.id);
+        if (it != counts.end())
+            b.subscribe_count = it->second;
+    }
+}
+
+const std::string &hotFieldsMode()
+{
+    return Config::getInstance()->redis_hot_fields;
+}
+
+int checkReplies(const std::vector<RedisReply> &replies)
+{
+    for (const RedisReply &reply : replies)
+    {
+        if (reply.isError())
+            return 1;
+    }
+    return 0;
+}
+
+//同步和异步版本共用的请求构造和回复解析
+void buildAddPublisher(RedisPipeline &pipeline, const std::string &room_id, const Publisher &publisher)
+{
+    pipeline.hset(roomKey("publisher_", room_id), publisher.id, publisher.serialize());
+    pipeline.command({"SADD", roomKey("publisher_by_client_", room_id) + ":" + publisher.client_id, publisher.id});
+}
+
+void buildAddClientAndGetAllPublisher(RedisPipeline &pipeline, const std::string &room_id,
+                                      const std::string &erizo_controller_id, const Client &client)
 {
-    std::string key = "publisher_" + room_id;
-    if (ACLRedis::getInstance()->hset(key, pubilsher.id, pubilsher.toJSON()) == -1)
+    std::string json = client.serialize();
+    pipeline.hset(roomKey("client_", room_id), client.id, json);
+    pipeline.command({"SADD", roomKey("indexed_client_", room_id), client.id});
+    pipeline.hset(erizo_controller_id, client.id, json);
+    pipeline.hgetall(roomKey("publisher_", room_id));
+    pipeline.hgetall(roomKey("publisher_ssrc_", room_id));
+}
+
+int parseAddClientAndGetAllPublisher(const std::vector<RedisReply> &replies, std::vector<Publisher> &publishers)
+{
+    if (checkReplies(replies) || parseAll(replies[3], publishers))
         return 1;
+    overlaySsrc(replies[4], publishers);
     return 0;
 }
 
-int RedisHelper::getPublisher(const std::string &room_id, const std::string &publisher_id, Publisher &publisher)
+std::vector<std::string> setSsrcKeys(const std::string &room_id)
 {
-    std::string key = "publisher_" + room_id;
-    std::string buf;
-    if (ACLRedis::getInstance()->hget(key, publisher_id, buf) == -1)
+    return {roomKey("publisher_", room_id), roomKey("publisher_ssrc_", room_id)};
+}
+
+std::vector<std::string> setSsrcArgs(const std::string &publisher_id, uint32_t video_ssrc, uint32_t audio_ssrc)
+{
+    return {publisher_id, std::to_string(video_ssrc), std::to_string(audio_ssrc), hotFieldsMode()};
+}
+
+int parseSetSsrc(const RedisReply &reply)
+{
+    if (reply.type != RedisReply::INTEGER || reply.integer != 1)
+        return 1;
+    return 0;
+}
+
+std::vector<std::string> subscribeKeys(const std::string &room_id)
+{
+    return {roomKey("publisher_", room_id), roomKey("subscriber_", room_id), roomKey("bridge_stream_", room_id),
+            roomKey("bridge_stream_index_", room_id), roomKey("subscriber_by_publisher_", room_id),
+            roomKey("subscriber_by_client_", room_id),
+            roomKey("publisher_ssrc_", room_id), roomKey("bridge_stream_count_", room_id)};
+}
+
+std::vector<std::string> subscribeArgs(const std::string &stream_id, const Subscriber &subscriber, const BridgeStream &bridge_stream)
+{
+    return {stream_id, subscriber.serialize(), bridge_stream.serialize(), hotFieldsMode()};
+}
+
+int parseSubscribe(const RedisReply &reply, RedisHelper::SubscribeResult &result)
+{
+    if (reply.type != RedisReply::ARRAY || reply.elements.empty() || reply.elements[0].type != RedisReply::INTEGER)
+        return 1;
+
+    const std::vector<RedisReply> &e = reply.elements;
+    result = RedisHelper::SubscribeResult();
+    if (e[0].integer == 0)
         return 1;
-    if (Publisher::fromJSON(buf, publisher))
+    if (e[0].integer == 1)
+        return 0;
+
+    if (e.size() < 3 ||
+        Publisher::parse(e[1].str, result.publisher) ||
+        Subscriber::parse(e[2].str, result.subscriber))
         return 1;
+    result.ready = true;
 
+    if (e.size() >= 5)
+    {
+        if (BridgeStream::parse(e[3].str, result.bridge_stream))
+            return 1;
+        result.has_bridge_stream = true;
+        result.bridge_stream_created = (e[4].integer == 1);
+    }
     return 0;
 }
 
-int RedisHelper::removePublishers(const std::string &room_id, const std::vector<std::string> &publisher_ids)
+void buildGetPublisher(RedisPipeline &pipeline, const std::string &room_id, const std::string &publisher_id)
 {
-    std::string key = "publisher_" + room_id;
-    if (ACLRedis::getInstance()->hdel(key, publisher_ids) == -1)
+    pipeline.hget(roomKey("publisher_", room_id), publisher_id);
+    pipeline.command({"HMGET", roomKey("publisher_ssrc_", room_id), publisher_id + ":video", publisher_id + ":audio"});
+}
+
+int parseGetPublisher(const std::vector<RedisReply> &replies, Publisher &publisher)
+{
+    if (checkReplies(replies) || Publisher::parse(replies[0].str, publisher))
         return 1;
+    overlaySsrc(replies[1], publisher);
     return 0;
 }
 
-int RedisHelper::getAllPublisher(const std::string &room_id, std::vector<Publisher> &publishers)
+void buildGetAllPublisher(RedisPipeline &pipeline, const std::string &room_id)
+{
+    pipeline.hgetall(roomKey("publisher_", room_id));
+    pipeline.hgetall(roomKey("publisher_ssrc_", room_id));
+}
+
+int parseGetAllPublisher(const std::vector<RedisReply> &replies, std::vector<Publisher> &publishers)
+{
+    if (checkReplies(replies) || parseAll(replies[0], publishers))
+        return 1;
+    overlaySsrc(replies[1], publishers);
+    return 0;
+}
+
+//erizo_controller的client集合与房间不在同一个slot,集群模式下脚本里不删除(KEYS[5]重复传入client key),
+//由调用方在脚本之后单独HDEL
+std::vector<std::string> removeClientKeys(const std::string &room_id, const std::string &erizo_controller_id)
+{
+    std::string client_key = roomKey("client_", room_id);
+    return {roomKey("subscriber_", room_id), roomKey("publisher_", room_id), roomKey("bridge_stream_", room_id),
+            client_key, RedisCluster::enabled() ? client_key : erizo_controller_id,
+            roomKey("bridge_stream_index_", room_id), roomKey("subscriber_by_publisher_", room_id),
+            roomKey("subscriber_by_client_", room_id), roomKey("publisher_by_client_", room_id),
+            roomKey("publisher_ssrc_", room_id), roomKey("bridge_stream_count_", room_id),
+            roomKey("indexed_client_", room_id)};
+}
+
+int parseRemoveClient(const RedisReply &reply, std::vector<Subscriber> &subscribers, std::vector<Publisher> &publishers,
+                      std::vector<BridgeStream> &bridge_streams)
+{
+    if (reply.type != RedisReply::ARRAY || reply.elements.size() != 3)
+        return 1;
+    if (parseList(reply.elements[0], subscribers) ||
+        parseList(reply.elements[1], publishers) ||
+        parseList(reply.elements[2], bridge_streams))
+        return 1;
+    return 0;
+}
+} // namespace
+
+int RedisHelper::addClient(const std::string &room_id, const Client &client)
 {
-    std::string key = "publisher_" + room_id;
+    RedisPipeline pipeline;
+    pipeline.hset(roomKey("client_", room_id), client.id, client.serialize());
+    pipeline.command({"SADD", roomKey("indexed_client_", room_id), client.id});
+
+    std::vector<RedisReply> replies;
+    if (pipeline.exec(replies) || checkReplies(replies))
+        return 1;
+    return 0;
+}
+
+int RedisHelper::removeClient(const std::string &room_id, const std::string &client_id)
+{
+    RedisPipeline pipeline;
+    pipeline.hdel(roomKey("client_", room_id), client_id);
+    pipeline.command({"SREM", roomKey("indexed_client_", room_id), client_id});
+
+    std::vector<RedisReply> replies;
+    if (pipeline.exec(replies) || checkReplies(replies))
+        return 1;
+    return 0;
+}
+
+int RedisHelper::getAllClient(const std::string &room_id, std::vector<Client> &clients)
+{
+    std::string key = roomKey("client_", room_id);
     std::vector<std::string> fields, values;
     if (ACLRedis::getInstance()->hvals(key, fields, values) == -1)
         return 1;
-    publishers.clear();
+    clients.clear();
     for (std::string &v : values)
     {
-        Publisher p;
-        if (!Publisher::fromJSON(v, p))
-            publishers.push_back(p);
+        Client c;
+        if (!Client::parse(v, c))
+            clients.push_back(c);
     }
     return 0;
 }
 
-int RedisHelper::addSubscriber(const std::string &room_id, const Subscriber &subscriber)
+int RedisHelper::addPublisher(const std::string &room_id, const Publisher &pubilsher)
 {
-    std::string key = "subscriber_" + room_id;
-    if (ACLRedis::getInstance()->hset(key, subscriber.id, subscriber.toJSON()) == -1)
+    RedisPipeline pipeline;
+    buildAddPublisher(pipeline, room_id, pubilsher);
+
+    std::vector<RedisReply> replies;
+    if (pipeline.exec(replies) || checkReplies(replies))
         return 1;
     return 0;
 }
 
-int RedisHelper::removeSubscribers(const std::string &room_id, const std::vector<std::string> &subscriber_ids)
+int RedisHelper::getPublisher(const std::string &room_id, const std::string &publisher_id, Publisher &publisher)
 {
-    std::string key = "subscriber_" + room_id;
-    if (ACLRedis::getInstance()->hdel(key, subscriber_ids) == -1)
+    RedisPipeline pipeline;
+    buildGetPublisher(pipeline, room_id, publisher_id);
+
+    std::vector<RedisReply> replies;
+    if (pipeline.exec(replies))
         return 1;
-    return 0;
+    return parseGetPublisher(replies, publisher);
+}
+
+int RedisHelper::getAllPublisher(const std::string &room_id, std::vector<Publisher> &publishers)
+{
+    RedisPipeline pipeline;
+    buildGetAllPublisher(pipeline, room_id);
+
+    std::vector<RedisReply> replies;
+    if (pipeline.exec(replies))
+        return 1;
+    return parseGetAllPublisher(replies, publishers);
 }
 
 int RedisHelper::getAllSubscriber(const std::string &room_id, std::vector<Subscriber> &subscribers)
 {
-    std::string key = "subscriber_" + room_id;
+    std::string key = roomKey("subscriber_", room_id);
     std::vector<std::string> fields, values;
     if (ACLRedis::getInstance()->hvals(key, fields, values) == -1)
         return 1;
@@ -106,17 +371,17 @@ int RedisHelper::getAllSubscriber(const std::string &room_id, std::vector<Subscr
     for (std::string &v : values)
     {
         Subscriber s;
-        if (!Subscriber::fromJSON(v, s))
+        if (!Subscriber::parse(v, s))
             subscribers.push_back(s);
     }
     return 0;
 }
 
-int RedisHelper::getAllErizoAgent(const std::string &area, std::vector<ErizoAgent> &agents)
+int RedisHelper::getAllErizoAgent(const std::string &area, std::vector<ErizoAgent> &agents, bool allow_stale)
 {
-    std::vector<std::string> fields, values;
+    std::vector<std::string> values;
     std::string key = "erizo_agent_" + area + "_heartbeat";
-    if (ACLRedis::getInstance()->hvals(key, fields, values) == -1)
+    if (hashValues(key, values, allow_stale))
         return 1;
     agents.clear();
     for (std::string &v : values)
@@ -143,52 +408,39 @@ int RedisHelper::getAllErizoAgent(const std::string &area, std::vector<ErizoAgen
 //     return 0;
 // }
 
-int RedisHelper::addBridgeStream(const std::string &room_id, const BridgeStream &bridge_stream)
-{
-    std::string key = "bridge_stream_" + room_id;
-    if (ACLRedis::getInstance()->hset(key, bridge_stream.id, bridge_stream.toJSON()) == -1)
-        return 1;
-    return 0;
-}
-
 int RedisHelper::getBridgeStream(const std::string &room_id, const std::string &bridge_stream_id, BridgeStream &bridge_stream)
 {
-    std::string key = "bridge_stream_" + room_id;
-    std::string buf;
-    if (ACLRedis::getInstance()->hget(key, bridge_stream_id, buf) == -1)
+    RedisPipeline pipeline;
+    pipeline.hget(roomKey("bridge_stream_", room_id), bridge_stream_id);
+    pipeline.hget(roomKey("bridge_stream_count_", room_id), bridge_stream_id);
+
+    std::vector<RedisReply> replies;
+    if (pipeline.exec(replies) || checkReplies(replies))
         return 1;
-    if (BridgeStream::fromJSON(buf, bridge_stream))
+    if (BridgeStream::parse(replies[0].str, bridge_stream))
         return 1;
+    overlayCount(replies[1], bridge_stream);
     return 0;
 }
 
 int RedisHelper::getAllBridgeStream(const std::string &room_id, std::vector<BridgeStream> &bridge_streams)
 {
-    std::string key = "bridge_stream_" + room_id;
-    std::vector<std::string> fields, values;
-    if (ACLRedis::getInstance()->hvals(key, fields, values) == -1)
-        return 1;
-    bridge_streams.clear();
-    for (std::string &v : values)
-    {
-        BridgeStream s;
-        if (!BridgeStream::fromJSON(v, s))
-            bridge_streams.push_back(s);
-    }
-    return 0;
-}
+    RedisPipeline pipeline;
+    pipeline.hgetall(roomKey("bridge_stream_", room_id));
+    pipeline.hgetall(roomKey("bridge_stream_count_", room_id));
 
-int RedisHelper::removeBridgeStream(const std::string &room_id, const std::string &bridge_stream_id)
-{
-    std::string key = "bridge_stream_" + room_id;
-    if (ACLRedis::getInstance()->hdel(key, bridge_stream_id) == -1)
+    std::vector<RedisReply> replies;
+    if (pipeline.exec(replies) || checkReplies(replies))
+        return 1;
+    if (parseAll(replies[0], bridge_streams))
         return 1;
+    overlayCount(replies[1], bridge_streams);
     return 0;
 }
 
 int RedisHelper::addClientToEC(const std::string &erizo_controller_id, const Client &client)
 {
-    if (ACLRedis::getInstance()->hset(erizo_controller_id, client.id, client.toJSON()) == -1)
+    if (ACLRedis::getInstance()->hset(erizo_controller_id, client.id, client.serialize()) == -1)
         return 1;
     return 0;
 }
@@ -208,12 +460,179 @@ int RedisHelper::getAllClientFromEC(const std::string &erizo_controller_id, std:
     for (std::string &v : values)
     {
         Client c;
-        if (!Client::fromJSON(v, c))
+        if (!Client::parse(v, c))
             clients.push_back(c);
     }
     return 0;
 }
 
+int RedisHelper::addClientAndGetAllPublisher(const std::string &room_id, const std::string &erizo_controller_id,
+                                             const Client &client, std::vector<Publisher> &publishers)
+{
+    RedisPipeline pipeline;
+    buildAddClientAndGetAllPublisher(pipeline, room_id, erizo_controller_id, client);
+
+    std::vector<RedisReply> replies;
+    if (pipeline.exec(replies) || parseAddClientAndGetAllPublisher(replies, publishers))
+        return 1;
+    return 0;
+}
+
+int RedisHelper::loadScripts()
+{
+    if (RoomScripts::loadAll() || RedisLocker::loadScripts())
+        return 1;
+    return 0;
+}
+
+int RedisHelper::setPublisherSsrc(const std::string &room_id, const std::string &publisher_id, uint32_t video_ssrc, uint32_t audio_ssrc)
+{
+    RedisReply reply;
+    if (RoomScripts::publisherSetSsrc().exec(setSsrcKeys(room_id), setSsrcArgs(publisher_id, video_ssrc, audio_ssrc), reply))
+        return 1;
+    return parseSetSsrc(reply);
+}
+
+int RedisHelper::subscribe(const std::string &room_id, const std::string &stream_id, const Subscriber &subscriber,
+                           const BridgeStream &bridge_stream, SubscribeResult &result)
+{
+    RedisReply reply;
+    if (RoomScripts::subscribe().exec(subscribeKeys(room_id), subscribeArgs(stream_id, subscriber, bridge_stream), reply))
+        return 1;
+    return parseSubscribe(reply, result);
+}
+
+int RedisHelper::removeClientFromRoom(const std::string &room_id, const std::string &erizo_controller_id, const std::string &client_id,
+                                      std::vector<Subscriber> &subscribers, std::vector<Publisher> &publishers,
+                                      std::vector<BridgeStream> &bridge_streams)
+{
+    RedisReply reply;
+    if (RoomScripts::removeClient().exec(removeClientKeys(room_id, erizo_controller_id), {client_id, hotFieldsMode()}, reply))
+        return 1;
+    //失败只会让该erizo_controller过期时多清理一次已删除的client
+    if (RedisCluster::enabled())
+        ACLRedis::getInstance()->hdel(erizo_controller_id, client_id);
+    return parseRemoveClient(reply, subscribers, publishers, bridge_streams);
+}
+
+void RedisHelper::asyncAddPublisher(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id, const Publisher &publisher,
+                                    const std::function<void(int err)> &cb)
+{
+    RedisPipeline pipeline;
+    buildAddPublisher(pipeline, room_id, publisher);
+    redis->exec(pipeline, [cb](int err, std::vector<RedisReply> &replies) {
+        cb((err || checkReplies(replies)) ? 1 : 0);
+    });
+}
+
+void RedisHelper::asyncAddClientAndGetAllPublisher(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id,
+                                                   const std::string &erizo_controller_id, const Client &client,
+                                                   const std::function<void(int err, std::vector<Publisher> &publishers)> &cb)
+{
+    RedisPipeline pipeline;
+    buildAddClientAndGetAllPublisher(pipeline, room_id, erizo_controller_id, client);
+    redis->exec(pipeline, [cb](int err, std::vector<RedisReply> &replies) {
+        std::vector<Publisher> publishers;
+        if (!err)
+            err = parseAddClientAndGetAllPublisher(replies, publishers);
+        cb(err, publishers);
+    });
+}
+
+void RedisHelper::asyncGetAllClient(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id,
+                                    const std::function<void(int err, std::vector<Client> &clients)> &cb)
+{
+    RedisPipeline pipeline;
+    pipeline.hgetall(roomKey("client_", room_id));
+    redis->exec(pipeline, [cb](int err, std::vector<RedisReply> &replies) {
+        std::vector<Client> clients;
+        if (!err)
+            err = (checkReplies(replies) || parseAll(replies[0], clients)) ? 1 : 0;
+        cb(err, clients);
+    });
+}
+
+void RedisHelper::asyncGetAllClientFromEC(const std::shared_ptr<AsyncRedis> &redis, const std::string &erizo_controller_id,
+                                         const std::function<void(int err, std::vector<Client> &clients)> &cb)
+{
+    RedisPipeline pipeline;
+    pipeline.hgetall(erizo_controller_id);
+    redis->exec(pipeline, [cb](int err, std::vector<RedisReply> &replies) {
+        std::vector<Client> clients;
+        if (!err)
+            err = (checkReplies(replies) || parseAll(replies[0], clients)) ? 1 : 0;
+        cb(err, clients);
+    });
+}
+
+void RedisHelper::asyncGetPublisher(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id, const std::string &publisher_id,
+                                    const std::function<void(int err, Publisher &publisher)> &cb)
+{
+    RedisPipeline pipeline;
+    buildGetPublisher(pipeline, room_id, publisher_id);
+    redis->exec(pipeline, [cb](int err, std::vector<RedisReply> &replies) {
+        Publisher publisher;
+        if (!err)
+            err = parseGetPublisher(replies, publisher);
+        cb(err, publisher);
+    });
+}
+
+void RedisHelper::asyncGetAllPublisher(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id,
+                                       const std::function<void(int err, std::vector<Publisher> &publishers)> &cb)
+{
+    RedisPipeline pipeline;
+    buildGetAllPublisher(pipeline, room_id);
+    redis->exec(pipeline, [cb](int err, std::vector<RedisReply> &replies) {
+        std::vector<Publisher> publishers;
+        if (!err)
+            err = parseGetAllPublisher(replies, publishers);
+        cb(err, publishers);
+    });
+}
+
+void RedisHelper::asyncSetPublisherSsrc(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id, const std::string &publisher_id,
+                                        uint32_t video_ssrc, uint32_t audio_ssrc, const std::function<void(int err)> &cb)
+{
+    RoomScripts::publisherSetSsrc().execAsync(redis, setSsrcKeys(room_id), setSsrcArgs(publisher_id, video_ssrc, audio_ssrc),
+                                              [cb](int err, RedisReply &reply) {
+                                                  cb(err ? 1 : parseSetSsrc(reply));
+                                              });
+}
+
+void RedisHelper::asyncSubscribe(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id, const std::string &stream_id,
+                                 const Subscriber &subscriber, const BridgeStream &bridge_stream,
+                                 const std::function<void(int err, SubscribeResult &result)> &cb)
+{
+    RoomScripts::subscribe().execAsync(redis, subscribeKeys(room_id), subscribeArgs(stream_id, subscriber, bridge_stream),
+                                       [cb](int err, RedisReply &reply) {
+                                           SubscribeResult result;
+                                           if (!err)
+                                               err = parseSubscribe(reply, result);
+                                           cb(err, result);
+                                       });
+}
+
+void RedisHelper::asyncRemoveClientFromRoom(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id,
+                                            const std::string &erizo_controller_id, const std::string &client_id,
+                                            const std::function<void(int err, RemovedRecords &removed)> &cb)
+{
+    RoomScripts::removeClient().execAsync(redis, removeClientKeys(room_id, erizo_controller_id), {client_id, hotFieldsMode()},
+                                          [cb](int err, RedisReply &reply) {
+                                              RemovedRecords removed;
+                                              if (!err)
+                                                  err = parseRemoveClient(reply, removed.subscribers, removed.publishers,
+                                                                          removed.bridge_streams);
+                                              cb(err, removed);
+                                          });
+    if (RedisCluster::enabled())
+    {
+        RedisPipeline pipeline;
+        pipeline.hdel(erizo_controller_id, client_id);
+        redis->exec(pipeline, [](int err, std::vector<RedisReply> &replies) {});
+    }
+}
+
 int RedisHelper::addHeartbeatData(const ErizoController::HEARTBEAT &heartbeat_data)
 {
     if (ACLRedis::getInstance()->hset("erizo_controller_heartbeat", heartbeat_data.id, heartbeat_data.toJSON()) == -1)
@@ -226,10 +645,10 @@ int RedisHelper::removeHeartbeatData(const std::string &id)
         return 1;
     return 0;
 }
-int RedisHelper::getAllHeartbeatData(std::vector<ErizoController::HEARTBEAT> &heartbeats)
+int RedisHelper::getAllHeartbeatData(std::vector<ErizoController::HEARTBEAT> &heartbeats, bool allow_stale)
 {
-    std::vector<std::string> fields, values;
-    if (ACLRedis::getInstance()->hvals("erizo_controller_heartbeat", fields, values) == -1)
+    std::vector<std::string> values;
+    if (hashValues("erizo_controller_heartbeat", values, allow_stale))
         return 1;
     heartbeats.clear();
     for (std::string &v : values)
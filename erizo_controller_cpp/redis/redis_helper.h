@@ -1,6 +1,9 @@
 #ifndef REDIS_HELPER_H
 #define REDIS_HELPER_H
 
+#include <memory>
+#include <functional>
+
 #include "core/erizo_controller.h"
 #include "model/publisher.h"
 #include "model/subscriber.h"
@@ -9,6 +12,8 @@
 #include "model/erizo_agent.h"
 #include "model/bridge_stream.h"
 
+class AsyncRedis;
+
 class RedisHelper
 {
 public:
@@ -16,31 +21,85 @@ public:
   static int removeClient(const std::string &room_id, const std::string &client_id);
   static int getAllClient(const std::string &room_id, std::vector<Client> &clients);
 
+  //同时维护publisher_by_client索引,subscriber/bridge_stream只通过RoomScripts修改
   static int addPublisher(const std::string &room_id, const Publisher &publisher);
   static int getPublisher(const std::string &room_id, const std::string &publisher_id, Publisher &publisher);
-  static int removePublishers(const std::string &room_id, const std::vector<std::string> &publisher_ids);
   static int getAllPublisher(const std::string &room_id, std::vector<Publisher> &publishers);
 
-  static int addSubscriber(const std::string &room_id, const Subscriber &subscriber);
-  static int removeSubscribers(const std::string &room_id, const std::vector<std::string> &subscriber_ids);
   static int getAllSubscriber(const std::string &room_id, std::vector<Subscriber> &subscribers);
 
-  static int getAllErizoAgent(const std::string &area, std::vector<ErizoAgent> &agents);
+  //allow_stale: 可以从从库读取,数据最多落后redis_replica_max_lag秒
+  static int getAllErizoAgent(const std::string &area, std::vector<ErizoAgent> &agents, bool allow_stale = false);
   // static int removeErizoAgent(const std::string &area, const ErizoAgent &agent);
   // static int removeAllErizo(const ErizoAgent &agent);
 
-  static int addBridgeStream(const std::string &room_id, const BridgeStream &bridge_stream);
   static int getBridgeStream(const std::string &room_id, const std::string &bridge_stream_id, BridgeStream &bridge_stream);
-  static int removeBridgeStream(const std::string &room_id, const std::string &bridge_stream_id);
   static int getAllBridgeStream(const std::string &room_id, std::vector<BridgeStream> &bridge_streams);
 
   static int addClientToEC(const std::string &erizo_controller_id, const Client &client);
   static int removeClientFromEC(const std::string &erizo_controller_id, const std::string &client_id);
   static int getAllClientFromEC(const std::string &erizo_controller_id, std::vector<Client> &clients);
 
+  //多步操作合并成一个pipeline,一次往返
+  //handleToken: 写入client和EC集合,同时读取房间内所有publisher
+  static int addClientAndGetAllPublisher(const std::string &room_id, const std::string &erizo_controller_id,
+                                         const Client &client, std::vector<Publisher> &publishers);
+
+  //以下通过Lua脚本原子完成,不需要锁房间
+  struct SubscribeResult
+  {
+    bool ready; //publisher已有ssrc,subscriber已写入
+    Publisher publisher;
+    Subscriber subscriber;
+    bool has_bridge_stream;
+    bool bridge_stream_created;
+    BridgeStream bridge_stream;
+    SubscribeResult() : ready(false),
+                        has_bridge_stream(false),
+                        bridge_stream_created(false) {}
+  };
+  static int loadScripts();
+  static int setPublisherSsrc(const std::string &room_id, const std::string &publisher_id, uint32_t video_ssrc, uint32_t audio_ssrc);
+  //写入subscriber,跨agent时新建bridge-stream或增加其引用计数
+  static int subscribe(const std::string &room_id, const std::string &stream_id, const Subscriber &subscriber,
+                       const BridgeStream &bridge_stream, SubscribeResult &result);
+  //删除client及其相关的subscriber/publisher,返回被删除的记录
+  static int removeClientFromRoom(const std::string &room_id, const std::string &erizo_controller_id, const std::string &client_id,
+                                  std::vector<Subscriber> &subscribers, std::vector<Publisher> &publishers,
+                                  std::vector<BridgeStream> &bridge_streams);
+
+  //非阻塞版本,供worker线程上的信令处理使用;回调在redis所属worker的线程里执行
+  struct RemovedRecords
+  {
+    std::vector<Subscriber> subscribers;
+    std::vector<Publisher> publishers;
+    std::vector<BridgeStream> bridge_streams;
+  };
+  static void asyncAddPublisher(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id, const Publisher &publisher,
+                                const std::function<void(int err)> &cb);
+  static void asyncAddClientAndGetAllPublisher(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id,
+                                               const std::string &erizo_controller_id, const Client &client,
+                                               const std::function<void(int err, std::vector<Publisher> &publishers)> &cb);
+  static void asyncGetAllClient(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id,
+                                const std::function<void(int err, std::vector<Client> &clients)> &cb);
+  static void asyncGetAllClientFromEC(const std::shared_ptr<AsyncRedis> &redis, const std::string &erizo_controller_id,
+                                     const std::function<void(int err, std::vector<Client> &clients)> &cb);
+  static void asyncGetPublisher(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id, const std::string &publisher_id,
+                                const std::function<void(int err, Publisher &publisher)> &cb);
+  static void asyncGetAllPublisher(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id,
+                                   const std::function<void(int err, std::vector<Publisher> &publishers)> &cb);
+  static void asyncSetPublisherSsrc(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id, const std::string &publisher_id,
+                                    uint32_t video_ssrc, uint32_t audio_ssrc, const std::function<void(int err)> &cb);
+  static void asyncSubscribe(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id, const std::string &stream_id,
+                             const Subscriber &subscriber, const BridgeStream &bridge_stream,
+                             const std::function<void(int err, SubscribeResult &result)> &cb);
+  static void asyncRemoveClientFromRoom(const std::shared_ptr<AsyncRedis> &redis, const std::string &room_id,
+                                        const std::string &erizo_controller_id, const std::string &client_id,
+                                        const std::function<void(int err, RemovedRecords &removed)> &cb);
+
   static int addHeartbeatData(const ErizoController::HEARTBEAT &heartbeat_data);
   static int removeHeartbeatData(const std::string &erizo_controller_id);
-  static int getAllHeartbeatData(std::vector<ErizoController::HEARTBEAT> &heartbeats);
+  static int getAllHeartbeatData(std::vector<ErizoController::HEARTBEAT> &heartbeats, bool allow_stale = false);
 };
 
 #endif
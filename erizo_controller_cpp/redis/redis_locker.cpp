@@ -1,13 +1,61 @@
 #include "redis_locker.h"
 
 #include <sstream>
+#include <algorithm>
 
 #include "acl_redis.h"
+#include "redis_script.h"
+#include "redis_pipeline.h"
+#include "redis_cluster.h"
 #include "common/utils.h"
 #include "common/config.h"
 
+namespace
+{
+//KEYS[1] 锁 KEYS[2] fencing计数器
+//ARGV[1] owner ARGV[2] 过期时间(ms)
+//成功返回{1, fencing token},失败返回{0, 锁剩余毫秒}
+const char *kAcquire = R"lua(
+if redis.call('SET', KEYS[1], ARGV[1], 'NX', 'PX', ARGV[2]) then
+    return {1, redis.call('INCR', KEYS[2])}
+end
+return {0, redis.call('PTTL', KEYS[1])}
+)lua";
+
+//KEYS[1] 锁 KEYS[2] 唤醒队列
+//只删除自己持有的锁,并往唤醒队列放一个令牌,让BLPOP上排队最久的等待者去抢锁
+const char *kRelease = R"lua(
+if redis.call('GET', KEYS[1]) ~= ARGV[1] then
+    return 0
+end
+redis.call('DEL', KEYS[1])
+if redis.call('LLEN', KEYS[2]) == 0 then
+    redis.call('RPUSH', KEYS[2], '1')
+end
+redis.call('PEXPIRE', KEYS[2], ARGV[2])
+return 1
+)lua";
+
+//单次BLPOP最长阻塞时间,持锁者崩溃时靠锁过期兜底,需要定期回来重试
+const int64_t kMaxBlockMs = 1000;
+
+const RedisScript &acquireScript()
+{
+    static const RedisScript script(kAcquire);
+    return script;
+}
+
+const RedisScript &releaseScript()
+{
+    static const RedisScript script(kRelease);
+    return script;
+}
+} // namespace
+
 RedisLocker::RedisLocker() : key_(""),
-                             locked_(false)
+                             locked_(false),
+                             fenced_(Config::getInstance()->redis_lock_mode == "fenced"),
+                             fencing_token_(0)
 
 {
 }
@@ -17,6 +65,15 @@ RedisLocker::~RedisLocker()
     unlock();
 }
 
+int RedisLocker::loadScripts()
+{
+    if (Config::getInstance()->redis_lock_mode != "fenced")
+        return 0;
+    if (acquireScript().load() || releaseScript().load())
+        return 1;
+    return 0;
+}
+
 bool RedisLocker::try_lock(const std::string &key)
 {
     if (locked_)
@@ -72,12 +129,20 @@ void RedisLocker::unlock()
 {
     if (!locked_)
         return;
+    if (fenced_)
+    {
+        unlockFenced();
+        return;
+    }
     ACLRedis::getInstance()->del(key_);
     locked_ = false;
 }
 
 bool RedisLocker::lock(const std::string &key)
 {
+    if (fenced_)
+        return lockFenced(key);
+
     bool ret;
     int try_time = Config::getInstance()->redis_lock_try_time;
     do
@@ -87,4 +152,67 @@ bool RedisLocker::lock(const std::string &key)
             usleep(10000); // 10ms
     } while (!ret && try_time--);
     return ret;
-}
\ No newline at end of file
+}
+
+bool RedisLocker::lockFenced(const std::string &key)
+{
+    if (locked_)
+        return true;
+
+    //锁、fencing计数器和唤醒队列必须在同一个slot
+    key_ = RedisCluster::tagKey(key);
+    owner_ = Utils::getUUID();
+    fencing_token_ = 0;
+
+    Config *config = Config::getInstance();
+    std::string ttl = std::to_string(config->redis_lock_timeout);
+    //和legacy模式的总等待时间一致: try_time次 * 10ms
+    uint64_t deadline = Utils::getCurrentMs() + (uint64_t)config->redis_lock_try_time * 10;
+
+    while (true)
+    {
+        RedisReply reply;
+        if (acquireScript().exec({key_, key_ + ":fence"}, {owner_, ttl}, reply) ||
+            reply.type != RedisReply::ARRAY ||
+            reply.elements.size() != 2)
+            return false;
+
+        if (reply.elements[0].integer == 1)
+        {
+            fencing_token_ = (uint64_t)reply.elements[1].integer;
+            locked_ = true;
+            return true;
+        }
+
+        uint64_t now = Utils::getCurrentMs();
+        if (now >= deadline)
+            return false;
+
+        //等待持锁者释放时的唤醒,最多等到锁过期或者超时
+        int64_t wait_ms = std::min<int64_t>(deadline - now, kMaxBlockMs);
+        int64_t pttl = reply.elements[1].integer;
+        if (pttl > 0)
+            wait_ms = std::min<int64_t>(wait_ms, pttl);
+        if (wait_ms <= 0)
+            continue;
+
+        //BLPOP的小数超时需要redis 6.0以上
+        char timeout[32];
+        snprintf(timeout, sizeof(timeout), "%.3f", wait_ms / 1000.0);
+        RedisPipeline pipeline;
+        pipeline.command({"BLPOP", key_ + ":wake", timeout});
+        std::vector<RedisReply> replies;
+        if (pipeline.exec(replies))
+            return false;
+    }
+}
+
+void RedisLocker::unlockFenced()
+{
+    RedisReply reply;
+    releaseScript().exec({key_, key_ + ":wake"},
+                         {owner_, std::to_string(Config::getInstance()->redis_lock_timeout)},
+                         reply);
+    locked_ = false;
+    fencing_token_ = 0;
+}
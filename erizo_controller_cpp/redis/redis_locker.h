@@ -2,6 +2,7 @@
 #define REDIS_LOCKER_H
 
 #include <string>
+#include <stdint.h>
 
 class RedisLocker
 {
@@ -11,12 +12,24 @@ public:
   bool lock(const std::string &key);
   void unlock();
 
+  //fenced模式下每次加锁得到的单调递增序号,legacy模式为0
+  //持锁期间写外部资源时带上,资源方拒绝比已见过的更小的序号
+  uint64_t getFencingToken() const { return fencing_token_; }
+
+  static int loadScripts();
+
 private:
   bool try_lock(const std::string &key);
 
+  bool lockFenced(const std::string &key);
+  void unlockFenced();
+
 private:
   std::string key_;
   bool locked_;
+  bool fenced_;
+  std::string owner_;
+  uint64_t fencing_token_;
 };
 
-#endif
\ No newline at end of file
+#endif
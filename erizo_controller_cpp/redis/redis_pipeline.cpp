@@ -0,0 +1,103 @@
+#include "redis_pipeline.h"
+
+#include "acl_redis.h"
+#include "redis_cluster.h"
+
+namespace
+{
+int commandSlot(const std::vector<std::string> &argv)
+{
+    if (argv.size() < 2)
+        return -1;
+    const std::string &name = argv[0];
+    //EVAL/EVALSHA script numkeys key...
+    if (name == "EVAL" || name == "EVALSHA")
+        return (argv.size() > 3 && argv[2] != "0") ? RedisCluster::keySlot(argv[3]) : -1;
+    if (name == "SCRIPT" || name == "AUTH" || name == "INFO" || name == "CLUSTER" || name == "PING")
+        return -1;
+    return RedisCluster::keySlot(argv[1]);
+}
+} // namespace
+
+RedisPipeline::RedisPipeline() : count_(0)
+{
+}
+
+void RedisPipeline::command(const std::vector<std::string> &argv)
+{
+    offsets_.push_back(req_.size());
+    slots_.push_back(commandSlot(argv));
+
+    //RESP: *<argc>\r\n$<len>\r\n<arg>\r\n...
+    req_ += "*" + std::to_string(argv.size()) + "\r\n";
+    for (const std::string &arg : argv)
+    {
+        req_ += "$" + std::to_string(arg.size()) + "\r\n";
+        req_ += arg;
+        req_ += "\r\n";
+    }
+    count_++;
+}
+
+void RedisPipeline::hset(const std::string &key, const std::string &field, const std::string &value)
+{
+    command({"HSET", key, field, value});
+}
+
+void RedisPipeline::hget(const std::string &key, const std::string &field)
+{
+    command({"HGET", key, field});
+}
+
+void RedisPipeline::hdel(const std::string &key, const std::string &field)
+{
+    command({"HDEL", key, field});
+}
+
+void RedisPipeline::hdel(const std::string &key, const std::vector<std::string> &fields)
+{
+    std::vector<std::string> argv = {"HDEL", key};
+    argv.insert(argv.end(), fields.begin(), fields.end());
+    command(argv);
+}
+
+void RedisPipeline::hgetall(const std::string &key)
+{
+    command({"HGETALL", key});
+}
+
+void RedisPipeline::del(const std::string &key)
+{
+    command({"DEL", key});
+}
+
+std::string RedisPipeline::encoded(size_t index) const
+{
+    size_t end = (index + 1 < offsets_.size()) ? offsets_[index + 1] : req_.size();
+    return req_.substr(offsets_[index], end - offsets_[index]);
+}
+
+void RedisPipeline::clear()
+{
+    req_.clear();
+    count_ = 0;
+    offsets_.clear();
+    slots_.clear();
+}
+
+int RedisPipeline::exec(std::vector<RedisReply> &replies)
+{
+    replies.clear();
+    if (count_ == 0)
+        return 0;
+    if (RedisCluster::enabled())
+        return RedisCluster::getInstance()->exec(*this, replies);
+    return ACLRedis::getInstance()->pipeline(req_, count_, replies);
+}
+
+void RedisPipeline::hashValues(const RedisReply &reply, std::vector<std::string> &values)
+{
+    values.clear();
+    for (size_t i = 1; i < reply.elements.size(); i += 2)
+        values.push_back(reply.elements[i].str);
+}
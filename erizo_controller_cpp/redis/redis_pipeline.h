@@ -0,0 +1,65 @@
+#ifndef REDIS_PIPELINE_H
+#define REDIS_PIPELINE_H
+
+#include <string>
+#include <vector>
+
+struct RedisReply
+{
+  enum Type
+  {
+    NIL,
+    ERROR,
+    STATUS,
+    INTEGER,
+    STRING,
+    ARRAY
+  };
+
+  Type type;
+  long long integer;
+  std::string str;
+  std::vector<RedisReply> elements;
+
+  RedisReply() : type(NIL),
+                 integer(0) {}
+
+  bool isError() const { return type == ERROR; }
+};
+
+//把多条命令编码到一个请求里,一次写出、一次读回所有回复
+class RedisPipeline
+{
+public:
+  RedisPipeline();
+
+  void command(const std::vector<std::string> &argv);
+  void hset(const std::string &key, const std::string &field, const std::string &value);
+  void hget(const std::string &key, const std::string &field);
+  void hdel(const std::string &key, const std::string &field);
+  void hdel(const std::string &key, const std::vector<std::string> &fields);
+  void hgetall(const std::string &key);
+  void del(const std::string &key);
+
+  size_t size() const { return count_; }
+  const std::string &request() const { return req_; }
+  //第index条编码好的命令,以及它的第一个key所在的slot(没有key的命令为-1),集群模式下按此分发
+  std::string encoded(size_t index) const;
+  int slot(size_t index) const { return slots_[index]; }
+  bool empty() const { return count_ == 0; }
+  void clear();
+
+  //replies与命令一一对应,网络/协议错误时返回1,单条命令的错误放在对应的reply里
+  int exec(std::vector<RedisReply> &replies);
+
+  //hgetall回复中的value部分
+  static void hashValues(const RedisReply &reply, std::vector<std::string> &values);
+
+private:
+  std::string req_;
+  size_t count_;
+  std::vector<size_t> offsets_;
+  std::vector<int> slots_;
+};
+
+#endif
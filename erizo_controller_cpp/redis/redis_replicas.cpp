@@ -0,0 +1,145 @@
+#include "redis_replicas.h"
+
+#include <sstream>
+#include <stdlib.h>
+
+#include <acl_cpp/lib_acl.hpp>
+
+#include "acl_redis.h"
+#include "redis_pipeline.h"
+#include "redis_cluster.h"
+#include "common/config.h"
+#include "common/utils.h"
+
+DEFINE_LOGGER(RedisReplicas, "RedisReplicas");
+
+static const uint64_t kCheckInterval = 1000; //ms
+
+RedisReplicas *RedisReplicas::instance_ = nullptr;
+RedisReplicas *RedisReplicas::getInstance()
+{
+    if (!instance_)
+        instance_ = new RedisReplicas;
+    return instance_;
+}
+
+RedisReplicas::RedisReplicas() : next_(0)
+{
+    //集群模式下从库需要READONLY并按slot选择,暂不支持
+    if (RedisCluster::enabled())
+        return;
+    Config *config = Config::getInstance();
+    for (const std::string &addr : config->redis_replicas)
+    {
+        replicas_.push_back({addr, false, 0});
+        std::shared_ptr<acl::redis_client_pool> pool = std::make_shared<acl::redis_client_pool>(addr.c_str(), config->redis_max_conns);
+        pool->set_password(config->redis_passwd.c_str());
+        pool->set_timeout(config->redis_conn_timeout, config->redis_rw_timeout);
+        pools_[addr] = pool;
+    }
+}
+
+int RedisReplicas::pipeline(const std::string &addr, const std::string &req, size_t count, std::vector<RedisReply> &replies)
+{
+    auto it = pools_.find(addr);
+    if (it == pools_.end())
+        return 1;
+    return ACLRedis::pipeline(it->second.get(), req, count, replies);
+}
+
+std::string RedisReplicas::pick()
+{
+    if (replicas_.empty())
+        return "";
+
+    //到期的先检查,check_time提前更新,避免多个线程同时检查同一个从库
+    uint64_t now = Utils::getCurrentMs();
+    std::vector<std::string> expired;
+    {
+        std::unique_lock<std::mutex> lock(mux_);
+        for (Replica &replica : replicas_)
+        {
+            if (now - replica.check_time >= kCheckInterval)
+            {
+                replica.check_time = now;
+                expired.push_back(replica.addr);
+            }
+        }
+    }
+    for (const std::string &addr : expired)
+    {
+        bool fresh = !check(addr);
+        std::unique_lock<std::mutex> lock(mux_);
+        for (Replica &replica : replicas_)
+        {
+            if (replica.addr == addr)
+                replica.fresh = fresh;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(mux_);
+    for (size_t i = 0; i < replicas_.size(); i++)
+    {
+        const Replica &replica = replicas_[(next_ + i) % replicas_.size()];
+        if (replica.fresh)
+        {
+            next_ = (next_ + i + 1) % replicas_.size();
+            return replica.addr;
+        }
+    }
+    return "";
+}
+
+void RedisReplicas::markStale(const std::string &addr)
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    for (Replica &replica : replicas_)
+    {
+        if (replica.addr == addr)
+            replica.fresh = false;
+    }
+}
+
+int RedisReplicas::check(const std::string &addr)
+{
+    RedisPipeline pipeline;
+    pipeline.command({"INFO", "replication"});
+    std::vector<RedisReply> replies;
+    if (this->pipeline(addr, pipeline.request(), pipeline.size(), replies) ||
+        replies[0].type != RedisReply::STRING)
+    {
+        ELOG_WARN("replica %s unreachable", addr);
+        return 1;
+    }
+
+    //role:slave master_link_status:up master_sync_in_progress:0 master_last_io_seconds_ago:<n>
+    std::istringstream iss(replies[0].str);
+    std::string line;
+    bool slave = false, link_up = false, syncing = true;
+    int last_io = -1;
+    while (std::getline(iss, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        size_t pos = line.find(':');
+        if (pos == std::string::npos)
+            continue;
+        std::string key = line.substr(0, pos);
+        std::string value = line.substr(pos + 1);
+        if (key == "role")
+            slave = (value == "slave");
+        else if (key == "master_link_status")
+            link_up = (value == "up");
+        else if (key == "master_sync_in_progress")
+            syncing = (value != "0");
+        else if (key == "master_last_io_seconds_ago")
+            last_io = atoi(value.c_str());
+    }
+
+    if (!slave || !link_up || syncing || last_io < 0 || last_io > Config::getInstance()->redis_replica_max_lag)
+    {
+        ELOG_WARN("replica %s stale, link:%d syncing:%d last_io:%d", addr, (int)link_up, (int)syncing, last_io);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+#ifndef REDIS_REPLICAS_H
+#define REDIS_REPLICAS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "redis_pipeline.h"
+
+#include "common/logger.h"
+
+//只读扫描使用的从库(Config::redis_replicas),写入和加锁的读取总是走主库
+//每秒用INFO replication检查一次: 与主库连接正常、没有在全量同步、最近一次通信不超过redis_replica_max_lag秒,
+//满足时才读取,读到的数据最多落后约redis_replica_max_lag秒;没有可用从库时调用方读主库
+//主库空闲时最近通信时间取决于repl-ping-replica-period,心跳每秒写入,正常不会误判
+namespace acl
+{
+class redis_client_pool;
+}
+
+class RedisReplicas
+{
+  DECLARE_LOGGER();
+
+  struct Replica
+  {
+    std::string addr;
+    bool fresh;
+    uint64_t check_time;
+  };
+
+public:
+  static RedisReplicas *getInstance();
+
+  //轮询选择可用的从库ip:port,没有时返回空
+  std::string pick();
+  //读取失败,下次检查之前不再使用
+  void markStale(const std::string &addr);
+  //在pick返回的从库上执行,使用从库自己的连接池
+  int pipeline(const std::string &addr, const std::string &req, size_t count, std::vector<RedisReply> &replies);
+
+private:
+  RedisReplicas();
+
+  int check(const std::string &addr);
+
+private:
+  std::mutex mux_;
+  std::vector<Replica> replicas_;
+  std::map<std::string, std::shared_ptr<acl::redis_client_pool>> pools_; //构造后不再修改,不需要加锁
+  size_t next_;
+  static RedisReplicas *instance_;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "redis_script.h"
+
+#include <stdio.h>
+
+#include <openssl/sha.h>
+
+#include "async_redis.h"
+#include "acl_redis.h"
+#include "redis_cluster.h"
+
+RedisScript::RedisScript(const std::string &source) : source_(source)
+{
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1((const unsigned char *)source_.data(), source_.size(), digest);
+
+    char hex[SHA_DIGEST_LENGTH * 2 + 1];
+    for (int i = 0; i < SHA_DIGEST_LENGTH; i++)
+        sprintf(hex + i * 2, "%02x", digest[i]);
+    sha1_ = hex;
+}
+
+int RedisScript::exec(const std::vector<std::string> &keys, const std::vector<std::string> &args, RedisReply &reply) const
+{
+    std::vector<std::string> argv = {"EVALSHA", sha1_, std::to_string(keys.size())};
+    argv.insert(argv.end(), keys.begin(), keys.end());
+    argv.insert(argv.end(), args.begin(), args.end());
+
+    RedisPipeline pipeline;
+    pipeline.command(argv);
+    std::vector<RedisReply> replies;
+    if (pipeline.exec(replies))
+        return 1;
+
+    if (replies[0].isError() && replies[0].str.compare(0, 8, "NOSCRIPT") == 0)
+    {
+        //redis重启或执行过SCRIPT FLUSH,EVAL会顺带把脚本缓存到服务端
+        argv[0] = "EVAL";
+        argv[1] = source_;
+        pipeline.clear();
+        pipeline.command(argv);
+        if (pipeline.exec(replies))
+            return 1;
+    }
+    reply = replies[0];
+    return 0;
+}
+
+void RedisScript::execAsync(const std::shared_ptr<AsyncRedis> &redis,
+                            const std::vector<std::string> &keys, const std::vector<std::string> &args,
+                            const std::function<void(int err, RedisReply &reply)> &cb) const
+{
+    auto argv = std::make_shared<std::vector<std::string>>();
+    *argv = {"EVALSHA", sha1_, std::to_string(keys.size())};
+    argv->insert(argv->end(), keys.begin(), keys.end());
+    argv->insert(argv->end(), args.begin(), args.end());
+
+    RedisPipeline pipeline;
+    pipeline.command(*argv);
+    //脚本对象都是静态的(RoomScripts),回调里可以直接使用this
+    const RedisScript *self = this;
+    redis->exec(pipeline, [redis, argv, self, cb](int err, std::vector<RedisReply> &replies) {
+        if (err)
+        {
+            RedisReply reply;
+            cb(1, reply);
+            return;
+        }
+        if (!replies[0].isError() || replies[0].str.compare(0, 8, "NOSCRIPT") != 0)
+        {
+            cb(0, replies[0]);
+            return;
+        }
+
+        (*argv)[0] = "EVAL";
+        (*argv)[1] = self->source_;
+        RedisPipeline retry;
+        retry.command(*argv);
+        redis->exec(retry, [cb](int err, std::vector<RedisReply> &replies) {
+            RedisReply reply;
+            if (!err)
+                reply = replies[0];
+            cb(err, reply);
+        });
+    });
+}
+
+int RedisScript::load() const
+{
+    RedisPipeline pipeline;
+    pipeline.command({"SCRIPT", "LOAD", source_});
+    std::vector<RedisReply> replies;
+    if (!RedisCluster::enabled())
+    {
+        if (pipeline.exec(replies) || replies[0].isError() || replies[0].str != sha1_)
+            return 1;
+        return 0;
+    }
+
+    //脚本缓存是每个节点独立的
+    for (const std::string &node : RedisCluster::getInstance()->nodes())
+    {
+        if (ACLRedis::getInstance()->pipeline(node, pipeline.request(), pipeline.size(), replies) ||
+            replies[0].isError() || replies[0].str != sha1_)
+            return 1;
+    }
+    return 0;
+}
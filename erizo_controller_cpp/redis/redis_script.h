@@ -0,0 +1,36 @@
+#ifndef REDIS_SCRIPT_H
+#define REDIS_SCRIPT_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "redis_pipeline.h"
+
+class AsyncRedis;
+
+//服务端Lua脚本,按SHA1用EVALSHA执行,服务端没有缓存(NOSCRIPT)时退回EVAL
+class RedisScript
+{
+public:
+  explicit RedisScript(const std::string &source);
+
+  const std::string &source() const { return source_; }
+  const std::string &sha1() const { return sha1_; }
+
+  //返回1表示网络/协议错误,脚本自身的错误放在reply里
+  int exec(const std::vector<std::string> &keys, const std::vector<std::string> &args, RedisReply &reply) const;
+  //非阻塞版本,回调在redis所属的io_service线程里执行
+  void execAsync(const std::shared_ptr<AsyncRedis> &redis,
+                 const std::vector<std::string> &keys, const std::vector<std::string> &args,
+                 const std::function<void(int err, RedisReply &reply)> &cb) const;
+  //SCRIPT LOAD
+  int load() const;
+
+private:
+  std::string source_;
+  std::string sha1_;
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include "resp_parser.h"
+
+#include <stdlib.h>
+
+RespParser::RespParser() : pos_(0), scan_(0)
+{
+}
+
+void RespParser::feed(const char *data, size_t len)
+{
+    buf_.append(data, len);
+}
+
+void RespParser::reset()
+{
+    buf_.clear();
+    pos_ = 0;
+    scan_ = 0;
+    pending_.clear();
+}
+
+int RespParser::next(RedisReply &reply)
+{
+    int res = scan();
+    if (res != 1)
+        return res;
+
+    //scan()已经确认从pos_开始有一个完整回复
+    size_t pos = pos_;
+    reply = RedisReply();
+    if (parse(pos, reply) != 1)
+        return -1;
+
+    pos_ = pos;
+    scan_ = pos;
+    if (pos_ == buf_.size())
+    {
+        buf_.clear();
+        pos_ = 0;
+        scan_ = 0;
+    }
+    else if (pos_ > 65536)
+    {
+        buf_.erase(0, pos_);
+        pos_ = 0;
+        scan_ = 0;
+    }
+    return 1;
+}
+
+//只检查回复是否完整,不构造RedisReply; 1: 完整; 0: 数据不够; -1: 协议错误
+int RespParser::scan()
+{
+    for (;;)
+    {
+        size_t eol = buf_.find("\r\n", scan_);
+        if (eol == std::string::npos)
+            return 0;
+
+        size_t next = eol + 2;
+        switch (buf_[scan_])
+        {
+        case '+':
+        case '-':
+        case ':':
+            break;
+        case '$':
+        {
+            long long len = strtoll(buf_.c_str() + scan_ + 1, nullptr, 10);
+            if (len >= 0)
+            {
+                if (buf_.size() < next + len + 2)
+                    return 0;
+                next += len + 2;
+            }
+            break;
+        }
+        case '*':
+        {
+            long long len = strtoll(buf_.c_str() + scan_ + 1, nullptr, 10);
+            if (len > 0)
+            {
+                scan_ = next;
+                pending_.push_back(len);
+                continue;
+            }
+            break;
+        }
+        default:
+            return -1;
+        }
+
+        //一个元素完整,逐层结束已经收齐的数组
+        scan_ = next;
+        while (!pending_.empty() && --pending_.back() == 0)
+            pending_.pop_back();
+        if (pending_.empty())
+            return 1;
+    }
+}
+
+int RespParser::parse(size_t &pos, RedisReply &reply)
+{
+    size_t eol = buf_.find("\r\n", pos);
+    if (eol == std::string::npos)
+        return 0;
+
+    char type = buf_[pos];
+    std::string line = buf_.substr(pos + 1, eol - pos - 1);
+    size_t next = eol + 2;
+    switch (type)
+    {
+    case '+':
+        reply.type = RedisReply::STATUS;
+        reply.str = line;
+        break;
+    case '-':
+        reply.type = RedisReply::ERROR;
+        reply.str = line;
+        break;
+    case ':':
+        reply.type = RedisReply::INTEGER;
+        reply.integer = strtoll(line.c_str(), nullptr, 10);
+        break;
+    case '$':
+    {
+        long long len = strtoll(line.c_str(), nullptr, 10);
+        if (len < 0)
+        {
+            reply.type = RedisReply::NIL;
+            break;
+        }
+        if (buf_.size() < next + len + 2)
+            return 0;
+        reply.type = RedisReply::STRING;
+        reply.str.assign(buf_, next, len);
+        next += len + 2;
+        break;
+    }
+    case '*':
+    {
+        long long len = strtoll(line.c_str(), nullptr, 10);
+        if (len < 0)
+        {
+            reply.type = RedisReply::NIL;
+            break;
+        }
+        reply.type = RedisReply::ARRAY;
+        reply.elements.resize(len);
+        for (long long i = 0; i < len; i++)
+        {
+            int res = parse(next, reply.elements[i]);
+            if (res != 1)
+                return res;
+        }
+        break;
+    }
+    default:
+        return -1;
+    }
+
+    pos = next;
+    return 1;
+}
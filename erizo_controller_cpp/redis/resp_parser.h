@@ -0,0 +1,33 @@
+#ifndef RESP_PARSER_H
+#define RESP_PARSER_H
+
+#include <string>
+#include <vector>
+
+#include "redis_pipeline.h"
+
+//增量解析redis回复(RESP),数据可以分多次喂入
+class RespParser
+{
+public:
+  RespParser();
+
+  void feed(const char *data, size_t len);
+  //1: 解析出一个完整回复; 0: 数据不够; -1: 协议错误
+  int next(RedisReply &reply);
+  void reset();
+
+private:
+  int scan();
+  int parse(size_t &pos, RedisReply &reply);
+
+private:
+  std::string buf_;
+  size_t pos_;
+  //数据不够时记下已经确认完整的位置和未完成数组还差的元素数,下次从这里继续扫描,
+  //回复完整后才从pos_解析一次,大回复分多次到达时不会反复解析
+  size_t scan_;
+  std::vector<long long> pending_;
+};
+
+#endif
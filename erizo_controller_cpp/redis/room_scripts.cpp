@@ -0,0 +1,405 @@
+#include "room_scripts.h"
+
+namespace
+{
+//所有脚本共用的编解码,记录解析失败时跳过,和RedisHelper中parse失败的处理一致
+//记录可能是JSON或model/binary_codec.h定义的二进制格式,写回时保持读入时的格式
+const char *kPrelude = R"lua(
+local MAGIC = 0xEC
+local VERSION = 1
+--字段顺序和model/*.h中toBinary一致
+local SCHEMA = {
+    [1] = {{'id', 's'}, {'agent_id', 's'}, {'erizo_id', 's'}, {'bridge_ip', 's'}, {'bridge_port', 'u16'},
+           {'room_id', 's'}, {'ip', 's'}, {'port', 'u16'}, {'family', 's'}, {'reply_to', 's'}},
+    [2] = {{'id', 's'}, {'client_id', 's'}, {'erizo_id', 's'}, {'bridge_ip', 's'}, {'bridge_port', 'u16'},
+           {'agent_id', 's'}, {'label', 's'}, {'video_ssrc', 'u32'}, {'audio_ssrc', 'u32'}},
+    [3] = {{'id', 's'}, {'client_id', 's'}, {'erizo_id', 's'}, {'agent_id', 's'}, {'subscribe_to', 's'},
+           {'reply_to', 's'}, {'is_bridge', 'b'}},
+    [4] = {{'id', 's'}, {'sender_erizo_id', 's'}, {'sender_ip', 's'}, {'sender_port', 'u16'},
+           {'recver_erizo_id', 's'}, {'recver_ip', 's'}, {'recver_port', 'u16'}, {'src_stream_id', 's'},
+           {'label', 's'}, {'subscribe_count', 'i32'}}
+}
+local WIDTH = {b = 1, u16 = 2, u32 = 4, i32 = 4}
+
+--二进制解码出的table -> kind
+local binary_kind = {}
+
+local function decodeBinary(s)
+    local _, version, kind = string.byte(s, 1, 3)
+    if version ~= VERSION or not SCHEMA[kind] then
+        return nil
+    end
+    local t = {}
+    local pos = 4
+    for _, f in ipairs(SCHEMA[kind]) do
+        local name, ftype = f[1], f[2]
+        if ftype == 's' then
+            if pos + 1 > #s then
+                return nil
+            end
+            local hi, lo = string.byte(s, pos, pos + 1)
+            local len = hi * 256 + lo
+            if pos + 1 + len > #s then
+                return nil
+            end
+            t[name] = string.sub(s, pos + 2, pos + 1 + len)
+            pos = pos + 2 + len
+        else
+            local n = WIDTH[ftype]
+            if pos + n - 1 > #s then
+                return nil
+            end
+            local v = 0
+            for i = 0, n - 1 do
+                v = v * 256 + string.byte(s, pos + i)
+            end
+            if ftype == 'i32' and v >= 2147483648 then
+                v = v - 4294967296
+            elseif ftype == 'b' then
+                v = (v ~= 0)
+            end
+            t[name] = v
+            pos = pos + n
+        end
+    end
+    if pos ~= #s + 1 then
+        return nil
+    end
+    binary_kind[t] = kind
+    return t
+end
+
+local function encodeBinary(t, kind)
+    local out = {string.char(MAGIC, VERSION, kind)}
+    for _, f in ipairs(SCHEMA[kind]) do
+        local name, ftype = f[1], f[2]
+        local v = t[name]
+        if ftype == 's' then
+            v = string.sub(tostring(v or ''), 1, 65535)
+            table.insert(out, string.char(math.floor(#v / 256), #v % 256))
+            table.insert(out, v)
+        elseif ftype == 'b' then
+            table.insert(out, string.char(v and 1 or 0))
+        else
+            v = tonumber(v) or 0
+            if v < 0 then
+                v = v + 4294967296
+            end
+            local bytes = {}
+            for i = WIDTH[ftype], 1, -1 do
+                bytes[i] = v % 256
+                v = math.floor(v / 256)
+            end
+            table.insert(out, string.char(unpack(bytes)))
+        end
+    end
+    return table.concat(out)
+end
+
+local function decode(s)
+    if type(s) ~= 'string' or #s == 0 then
+        return nil
+    end
+    if string.byte(s, 1) == MAGIC then
+        return decodeBinary(s)
+    end
+    local ok, t = pcall(cjson.decode, s)
+    if ok and type(t) == 'table' then
+        return t
+    end
+    return nil
+end
+
+local function encode(t)
+    local kind = binary_kind[t]
+    if kind then
+        return encodeBinary(t, kind)
+    end
+    return cjson.encode(t)
+end
+
+--二级索引的key: 前缀由KEYS传入,后面拼上id
+local function index(prefix, id)
+    return prefix .. ':' .. id
+end
+
+--split模式下ssrc和subscribe_count单独存放,可以原子地单字段更新
+--读取时总是用单独存放的值覆盖记录里的值
+--inline模式写回记录时删除单独存放的字段,否则split模式留下的旧值会覆盖新写入的记录
+local function overlaySsrc(key, p)
+    local v = redis.call('HMGET', key, p.id .. ':video', p.id .. ':audio')
+    if v[1] then
+        p.video_ssrc = tonumber(v[1])
+    end
+    if v[2] then
+        p.audio_ssrc = tonumber(v[2])
+    end
+end
+
+local function overlayCount(key, b)
+    local v = redis.call('HGET', key, b.id)
+    if v then
+        b.subscribe_count = tonumber(v)
+    end
+end
+
+--inline模式写入的记录还没有单独的计数,先用记录里的值补上
+local function incrCount(key, b, delta)
+    redis.call('HSETNX', key, b.id, b.subscribe_count)
+    return redis.call('HINCRBY', key, b.id, delta)
+end
+)lua";
+
+const char *kPublisherSetSsrc = R"lua(
+if ARGV[4] == 'split' then
+    if redis.call('HEXISTS', KEYS[1], ARGV[1]) == 0 then
+        return 0
+    end
+    redis.call('HSET', KEYS[2], ARGV[1] .. ':video', ARGV[2], ARGV[1] .. ':audio', ARGV[3])
+    return 1
+end
+
+local v = redis.call('HGET', KEYS[1], ARGV[1])
+if not v then
+    return 0
+end
+local p = decode(v)
+if not p then
+    return 0
+end
+p.video_ssrc = tonumber(ARGV[2])
+p.audio_ssrc = tonumber(ARGV[3])
+redis.call('HSET', KEYS[1], ARGV[1], encode(p))
+redis.call('HDEL', KEYS[2], ARGV[1] .. ':video', ARGV[1] .. ':audio')
+return 1
+)lua";
+
+const char *kSubscribe = R"lua(
+local pub_json = redis.call('HGET', KEYS[1], ARGV[1])
+if not pub_json then
+    return {0}
+end
+local pub = decode(pub_json)
+if not pub then
+    return {0}
+end
+local split = (ARGV[4] == 'split')
+overlaySsrc(KEYS[7], pub)
+pub_json = encode(pub)
+if pub.video_ssrc == 0 or pub.audio_ssrc == 0 then
+    return {1}
+end
+
+local sub = decode(ARGV[2])
+sub.is_bridge = (sub.agent_id ~= pub.agent_id)
+local sub_json = encode(sub)
+redis.call('HSET', KEYS[2], sub.id, sub_json)
+redis.call('SADD', index(KEYS[5], ARGV[1]), sub.id)
+redis.call('SADD', index(KEYS[6], sub.client_id), sub.id)
+if not sub.is_bridge then
+    return {2, pub_json, sub_json}
+end
+
+local bridge_index = index(KEYS[4], ARGV[1])
+local bridge_id = redis.call('HGET', bridge_index, sub.erizo_id)
+if bridge_id then
+    local b = decode(redis.call('HGET', KEYS[3], bridge_id) or '')
+    if b then
+        if split then
+            b.subscribe_count = incrCount(KEYS[8], b, 1)
+            return {2, pub_json, sub_json, encode(b), 0}
+        end
+        overlayCount(KEYS[8], b)
+        b.subscribe_count = b.subscribe_count + 1
+        local json = encode(b)
+        redis.call('HSET', KEYS[3], b.id, json)
+        redis.call('HDEL', KEYS[8], b.id)
+        return {2, pub_json, sub_json, json, 0}
+    end
+    --索引指向的记录已不存在,重新创建
+end
+
+local b = decode(ARGV[3])
+b.sender_erizo_id = pub.erizo_id
+b.sender_ip = pub.bridge_ip
+b.sender_port = pub.bridge_port
+b.subscribe_count = 1
+local json = encode(b)
+redis.call('HSET', KEYS[3], b.id, json)
+redis.call('HSET', bridge_index, sub.erizo_id, b.id)
+if split then
+    redis.call('HSET', KEYS[8], b.id, 1)
+end
+return {2, pub_json, sub_json, json, 1}
+)lua";
+
+const char *kRemoveClient = R"lua(
+local client_id = ARGV[1]
+local split = (ARGV[2] == 'split')
+
+--本次涉及的bridge-stream,最后统一写回
+local bridges = {}
+local bridge_order = {}
+local function loadBridge(stream_id, erizo_id)
+    local bridge_index = index(KEYS[6], stream_id)
+    local id = redis.call('HGET', bridge_index, erizo_id)
+    if not id then
+        return nil
+    end
+    if bridges[id] then
+        return bridges[id]
+    end
+    local d = decode(redis.call('HGET', KEYS[3], id) or '')
+    if not d then
+        redis.call('HDEL', bridge_index, erizo_id)
+        return nil
+    end
+    overlayCount(KEYS[11], d)
+    local b = {data = d, index = bridge_index, field = erizo_id, dirty = false, removed = false}
+    bridges[id] = b
+    table.insert(bridge_order, b)
+    return b
+end
+
+local removed_subs = {}
+local function removeSubscriber(sub_id)
+    local v = redis.call('HGET', KEYS[1], sub_id)
+    if not v then
+        return
+    end
+    redis.call('HDEL', KEYS[1], sub_id)
+    local s = decode(v)
+    if not s then
+        return
+    end
+    table.insert(removed_subs, v)
+    redis.call('SREM', index(KEYS[7], s.subscribe_to), s.id)
+    redis.call('SREM', index(KEYS[8], s.client_id), s.id)
+    if s.is_bridge then
+        local b = loadBridge(s.subscribe_to, s.erizo_id)
+        if b and not b.removed then
+            if split then
+                b.data.subscribe_count = incrCount(KEYS[11], b.data, -1)
+            else
+                b.data.subscribe_count = b.data.subscribe_count - 1
+                b.dirty = true
+            end
+            if b.data.subscribe_count <= 0 then
+                b.removed = true
+            end
+        end
+    end
+end
+
+--升级前或未升级的erizo_controller写入的记录没有二级索引,从房间的全部记录补建
+local function rebuildIndex()
+    for _, v in ipairs(redis.call('HVALS', KEYS[2])) do
+        local p = decode(v)
+        if p and p.id and p.client_id then
+            redis.call('SADD', index(KEYS[9], p.client_id), p.id)
+        end
+    end
+    for _, v in ipairs(redis.call('HVALS', KEYS[1])) do
+        local s = decode(v)
+        if s and s.id and s.subscribe_to and s.client_id then
+            redis.call('SADD', index(KEYS[7], s.subscribe_to), s.id)
+            redis.call('SADD', index(KEYS[8], s.client_id), s.id)
+        end
+    end
+    for _, v in ipairs(redis.call('HVALS', KEYS[3])) do
+        local b = decode(v)
+        if b and b.id and b.src_stream_id and b.recver_erizo_id then
+            redis.call('HSETNX', index(KEYS[6], b.src_stream_id), b.recver_erizo_id, b.id)
+        end
+    end
+end
+
+--addClient写入的客户端带有索引标记,只有没有标记的(未升级的erizo_controller写入的)客户端才补建
+if redis.call('SISMEMBER', KEYS[12], client_id) == 0 and redis.call('HEXISTS', KEYS[4], client_id) == 1 then
+    rebuildIndex()
+end
+
+--此客户端订阅的流
+for _, id in ipairs(redis.call('SMEMBERS', index(KEYS[8], client_id))) do
+    removeSubscriber(id)
+end
+
+--此客户端推送的流,以及其他客户端对这些流的订阅
+local removed_pubs = {}
+local pubs_index = index(KEYS[9], client_id)
+for _, id in ipairs(redis.call('SMEMBERS', pubs_index)) do
+    local v = redis.call('HGET', KEYS[2], id)
+    if v then
+        redis.call('HDEL', KEYS[2], id)
+        if decode(v) then
+            table.insert(removed_pubs, v)
+        end
+    end
+    redis.call('HDEL', KEYS[10], id .. ':video', id .. ':audio')
+    local subs_index = index(KEYS[7], id)
+    for _, sub_id in ipairs(redis.call('SMEMBERS', subs_index)) do
+        removeSubscriber(sub_id)
+    end
+    redis.call('DEL', subs_index)
+    local bridge_index = index(KEYS[6], id)
+    for _, erizo_id in ipairs(redis.call('HKEYS', bridge_index)) do
+        local b = loadBridge(id, erizo_id)
+        if b then
+            b.removed = true
+        end
+    end
+end
+redis.call('DEL', pubs_index)
+redis.call('DEL', index(KEYS[8], client_id))
+
+local removed_bridges = {}
+for _, b in ipairs(bridge_order) do
+    local json = encode(b.data)
+    if b.removed then
+        redis.call('HDEL', KEYS[3], b.data.id)
+        redis.call('HDEL', KEYS[11], b.data.id)
+        redis.call('HDEL', b.index, b.field)
+        table.insert(removed_bridges, json)
+    elseif b.dirty then
+        redis.call('HSET', KEYS[3], b.data.id, json)
+        redis.call('HDEL', KEYS[11], b.data.id)
+    end
+end
+
+redis.call('HDEL', KEYS[4], client_id)
+redis.call('HDEL', KEYS[5], client_id)
+redis.call('SREM', KEYS[12], client_id)
+--房间已空,标记随房间一起删除,不残留
+if redis.call('HLEN', KEYS[4]) == 0 then
+    redis.call('DEL', KEYS[12])
+end
+return {removed_subs, removed_pubs, removed_bridges}
+)lua";
+} // namespace
+
+const RedisScript &RoomScripts::publisherSetSsrc()
+{
+    static const RedisScript script(std::string(kPrelude) + kPublisherSetSsrc);
+    return script;
+}
+
+const RedisScript &RoomScripts::subscribe()
+{
+    static const RedisScript script(std::string(kPrelude) + kSubscribe);
+    return script;
+}
+
+const RedisScript &RoomScripts::removeClient()
+{
+    static const RedisScript script(std::string(kPrelude) + kRemoveClient);
+    return script;
+}
+
+int RoomScripts::loadAll()
+{
+    if (publisherSetSsrc().load() ||
+        subscribe().load() ||
+        removeClient().load())
+        return 1;
+    return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef ROOM_SCRIPTS_H
+#define ROOM_SCRIPTS_H
+
+#include "redis_script.h"
+
+//房间内需要原子完成的多key修改,代替RedisLocker锁房间
+//集群模式下房间的key都带{room_id}哈希标签(RedisCluster::roomKey),索引key由前缀拼接,同样落在房间的slot
+//二级索引(前缀:id),由脚本和RedisHelper::addPublisher维护,避免整房间HVALS:
+//  bridge_stream_index_<room>:<stream_id>      hash recver_erizo_id -> bridge_stream_id
+//  subscriber_by_publisher_<room>:<stream_id>  set subscriber_id
+//  subscriber_by_client_<room>:<client_id>     set subscriber_id
+//  publisher_by_client_<room>:<client_id>      set publisher_id
+//  indexed_client_<room>                       set client_id, addClient写入,其记录带有索引;removeClient只为不在其中的客户端补建索引
+//热字段(Config::redis_hot_fields为split时写入,读取时总是覆盖记录中的值,inline模式写记录时删除):
+//  publisher_ssrc_<room>        hash <publisher_id>:video/<publisher_id>:audio -> ssrc
+//  bridge_stream_count_<room>   hash bridge_stream_id -> subscribe_count
+class RoomScripts
+{
+public:
+  //KEYS: publisher, publisher_ssrc
+  //ARGV: publisher_id, video_ssrc, audio_ssrc, inline/split
+  //返回: 1 已更新, 0 publisher不存在
+  static const RedisScript &publisherSetSsrc();
+
+  //KEYS: publisher, subscriber, bridge_stream,
+  //      bridge_stream_index前缀, subscriber_by_publisher前缀, subscriber_by_client前缀,
+  //      publisher_ssrc, bridge_stream_count
+  //ARGV: stream_id, subscriber(is_bridge由脚本按agent_id计算), bridge_stream模板(sender_*和subscribe_count由脚本填),
+  //      inline/split
+  //返回: {0} publisher不存在; {1} publisher还没有ssrc;
+  //      {2, publisher, subscriber[, bridge_stream, 新建为1]}
+  static const RedisScript &subscribe();
+
+  //KEYS: subscriber, publisher, bridge_stream, client, erizo_controller(集群模式下不在同一个slot,传入client),
+  //      bridge_stream_index前缀, subscriber_by_publisher前缀, subscriber_by_client前缀, publisher_by_client前缀,
+  //      publisher_ssrc, bridge_stream_count, indexed_client
+  //ARGV: client_id, inline/split
+  //返回: {删除的subscriber, 删除的publisher, 删除的bridge_stream}
+  static const RedisScript &removeClient();
+
+  static int loadAll();
+};
+
+#endif
@@ -1,14 +1,542 @@
 #include "IP_TABLE.h"
 #include <stdio.h>
+#include <string.h>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 namespace edu {
 namespace iptable {
-IP_TABLE::IP_TABLE() {
+
+static const char     kBlobMagic[8]  = { 'I', 'P', 'T', 'A', 'B', 'L', 'E', 0 };
+static const uint32_t kBlobVersion   = 2;
+static const uint32_t kBlobByteOrder = 0x01020304;
+
+static inline size_t blobAlign( size_t n )
+{
+	return ( n + 7 ) & ~(size_t)7;
+}
+
+static uint32_t blobChecksum( const void* data, size_t len )
+{
+	// payload 的各段都是 8 字节对齐的, 长度一定是 4 的倍数
+	const uint32_t* p    = (const uint32_t*)data;
+	uint32_t        hash = 2166136261u;
+	for( size_t i = 0; i < len / 4; i++ )
+	{
+		hash = ( hash ^ p[i] ) * 16777619u;
+	}
+	return hash;
+}
+
+// 各段在 payload 中的偏移
+struct IP_TABLE_BLOB_LAYOUT
+{
+	size_t from;
+	size_t to;
+	size_t value;
+	size_t valueTable;
+	size_t eytzinger;
+	size_t eytzingerIdx;
+	size_t from6;
+	size_t to6;
+	size_t value6;
+	size_t size;
+
+	IP_TABLE_BLOB_LAYOUT( size_t count, size_t valueCount, size_t count6 )
+	{
+		from         = 0;
+		to           = from + blobAlign( count * sizeof( uint32_t ) );
+		value        = to + blobAlign( count * sizeof( uint32_t ) );
+		valueTable   = value + blobAlign( count * sizeof( uint16_t ) );
+		eytzinger    = valueTable + blobAlign( valueCount * 2 * sizeof( uint32_t ) );
+		eytzingerIdx = eytzinger + blobAlign( ( count + 1 ) * sizeof( uint32_t ) );
+		from6        = eytzingerIdx + blobAlign( ( count + 1 ) * sizeof( uint32_t ) );
+		to6          = from6 + count6 * sizeof( IPV6_ADDR );
+		value6       = to6 + count6 * sizeof( IPV6_ADDR );
+		size         = value6 + blobAlign( count6 * sizeof( uint16_t ) );
+	}
+};
+
+IP_TABLE::IP_TABLE()
+	: m_indexFrom( NULL )
+	, m_indexTo( NULL )
+	, m_indexValue( NULL )
+	, m_eytzinger( NULL )
+	, m_eytzingerIdx( NULL )
+	, m_indexSize( 0 )
+	, m_eytzingerDepth( 0 )
+	, m_index6From( NULL )
+	, m_index6To( NULL )
+	, m_index6Value( NULL )
+	, m_index6Size( 0 )
+	, m_mapped( NULL )
+	, m_mappedSize( 0 ) {
 }
 
 IP_TABLE::~IP_TABLE() {
 
 	this->clear();
 }
+
+typedef std::map< std::pair<int, int>, uint16_t > IP_TABLE_PALETTE;
+
+// 返回 value 在 valueTable 中的下标, 下标放不下时返回 false
+static bool paletteIndex( IP_TABLE_PALETTE& palette, std::vector<IP_TABLE_VALUE>& valueTable, const IP_TABLE_VALUE& value, uint16_t& index )
+{
+	std::pair<int, int> v( (int)value.isp, (int)value.area );
+	IP_TABLE_PALETTE::iterator it = palette.find( v );
+	if( it == palette.end() )
+	{
+		if( valueTable.size() > 0xffff )
+		{
+			return false;
+		}
+		it = palette.insert( std::make_pair( v, (uint16_t)valueTable.size() ) ).first;
+		valueTable.push_back( value );
+	}
+	index = it->second;
+	return true;
+}
+
+bool IP_TABLE::insert6( const IPV6_ADDR& from, const IPV6_ADDR& to, ISPType isp, AreaType area ) {
+	if( to < from )
+	{
+		return false;
+	}
+
+	// 后一个区间的 from 不能落在 [from, to] 内, 前一个区间的 to 不能 >= from
+	IP_TABLE6_MAP::iterator next = m_table6.upper_bound( from );
+	if( next != m_table6.end() && next->first <= to )
+	{
+		return false;
+	}
+	if( next != m_table6.begin() )
+	{
+		IP_TABLE6_MAP::iterator prev = next;
+		--prev;
+		if( from <= prev->second.first )
+		{
+			return false;
+		}
+	}
+
+	m_table6.insert( next, IP_TABLE6_MAP::value_type( from, std::make_pair( to, IP_TABLE_VALUE( isp, area ) ) ) );
+	clearIndex();
+	return true;
+}
+
+IP_TABLE_VALUE IP_TABLE::getValue6( const IPV6_ADDR& ip ) const {
+	if( m_index6Size > 0 )
+	{
+		// 找到最后一个 from <= ip 的条目
+		const IPV6_ADDR* first = m_index6From;
+		const IPV6_ADDR* base  = first;
+		size_t           n     = m_index6Size;
+		while( n > 1 )
+		{
+			size_t half = n / 2;
+			base = ( base[half] <= ip ) ? base + half : base;
+			n -= half;
+		}
+
+		size_t i = base - first;
+		if( ( *base <= ip ) && ( ip <= m_index6To[i] ) )
+		{
+			return m_valueTable[ m_index6Value[i] ];
+		}
+		return IP_TABLE_VALUE();
+	}
+
+	IP_TABLE6_MAP::const_iterator it = m_table6.upper_bound( ip );
+	if( it != m_table6.begin() )
+	{
+		--it;
+		if( ip <= it->second.first )
+		{
+			return it->second.second;
+		}
+	}
+	return IP_TABLE_VALUE();
+}
+
+void IP_TABLE::buildIndex() {
+	clearIndex();
+
+	IP_TABLE_PALETTE palette;
+	m_fromBuf.reserve( m_table.size() );
+	m_toBuf.reserve( m_table.size() );
+	m_valueBuf.reserve( m_table.size() );
+
+	// m_table 中的区间互不重叠, 按 from 有序
+	for( IP_TABLE_MAP_CONST_IT it = m_table.begin(); it != m_table.end(); ++it )
+	{
+		uint16_t index = 0;
+		if( !paletteIndex( palette, m_valueTable, it->second, index ) )
+		{
+			// 下标放不下, 退回 std::map 查找
+			clearIndex();
+			return;
+		}
+
+		m_fromBuf.push_back( (uint32_t)it->first.from );
+		m_toBuf.push_back( (uint32_t)it->first.to );
+		m_valueBuf.push_back( index );
+	}
+
+	// IPv6 与 IPv4 共用 m_valueTable
+	m_from6Buf.reserve( m_table6.size() );
+	m_to6Buf.reserve( m_table6.size() );
+	m_value6Buf.reserve( m_table6.size() );
+	for( IP_TABLE6_MAP::const_iterator it = m_table6.begin(); it != m_table6.end(); ++it )
+	{
+		uint16_t index = 0;
+		if( !paletteIndex( palette, m_valueTable, it->second.second, index ) )
+		{
+			clearIndex();
+			return;
+		}
+
+		m_from6Buf.push_back( it->first );
+		m_to6Buf.push_back( it->second.first );
+		m_value6Buf.push_back( index );
+	}
+
+	if( m_fromBuf.empty() && m_from6Buf.empty() )
+	{
+		return;
+	}
+
+	m_eytzingerBuf.resize( m_fromBuf.size() + 1 );
+	m_eytzingerIdxBuf.resize( m_fromBuf.size() + 1 );
+	buildEytzinger( 0, 1 );
+
+	// 树高, 保证 depth 轮之后所有查询都走到叶子之外
+	m_eytzingerDepth = 0;
+	while( ( (size_t)1 << m_eytzingerDepth ) <= m_fromBuf.size() )
+	{
+		m_eytzingerDepth++;
+	}
+
+	setIndexStorage();
+}
+
+size_t IP_TABLE::buildEytzinger( size_t i, size_t k ) {
+	// 中序遍历隐式完全二叉树, 依次填入有序数组
+	if( k < m_eytzingerBuf.size() )
+	{
+		i = buildEytzinger( i, 2 * k );
+		m_eytzingerBuf[k]    = m_fromBuf[i];
+		m_eytzingerIdxBuf[k] = (uint32_t)i;
+		i = buildEytzinger( i + 1, 2 * k + 1 );
+	}
+	return i;
+}
+
+void IP_TABLE::buildDirectory() {
+	m_dir.assign( 0x10000 + 1, 0 );
+	size_t i = 0;
+	for( uint32_t h = 0; h <= 0x10000; h++ )
+	{
+		while( i < m_indexSize && ( m_indexFrom[i] >> 16 ) < h )
+		{
+			i++;
+		}
+		m_dir[h] = (uint32_t)i;
+	}
+}
+
+void IP_TABLE::setIndexStorage() {
+	// 只有 IPv6 条目时 IPv4 的数组为空, 不能取 &v[0]
+	m_indexFrom    = m_fromBuf.empty() ? NULL : &m_fromBuf[0];
+	m_indexTo      = m_toBuf.empty() ? NULL : &m_toBuf[0];
+	m_indexValue   = m_valueBuf.empty() ? NULL : &m_valueBuf[0];
+	m_eytzinger    = &m_eytzingerBuf[0];
+	m_eytzingerIdx = &m_eytzingerIdxBuf[0];
+	m_indexSize    = m_fromBuf.size();
+
+	m_index6From   = m_from6Buf.empty() ? NULL : &m_from6Buf[0];
+	m_index6To     = m_to6Buf.empty() ? NULL : &m_to6Buf[0];
+	m_index6Value  = m_value6Buf.empty() ? NULL : &m_value6Buf[0];
+	m_index6Size   = m_from6Buf.size();
+	buildDirectory();
+}
+
+void IP_TABLE::clearIndex() {
+	m_indexFrom      = NULL;
+	m_indexTo        = NULL;
+	m_indexValue     = NULL;
+	m_eytzinger      = NULL;
+	m_eytzingerIdx   = NULL;
+	m_indexSize      = 0;
+	m_eytzingerDepth = 0;
+	m_valueTable.clear();
+
+	m_fromBuf.clear();
+	m_toBuf.clear();
+	m_valueBuf.clear();
+	m_eytzingerBuf.clear();
+	m_eytzingerIdxBuf.clear();
+	m_dir.clear();
+
+	m_index6From     = NULL;
+	m_index6To       = NULL;
+	m_index6Value    = NULL;
+	m_index6Size     = 0;
+	m_from6Buf.clear();
+	m_to6Buf.clear();
+	m_value6Buf.clear();
+
+	if( m_mapped != NULL )
+	{
+		munmap( m_mapped, m_mappedSize );
+		m_mapped     = NULL;
+		m_mappedSize = 0;
+	}
+}
+
+bool IP_TABLE::saveIndex( const char* filename ) const {
+	if( !isIndexed() )
+	{
+		return false;
+	}
+
+	IP_TABLE_BLOB_LAYOUT layout( m_indexSize, m_valueTable.size(), m_index6Size );
+	std::vector<char>    payload( layout.size, 0 );
+
+	if( m_indexSize > 0 )
+	{
+		memcpy( &payload[layout.from], m_indexFrom, m_indexSize * sizeof( uint32_t ) );
+		memcpy( &payload[layout.to], m_indexTo, m_indexSize * sizeof( uint32_t ) );
+		memcpy( &payload[layout.value], m_indexValue, m_indexSize * sizeof( uint16_t ) );
+	}
+	uint32_t* valueTable = (uint32_t*)&payload[layout.valueTable];
+	for( size_t i = 0; i < m_valueTable.size(); i++ )
+	{
+		valueTable[2 * i]     = (uint32_t)m_valueTable[i].isp;
+		valueTable[2 * i + 1] = (uint32_t)m_valueTable[i].area;
+	}
+	memcpy( &payload[layout.eytzinger], m_eytzinger, ( m_indexSize + 1 ) * sizeof( uint32_t ) );
+	memcpy( &payload[layout.eytzingerIdx], m_eytzingerIdx, ( m_indexSize + 1 ) * sizeof( uint32_t ) );
+	if( m_index6Size > 0 )
+	{
+		memcpy( &payload[layout.from6], m_index6From, m_index6Size * sizeof( IPV6_ADDR ) );
+		memcpy( &payload[layout.to6], m_index6To, m_index6Size * sizeof( IPV6_ADDR ) );
+		memcpy( &payload[layout.value6], m_index6Value, m_index6Size * sizeof( uint16_t ) );
+	}
+
+	IP_TABLE_BLOB_HEADER header;
+	memset( &header, 0, sizeof( header ) );
+	memcpy( header.magic, kBlobMagic, sizeof( header.magic ) );
+	header.version      = kBlobVersion;
+	header.byte_order   = kBlobByteOrder;
+	header.header_size  = sizeof( header );
+	header.count        = (uint32_t)m_indexSize;
+	header.value_count  = (uint32_t)m_valueTable.size();
+	header.depth        = m_eytzingerDepth;
+	header.count6       = (uint32_t)m_index6Size;
+	header.payload_size = payload.size();
+	header.checksum     = blobChecksum( &payload[0], payload.size() );
+
+	// 先写临时文件再 rename, 运行中的进程 reload 时不会读到写了一半的文件
+	std::string tmp = std::string( filename ) + ".tmp";
+	FILE* fp = fopen( tmp.c_str(), "wb" );
+	if( fp == NULL )
+	{
+		return false;
+	}
+	bool ok = ( fwrite( &header, sizeof( header ), 1, fp ) == 1 )
+		&& ( fwrite( &payload[0], payload.size(), 1, fp ) == 1 );
+	ok = ( fclose( fp ) == 0 ) && ok;
+	if( !ok || rename( tmp.c_str(), filename ) != 0 )
+	{
+		unlink( tmp.c_str() );
+		return false;
+	}
+	return true;
+}
+
+bool IP_TABLE::loadIndex( const char* filename ) {
+	clear();
+
+	int fd = open( filename, O_RDONLY );
+	if( fd < 0 )
+	{
+		return false;
+	}
+
+	struct stat st;
+	if( fstat( fd, &st ) != 0 || (size_t)st.st_size < sizeof( IP_TABLE_BLOB_HEADER ) )
+	{
+		close( fd );
+		return false;
+	}
+
+	void* mapped = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if( mapped == MAP_FAILED )
+	{
+		return false;
+	}
+
+	// version 1 没有 IPv6 段, count6 的位置是保留字段
+	const IP_TABLE_BLOB_HEADER* header = (const IP_TABLE_BLOB_HEADER*)mapped;
+	const char*                 payload = (const char*)mapped + sizeof( IP_TABLE_BLOB_HEADER );
+	uint32_t                    count6  = ( header->version >= 2 ) ? header->count6 : 0;
+	IP_TABLE_BLOB_LAYOUT        layout( header->count, header->value_count, count6 );
+	if( memcmp( header->magic, kBlobMagic, sizeof( kBlobMagic ) ) != 0
+		|| header->version < 1
+		|| header->version > kBlobVersion
+		|| header->byte_order != kBlobByteOrder
+		|| header->header_size != sizeof( IP_TABLE_BLOB_HEADER )
+		|| ( header->count == 0 && count6 == 0 )
+		|| header->value_count > 0x10000
+		|| header->payload_size != layout.size
+		|| header->payload_size != (uint64_t)st.st_size - sizeof( IP_TABLE_BLOB_HEADER )
+		|| header->checksum != blobChecksum( payload, layout.size ) )
+	{
+		munmap( mapped, st.st_size );
+		return false;
+	}
+
+	const uint32_t* valueTable = (const uint32_t*)( payload + layout.valueTable );
+	for( uint32_t i = 0; i < header->value_count; i++ )
+	{
+		m_valueTable.push_back( IP_TABLE_VALUE( (ISPType)valueTable[2 * i], (AreaType)valueTable[2 * i + 1] ) );
+	}
+
+	m_mapped         = mapped;
+	m_mappedSize     = st.st_size;
+	m_indexFrom      = (const uint32_t*)( payload + layout.from );
+	m_indexTo        = (const uint32_t*)( payload + layout.to );
+	m_indexValue     = (const uint16_t*)( payload + layout.value );
+	m_eytzinger      = (const uint32_t*)( payload + layout.eytzinger );
+	m_eytzingerIdx   = (const uint32_t*)( payload + layout.eytzingerIdx );
+	m_indexSize      = header->count;
+	m_eytzingerDepth = header->depth;
+	if( m_indexSize == 0 )
+	{
+		m_indexFrom  = NULL;
+		m_indexTo    = NULL;
+		m_indexValue = NULL;
+	}
+	if( count6 > 0 )
+	{
+		m_index6From  = (const IPV6_ADDR*)( payload + layout.from6 );
+		m_index6To    = (const IPV6_ADDR*)( payload + layout.to6 );
+		m_index6Value = (const uint16_t*)( payload + layout.value6 );
+		m_index6Size  = count6;
+	}
+	buildDirectory();
+	return true;
+}
+
+bool IP_TABLE::isIndexFile( const char* filename ) {
+	char  magic[sizeof( kBlobMagic )];
+	FILE* fp = fopen( filename, "rb" );
+	if( fp == NULL )
+	{
+		return false;
+	}
+	bool ok = ( fread( magic, sizeof( magic ), 1, fp ) == 1 ) && ( memcmp( magic, kBlobMagic, sizeof( magic ) ) == 0 );
+	fclose( fp );
+	return ok;
+}
+
+void IP_TABLE::getValues( const uint32_t* ips, size_t count, IP_TABLE_VALUE* values ) const {
+	if( m_indexSize == 0 )
+	{
+		for( size_t i = 0; i < count; i++ )
+		{
+			values[i] = getValue( ips[i] );
+		}
+		return;
+	}
+
+#if defined(__AVX2__)
+	size_t simd = count & ~(size_t)7;
+	getValuesAVX2( ips, simd, values );
+	getValuesScalar( ips + simd, count - simd, values + simd );
+#else
+	getValuesScalar( ips, count, values );
+#endif
+}
+
+void IP_TABLE::getValuesScalar( const uint32_t* ips, size_t count, IP_TABLE_VALUE* values ) const {
+	const size_t    kLanes = 8;
+	const uint32_t* t      = m_eytzinger;
+	const uint32_t  n      = (uint32_t)m_indexSize;
+
+	// 多个查询交错下降, 让各自的 cache miss 重叠
+	for( size_t base = 0; base < count; base += kLanes )
+	{
+		size_t   lanes = ( count - base < kLanes ) ? count - base : kLanes;
+		uint32_t k[kLanes];
+		for( size_t l = 0; l < lanes; l++ )
+		{
+			k[l] = 1;
+		}
+
+		for( uint32_t d = 0; d < m_eytzingerDepth; d++ )
+		{
+			for( size_t l = 0; l < lanes; l++ )
+			{
+				if( k[l] <= n )
+				{
+					__builtin_prefetch( t + ( ( 16 * (size_t)k[l] ) < n ? 16 * k[l] : n ) );
+					k[l] = 2 * k[l] + ( t[k[l]] <= ips[base + l] );
+				}
+			}
+		}
+
+		for( size_t l = 0; l < lanes; l++ )
+		{
+			values[base + l] = getEytzingerValue( ips[base + l], k[l] );
+		}
+	}
+}
+
+#if defined(__AVX2__)
+void IP_TABLE::getValuesAVX2( const uint32_t* ips, size_t count, IP_TABLE_VALUE* values ) const {
+	const int*    t     = (const int*)m_eytzinger;
+	const __m256i bias  = _mm256_set1_epi32( (int)0x80000000 );
+	const __m256i limit = _mm256_set1_epi32( (int)m_indexSize + 1 );
+	const __m256i one   = _mm256_set1_epi32( 1 );
+
+	for( size_t base = 0; base < count; base += 8 )
+	{
+		// 无符号比较: 两边都异或符号位后用有符号比较
+		__m256i x = _mm256_xor_si256( _mm256_loadu_si256( (const __m256i*)( ips + base ) ), bias );
+		__m256i k = one;
+		for( uint32_t d = 0; d < m_eytzingerDepth; d++ )
+		{
+			__m256i active = _mm256_cmpgt_epi32( limit, k );
+			__m256i node   = _mm256_mask_i32gather_epi32( _mm256_setzero_si256(), t, k, active, 4 );
+			__m256i gt     = _mm256_cmpgt_epi32( _mm256_xor_si256( node, bias ), x );
+			__m256i le     = _mm256_andnot_si256( gt, active );
+			// le 为 -1 时 2k - le = 2k + 1
+			__m256i next   = _mm256_sub_epi32( _mm256_add_epi32( k, k ), le );
+			k = _mm256_blendv_epi8( k, next, active );
+		}
+
+		uint32_t lanes[8];
+		_mm256_storeu_si256( (__m256i*)lanes, k );
+		for( size_t l = 0; l < 8; l++ )
+		{
+			values[base + l] = getEytzingerValue( ips[base + l], lanes[l] );
+		}
+	}
+}
+#else
+void IP_TABLE::getValuesAVX2( const uint32_t* ips, size_t count, IP_TABLE_VALUE* values ) const {
+	getValuesScalar( ips, count, values );
+}
+#endif
 }
 }
@@ -7,7 +7,10 @@
  */
 
 #include <map>
+#include <vector>
 #include <assert.h>
+#include <stdint.h>
+#include <stddef.h>
 #include "CommDef.h"
 #include "Const.h"
 using namespace edu::common;
@@ -188,6 +191,50 @@ public:
 	}
 };
 
+// IPv6 地址, 按数值比较
+struct IPV6_ADDR
+{
+public:
+	uint64_t hi;
+	uint64_t lo;
+
+public:
+	IPV6_ADDR()
+		: hi( 0 )
+		, lo( 0 )
+	{
+
+	}
+
+	IPV6_ADDR( uint64_t _hi, uint64_t _lo )
+		: hi( _hi )
+		, lo( _lo )
+	{
+
+	}
+
+	// bytes 为网络字节序的 16 字节地址, 如 in6_addr.s6_addr
+	explicit IPV6_ADDR( const unsigned char* bytes )
+		: hi( 0 )
+		, lo( 0 )
+	{
+		for( int i = 0; i < 8; i++ )
+		{
+			hi = ( hi << 8 ) | bytes[i];
+			lo = ( lo << 8 ) | bytes[i + 8];
+		}
+	}
+
+	bool operator==( const IPV6_ADDR& data ) const { return hi == data.hi && lo == data.lo;                       }
+	bool operator!=( const IPV6_ADDR& data ) const { return !( *this == data );                                  }
+	bool operator< ( const IPV6_ADDR& data ) const { return hi < data.hi || ( hi == data.hi && lo < data.lo );   }
+	bool operator<=( const IPV6_ADDR& data ) const { return !( data < *this );                                   }
+
+	// ::ffff:a.b.c.d
+	bool isV4Mapped() const                        { return hi == 0 && ( lo >> 32 ) == 0xffff;                   }
+	uint32_t v4() const                            { return (uint32_t)lo;                                        }
+};
+
 struct IP_TABLE_VALUE
 {
 public:
@@ -216,9 +263,29 @@ public:
 	}
 };
 
+// iptable 二进制文件头, 后面依次是 8 字节对齐的各段:
+//   uint32 from[count], uint32 to[count], uint16 value[count],
+//   uint32 (isp, area)[value_count], uint32 eytzinger[count + 1], uint32 eytzinger_idx[count + 1],
+//   IPV6_ADDR from6[count6], IPV6_ADDR to6[count6], uint16 value6[count6]
+// checksum 为 payload 按 32 位字计算的 FNV-1a
+struct IP_TABLE_BLOB_HEADER
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t header_size;
+	uint32_t count;
+	uint32_t value_count;
+	uint32_t depth;
+	uint64_t payload_size;
+	uint32_t checksum;
+	uint32_t count6;       // version 2 起有 IPv6 段, version 1 为 0
+};
+
 class IP_TABLE
 {
 public:
+	typedef std::map< IPV6_ADDR, std::pair< IPV6_ADDR, IP_TABLE_VALUE > > IP_TABLE6_MAP;   // from -> (to, value)
 	typedef std::map< IP_TABLE_KEY, IP_TABLE_VALUE >                 IP_TABLE_MAP;
 	typedef std::map< IP_TABLE_KEY, IP_TABLE_VALUE >::iterator       IP_TABLE_MAP_IT;
 	typedef std::map< IP_TABLE_KEY, IP_TABLE_VALUE >::const_iterator IP_TABLE_MAP_CONST_IT;
@@ -230,10 +297,10 @@ public:
 	inline IP_TABLE_MAP_CONST_IT begin() const                                  { return m_table.begin();                                                                               }
 	inline IP_TABLE_MAP_CONST_IT end() const                                    { return m_table.end();                                                                                 }
 
-	inline void insert( const IP_TABLE_KEY& key, const IP_TABLE_VALUE& value )  { m_table.insert( IP_TABLE_MAP::value_type( key, value ) );                                             }
-	inline void insert( unsigned long from, unsigned long to, ISPType value , AreaType area)   { m_table.insert( IP_TABLE_MAP::value_type( IP_TABLE_KEY( from, to ), IP_TABLE_VALUE( value , area) ) );   	}
-	inline void erase( IP_TABLE_MAP_IT it )                                     { m_table.erase( it );              	                                                                }
-	inline void clear()                                                         { m_table.clear();                                                                                      }
+	inline void insert( const IP_TABLE_KEY& key, const IP_TABLE_VALUE& value )  { m_table.insert( IP_TABLE_MAP::value_type( key, value ) ); clearIndex();                               }
+	inline void insert( unsigned long from, unsigned long to, ISPType value , AreaType area)   { m_table.insert( IP_TABLE_MAP::value_type( IP_TABLE_KEY( from, to ), IP_TABLE_VALUE( value , area) ) ); clearIndex(); }
+	inline void erase( IP_TABLE_MAP_IT it )                                     { m_table.erase( it ); clearIndex();                                                                    }
+	inline void clear()                                                         { m_table.clear(); m_table6.clear(); clearIndex();                                                      }
 
 	inline IP_TABLE_MAP_IT find( const IP_TABLE_KEY& key )                      { return m_table.find( key );                                                                           }
 	inline IP_TABLE_MAP_CONST_IT find( const IP_TABLE_KEY& key ) const          { return m_table.find( key );                                                                           }
@@ -243,6 +310,11 @@ public:
 	// 2006/12/29
 	inline IP_TABLE_VALUE getValue( unsigned long ip) const
 	{
+		if( m_indexSize > 0 )
+		{
+			return getIndexedValue( ip );
+		}
+
 		IP_TABLE_MAP_CONST_IT it = this->find( ip );
 		if( it != this->end() )
 		{
@@ -258,13 +330,148 @@ public:
 		}
 	}
 
+	// 同时返回 ip 所在的、结果相同的整段 [spanFrom, spanTo], 落在空隙里时为整个空隙
+	// 没有索引时只保证 ip 本身
+	inline IP_TABLE_VALUE getValue( unsigned long ip, uint32_t& spanFrom, uint32_t& spanTo ) const
+	{
+		if( m_indexSize == 0 )
+		{
+			spanFrom = spanTo = (uint32_t)ip;
+			return getValue( ip );
+		}
+
+		size_t i = findIndexed( ip );
+		if( ( i < m_indexSize ) && ( ip <= m_indexTo[i] ) )
+		{
+			spanFrom = m_indexFrom[i];
+			spanTo   = m_indexTo[i];
+			return m_valueTable[ m_indexValue[i] ];
+		}
+
+		size_t next = ( i < m_indexSize ) ? i + 1 : 0;
+		spanFrom = ( i < m_indexSize ) ? m_indexTo[i] + 1 : 0;
+		spanTo   = ( next < m_indexSize ) ? m_indexFrom[next] - 1 : 0xffffffff;
+		return IP_TABLE_VALUE();
+	}
+
+	// IPv6 区间单独保存, 与已有区间重叠时不插入, 和 IPv4 的 std::map 语义一致
+	bool insert6( const IPV6_ADDR& from, const IPV6_ADDR& to, ISPType isp, AreaType area );
+	IP_TABLE_VALUE getValue6( const IPV6_ADDR& ip ) const;
+	inline size_t size6() const                                                 { return m_table6.size();                                                                               }
+	inline size_t index6Size() const                                            { return m_index6Size;                                                                                  }
+
+	// 把 m_table 展开成按 from 排序的扁平数组, 之后 getValue 走二分查找而不是红黑树
+	// insert/erase/clear 会使索引失效, 修改完需要重新调用
+	void buildIndex();
+	void clearIndex();
+	inline bool isIndexed() const                                               { return m_indexSize > 0 || m_index6Size > 0;                                                           }
+	inline size_t indexSize() const                                             { return m_indexSize;                                                                                   }
+
+	// 批量查询, ips 为主机字节序; 索引按 Eytzinger(BFS) 顺序排列, 编译时带 -mavx2 则一次处理 8 个
+	void getValues( const uint32_t* ips, size_t count, IP_TABLE_VALUE* values ) const;
+
+	// 索引的二进制格式(见 IP_TABLE_BLOB_HEADER), 由 iptable_compiler 离线生成
+	// loadIndex 把文件 mmap 进来直接使用, 不再构造 m_table, 只能通过 getValue/getValues 查询
+	bool saveIndex( const char* filename ) const;
+	bool loadIndex( const char* filename );
+	static bool isIndexFile( const char* filename );
+
 public:
 	IP_TABLE();
 
 	~IP_TABLE();
 
+private:
+	IP_TABLE( const IP_TABLE& );
+	IP_TABLE& operator=( const IP_TABLE& );
+
+	size_t buildEytzinger( size_t i, size_t k );
+	void buildDirectory();
+	void setIndexStorage();
+	void getValuesScalar( const uint32_t* ips, size_t count, IP_TABLE_VALUE* values ) const;
+	void getValuesAVX2( const uint32_t* ips, size_t count, IP_TABLE_VALUE* values ) const;
+	inline IP_TABLE_VALUE getEytzingerValue( uint32_t ip, uint32_t k ) const
+	{
+		// k 的低位连续 1 是最后几次向右走, 去掉后得到第一个 from > ip 的位置
+		k >>= __builtin_ffs( ~k );
+		size_t j = k ? m_eytzingerIdx[k] : m_indexSize;
+		if( ( j > 0 ) && ( ip <= m_indexTo[j - 1] ) )
+		{
+			return m_valueTable[ m_indexValue[j - 1] ];
+		}
+		return IP_TABLE_VALUE();
+	}
+
+	// 返回最后一个 from <= ip 的条目下标, 没有时返回 m_indexSize
+	inline size_t findIndexed( unsigned long ip ) const
+	{
+		// 先按高 16 位查一级目录, 候选为 [m_dir[h] - 1, m_dir[h + 1] - 1], 通常只有几条
+		uint32_t h  = (uint32_t)ip >> 16;
+		uint32_t hi = m_dir[h + 1];
+		if( hi == 0 )
+		{
+			return m_indexSize;
+		}
+		uint32_t lo = ( m_dir[h] > 0 ) ? m_dir[h] - 1 : 0;
+
+		// 无分支二分
+		const uint32_t* first = m_indexFrom;
+		const uint32_t* base  = first + lo;
+		size_t          n     = hi - lo;
+		while( n > 1 )
+		{
+			size_t half = n / 2;
+			base = ( base[half] <= ip ) ? base + half : base;
+			n -= half;
+		}
+		return ( *base <= ip ) ? (size_t)( base - first ) : m_indexSize;
+	}
+
+	inline IP_TABLE_VALUE getIndexedValue( unsigned long ip ) const
+	{
+		size_t i = findIndexed( ip );
+		if( ( i < m_indexSize ) && ( ip <= m_indexTo[i] ) )
+		{
+			return m_valueTable[ m_indexValue[i] ];
+		}
+		return IP_TABLE_VALUE();
+	}
+
 private:
 	IP_TABLE_MAP     m_table;
+
+	// 扁平索引: m_indexValue 保存 m_valueTable 的下标, (isp, area) 的组合很少
+	// m_eytzinger 为 m_indexFrom 的 Eytzinger 排列(下标从 1 开始), m_eytzingerIdx 映射回有序下标
+	// 指针指向下面的 buffer(buildIndex) 或者 mmap 进来的文件(loadIndex)
+	const uint32_t*             m_indexFrom;
+	const uint32_t*             m_indexTo;
+	const uint16_t*             m_indexValue;
+	const uint32_t*             m_eytzinger;
+	const uint32_t*             m_eytzingerIdx;
+	size_t                      m_indexSize;
+	uint32_t                    m_eytzingerDepth;
+	std::vector<IP_TABLE_VALUE> m_valueTable;
+
+	std::vector<uint32_t>       m_fromBuf;
+	std::vector<uint32_t>       m_toBuf;
+	std::vector<uint16_t>       m_valueBuf;
+	std::vector<uint32_t>       m_eytzingerBuf;
+	std::vector<uint32_t>       m_eytzingerIdxBuf;
+
+	// m_dir[h] 为 from 的高 16 位 < h 的条目数, 共 65537 项
+	std::vector<uint32_t>       m_dir;
+
+	IP_TABLE6_MAP               m_table6;
+	const IPV6_ADDR*            m_index6From;
+	const IPV6_ADDR*            m_index6To;
+	const uint16_t*             m_index6Value;
+	size_t                      m_index6Size;
+	std::vector<IPV6_ADDR>      m_from6Buf;
+	std::vector<IPV6_ADDR>      m_to6Buf;
+	std::vector<uint16_t>       m_value6Buf;
+
+	void*                       m_mapped;
+	size_t                      m_mappedSize;
 };
 
 }
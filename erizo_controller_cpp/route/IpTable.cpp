@@ -2,6 +2,11 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fstream>
+#include <algorithm>
+#include <set>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "IpTable.h"
 #include "Utility.h"
@@ -62,6 +67,235 @@ IpTable::IpTable()
   m_areaMap["WBN"] = WBN_AREA;
 }
 
+namespace
+{
+template <typename ADDR>
+struct IpRange
+{
+  ADDR from;
+  ADDR to;
+  IP_TABLE_VALUE value;
+  int line;
+};
+
+uint32_t nextAddr(uint32_t ip) { return ip + 1; }
+uint32_t prevAddr(uint32_t ip) { return ip - 1; }
+bool isMaxAddr(uint32_t ip) { return ip == 0xffffffff; }
+
+IPV6_ADDR nextAddr(const IPV6_ADDR &ip) { return IPV6_ADDR(ip.lo == UINT64_MAX ? ip.hi + 1 : ip.hi, ip.lo + 1); }
+IPV6_ADDR prevAddr(const IPV6_ADDR &ip) { return IPV6_ADDR(ip.lo == 0 ? ip.hi - 1 : ip.hi, ip.lo - 1); }
+bool isMaxAddr(const IPV6_ADDR &ip) { return ip.hi == UINT64_MAX && ip.lo == UINT64_MAX; }
+
+std::string addrString(uint32_t ip)
+{
+  char buf[INET_ADDRSTRLEN];
+  struct in_addr in;
+  in.s_addr = htonl(ip);
+  return inet_ntop(AF_INET, &in, buf, sizeof(buf));
+}
+
+std::string addrString(const IPV6_ADDR &ip)
+{
+  char buf[INET6_ADDRSTRLEN];
+  struct in6_addr in6;
+  for (int i = 0; i < 8; i++)
+  {
+    in6.s6_addr[i] = (unsigned char)(ip.hi >> (56 - 8 * i));
+    in6.s6_addr[i + 8] = (unsigned char)(ip.lo >> (56 - 8 * i));
+  }
+  return inet_ntop(AF_INET6, &in6, buf, sizeof(buf));
+}
+
+bool sameValue(const IP_TABLE_VALUE &a, const IP_TABLE_VALUE &b)
+{
+  return a.isp == b.isp && a.area == b.area;
+}
+
+// '/'后必须是1-3位数字且没有多余字符,否则"1.2.3.0/"之类会被当成/0
+bool parsePrefixLen(const std::string &str, size_t pos, int maxLen, int &len)
+{
+  if (pos == std::string::npos)
+    return false;
+  const char *begin = str.c_str() + pos + 1;
+  size_t digits = strspn(begin, "0123456789");
+  if (digits < 1 || digits > 3)
+    return false;
+  char *end = NULL;
+  long value = strtol(begin, &end, 10);
+  if (end != begin + digits || *end != '\0' || value > maxLen)
+    return false;
+  len = (int)value;
+  return true;
+}
+
+// a.b.c.d/len 或 x:x::/len
+bool parseCidr(const std::string &str, uint32_t &from, uint32_t &to)
+{
+  size_t pos = str.find('/');
+  int len = 0;
+  struct in_addr in;
+  if (!parsePrefixLen(str, pos, 32, len) || inet_pton(AF_INET, str.substr(0, pos).c_str(), &in) != 1)
+    return false;
+
+  uint32_t mask = len == 0 ? 0 : 0xffffffff << (32 - len);
+  from = ntohl(in.s_addr) & mask;
+  to = from | ~mask;
+  return true;
+}
+
+bool parseCidr(const std::string &str, IPV6_ADDR &from, IPV6_ADDR &to)
+{
+  size_t pos = str.find('/');
+  int len = 0;
+  struct in6_addr in6;
+  if (!parsePrefixLen(str, pos, 128, len) || inet_pton(AF_INET6, str.substr(0, pos).c_str(), &in6) != 1)
+    return false;
+
+  uint64_t hiMask = len == 0 ? 0 : (len >= 64 ? UINT64_MAX : UINT64_MAX << (64 - len));
+  uint64_t loMask = len <= 64 ? 0 : (len == 128 ? UINT64_MAX : UINT64_MAX << (128 - len));
+  IPV6_ADDR addr(in6.s6_addr);
+  from = IPV6_ADDR(addr.hi & hiMask, addr.lo & loMask);
+  to = IPV6_ADDR(from.hi | ~hiMask, from.lo | ~loMask);
+  return true;
+}
+
+bool parseRange(const std::string &fromStr, const std::string &toStr, uint32_t &from, uint32_t &to)
+{
+  struct in_addr inFrom, inTo;
+  if (inet_pton(AF_INET, fromStr.c_str(), &inFrom) != 1 || inet_pton(AF_INET, toStr.c_str(), &inTo) != 1)
+    return false;
+  from = ntohl(inFrom.s_addr);
+  to = ntohl(inTo.s_addr);
+  return true;
+}
+
+bool parseRange(const std::string &fromStr, const std::string &toStr, IPV6_ADDR &from, IPV6_ADDR &to)
+{
+  struct in6_addr inFrom, inTo;
+  if (inet_pton(AF_INET6, fromStr.c_str(), &inFrom) != 1 || inet_pton(AF_INET6, toStr.c_str(), &inTo) != 1)
+    return false;
+  from = IPV6_ADDR(inFrom.s6_addr);
+  to = IPV6_ADDR(inTo.s6_addr);
+  return true;
+}
+
+template <typename ADDR>
+bool rangeLess(const IpRange<ADDR> &a, const IpRange<ADDR> &b)
+{
+  if (a.from != b.from)
+    return a.from < b.from;
+  if (a.to != b.to)
+    return b.to < a.to;
+  return a.line < b.line;
+}
+
+// 覆盖同一个地址的多条记录中 from 最大的优先(嵌套时即最长前缀), 其次 to 最小, 再其次行号大的
+template <typename ADDR>
+struct RangePriority
+{
+  const std::vector<IpRange<ADDR> > *ranges;
+
+  bool operator()(size_t a, size_t b) const
+  {
+    const IpRange<ADDR> &x = (*ranges)[a];
+    const IpRange<ADDR> &y = (*ranges)[b];
+    if (x.from != y.from)
+      return y.from < x.from;
+    if (x.to != y.to)
+      return x.to < y.to;
+    if (x.line != y.line)
+      return x.line > y.line;
+    return a < b;
+  }
+};
+
+// 检查重复和部分重叠的记录, 嵌套是正常的(最长前缀优先), 不报
+template <typename ADDR>
+void checkOverlaps(const std::vector<IpRange<ADDR> > &ranges, std::vector<std::string> &warnings)
+{
+  char buf[256];
+  // 覆盖当前起点的记录, 部分重叠时栈顶下面的记录也可能和 r 相交, 需要逐个比较
+  std::vector<size_t> stack;
+  for (size_t i = 0; i < ranges.size(); i++)
+  {
+    const IpRange<ADDR> &r = ranges[i];
+    size_t kept = 0;
+    for (size_t k = 0; k < stack.size(); k++)
+    {
+      const IpRange<ADDR> &e = ranges[stack[k]];
+      // 之后的记录起点不小于 r.from, 不再相交, 移除
+      if (e.to < r.from)
+        continue;
+      stack[kept++] = stack[k];
+
+      if (e.from == r.from && e.to == r.to)
+      {
+        snprintf(buf, sizeof(buf), "line %d duplicates line %d (%s - %s), line %d wins",
+                 r.line, e.line, addrString(r.from).c_str(), addrString(r.to).c_str(), r.line);
+        warnings.push_back(buf);
+      }
+      else if (e.to < r.to)
+      {
+        snprintf(buf, sizeof(buf), "line %d (%s - %s) partially overlaps line %d (%s - %s), line %d wins the overlap",
+                 r.line, addrString(r.from).c_str(), addrString(r.to).c_str(),
+                 e.line, addrString(e.from).c_str(), addrString(e.to).c_str(), r.line);
+        warnings.push_back(buf);
+      }
+    }
+    stack.resize(kept);
+    stack.push_back(i);
+  }
+}
+
+// 把可能嵌套/重叠的记录展开成互不重叠的区间, 相邻且值相同的区间合并
+template <typename ADDR>
+void flattenRanges(std::vector<IpRange<ADDR> > &ranges, std::vector<IpRange<ADDR> > &flat)
+{
+  std::sort(ranges.begin(), ranges.end(), rangeLess<ADDR>);
+
+  RangePriority<ADDR> priority = {&ranges};
+  std::set<size_t, RangePriority<ADDR> > active(priority);
+  std::set<std::pair<ADDR, size_t> > ends;
+  size_t i = 0;
+  ADDR cur = ADDR();
+  while (i < ranges.size() || !active.empty())
+  {
+    if (active.empty())
+      cur = ranges[i].from;
+    for (; i < ranges.size() && ranges[i].from == cur; i++)
+    {
+      active.insert(i);
+      ends.insert(std::make_pair(ranges[i].to, i));
+    }
+
+    // 当前段到下一个起点或最近的终点为止
+    ADDR segEnd = ends.begin()->first;
+    if (i < ranges.size() && ranges[i].from <= segEnd)
+      segEnd = prevAddr(ranges[i].from);
+
+    const IP_TABLE_VALUE &value = ranges[*active.begin()].value;
+    if (!flat.empty() && nextAddr(flat.back().to) == cur && sameValue(flat.back().value, value))
+    {
+      flat.back().to = segEnd;
+    }
+    else
+    {
+      IpRange<ADDR> seg = {cur, segEnd, value, ranges[*active.begin()].line};
+      flat.push_back(seg);
+    }
+
+    while (!ends.empty() && ends.begin()->first == segEnd)
+    {
+      active.erase(ends.begin()->second);
+      ends.erase(ends.begin());
+    }
+    if (isMaxAddr(segEnd))
+      break;
+    cur = nextAddr(segEnd);
+  }
+}
+} // namespace
+
 bool IpTable::loadIspIpDataFile(string filename, string delim)
 {
   std::ifstream ifile(filename.c_str());
@@ -70,6 +304,8 @@ bool IpTable::loadIspIpDataFile(string filename, string delim)
   AreaType areaType;
   std::string isp_str, area_str;
   int lineNum = 0;
+  std::vector<IpRange<uint32_t> > ranges;
+  std::vector<IpRange<IPV6_ADDR> > ranges6;
 
   int fd = access(filename.c_str(), F_OK);
   if (fd != 0)
@@ -80,6 +316,7 @@ bool IpTable::loadIspIpDataFile(string filename, string delim)
   if (!ifile.good())
     return false;
 
+  m_loadWarnings.clear();
   while (std::getline(ifile, line))
   {
     lineNum++;
@@ -89,11 +326,15 @@ bool IpTable::loadIspIpDataFile(string filename, string delim)
 
     std::vector<string> retVec;
     StringUtil::split(line, delim, &retVec);
-    if (retVec.size() < 4)
+
+    // 两种格式: "起始IP 结束IP ISP 区域" 或 "CIDR ISP 区域"
+    bool cidr = retVec.size() >= 3 && retVec[0].find('/') != std::string::npos;
+    if (retVec.size() < (cidr ? 3u : 4u))
       continue;
-    
-    isp_str = StringUtil::trim(retVec[2]);
-    area_str = StringUtil::trim(retVec[3]);
+
+    size_t field = cidr ? 1 : 2;
+    isp_str = StringUtil::trim(retVec[field]);
+    area_str = StringUtil::trim(retVec[field + 1]);
 
     if (m_ispMap.find(isp_str.c_str()) == m_ispMap.end())
       continue;
@@ -103,15 +344,45 @@ bool IpTable::loadIspIpDataFile(string filename, string delim)
     ispType = m_ispMap[isp_str];
     areaType = m_areaMap[area_str];
 
-    // 分析Ip范围条目 e.g. 202.99.102.128 - 202.99.102.191
+    std::string fromStr = StringUtil::trim(retVec[0]);
+    std::string toStr = cidr ? "" : StringUtil::trim(retVec[1]);
+    bool ok;
 
-    unsigned long ipFrom = ntohl(inet_addr(StringUtil::trim(retVec[0]).c_str()));
-    unsigned long ipTo = ntohl(inet_addr(StringUtil::trim(retVec[1]).c_str()));
-
-    if (ipFrom == 0xffffffff || ipTo == 0xffffffff)
+    // IPv6 条目 e.g. 2001:da8::/32
+    if (fromStr.find(':') != std::string::npos)
+    {
+      IpRange<IPV6_ADDR> r = {IPV6_ADDR(), IPV6_ADDR(), IP_TABLE_VALUE(ispType, areaType), lineNum};
+      ok = cidr ? parseCidr(fromStr, r.from, r.to) : parseRange(fromStr, toStr, r.from, r.to);
+      if (ok && r.from <= r.to)
+        ranges6.push_back(r);
+      else
+        m_loadWarnings.push_back("line " + std::to_string(lineNum) + " is not a valid ip range, ignored");
       continue;
-    insert(ipFrom, ipTo, ispType, areaType);
+    }
+
+    // 分析Ip范围条目 e.g. 202.99.102.128 - 202.99.102.191 或 202.99.102.128/26
+    IpRange<uint32_t> r = {0, 0, IP_TABLE_VALUE(ispType, areaType), lineNum};
+    ok = cidr ? parseCidr(fromStr, r.from, r.to) : parseRange(fromStr, toStr, r.from, r.to);
+    if (ok && r.from <= r.to)
+      ranges.push_back(r);
+    else
+      m_loadWarnings.push_back("line " + std::to_string(lineNum) + " is not a valid ip range, ignored");
   }
+
+  // 文本中的记录可以嵌套, 按最长前缀匹配展开后再插入, 同一范围后出现的覆盖前面的
+  std::vector<IpRange<uint32_t> > flat;
+  flattenRanges(ranges, flat);
+  checkOverlaps(ranges, m_loadWarnings);
+  for (size_t i = 0; i < flat.size(); i++)
+    insert(flat[i].from, flat[i].to, flat[i].value.isp, flat[i].value.area);
+
+  std::vector<IpRange<IPV6_ADDR> > flat6;
+  flattenRanges(ranges6, flat6);
+  checkOverlaps(ranges6, m_loadWarnings);
+  for (size_t i = 0; i < flat6.size(); i++)
+    insert6(flat6[i].from, flat6[i].to, flat6[i].value.isp, flat6[i].value.area);
+
+  buildIndex();
   return true;
 }
 
@@ -131,7 +402,7 @@ AreaType IpTable::getAreaType(unsigned long ip)
   return m_defaultArea;
 }
 
-IP_TABLE_VALUE IpTable::getIpTableValue(unsigned long ip)
+IP_TABLE_VALUE IpTable::getIpTableValue(unsigned long ip) const
 {
   IP_TABLE_VALUE IP_T = getValue(ntohl(ip));
 
@@ -144,6 +415,55 @@ IP_TABLE_VALUE IpTable::getIpTableValue(unsigned long ip)
   return IP_T;
 }
 
+IP_TABLE_VALUE IpTable::getIpTableValue(unsigned long ip, uint32_t &spanFrom, uint32_t &spanTo) const
+{
+  IP_TABLE_VALUE IP_T = getValue(ntohl(ip), spanFrom, spanTo);
+
+  if (IP_T.isp == AUTO_DETECT)
+    IP_T.isp = m_defaultIsp;
+
+  if (IP_T.area == AREA_UNKNOWN)
+    IP_T.area = m_defaultArea;
+
+  return IP_T;
+}
+
+IP_TABLE_VALUE IpTable::getIpTableValue6(const unsigned char *ip) const
+{
+  IP_TABLE_VALUE IP_T = getValue6(IPV6_ADDR(ip));
+
+  if (IP_T.isp == AUTO_DETECT)
+    IP_T.isp = m_defaultIsp;
+
+  if (IP_T.area == AREA_UNKNOWN)
+    IP_T.area = m_defaultArea;
+
+  return IP_T;
+}
+
+void IpTable::getIpTableValues(const uint32_t *ips, size_t count, IP_TABLE_VALUE *values) const
+{
+  const size_t kChunk = 256;
+  uint32_t host[kChunk];
+
+  for (size_t base = 0; base < count; base += kChunk)
+  {
+    size_t n = std::min(kChunk, count - base);
+    for (size_t i = 0; i < n; i++)
+      host[i] = ntohl(ips[base + i]);
+
+    getValues(host, n, values + base);
+
+    for (size_t i = 0; i < n; i++)
+    {
+      if (values[base + i].isp == AUTO_DETECT)
+        values[base + i].isp = m_defaultIsp;
+      if (values[base + i].area == AREA_UNKNOWN)
+        values[base + i].area = m_defaultArea;
+    }
+  }
+}
+
 IpTable &IpTable::instance()
 {
   static IpTable instance;
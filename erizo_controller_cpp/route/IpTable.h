@@ -2,6 +2,7 @@
 #define __IP_TABLE_IMP_H__
 
 #include <string>
+#include <vector>
 #include "IP_TABLE.h"
 #include "CommDef.h"
 #include "Const.h"
@@ -10,10 +11,17 @@ namespace iptable {
 class IpTable : public IP_TABLE {
 public:
   IpTable();
+	//每行为 "起始IP 结束IP ISP 区域" 或 "CIDR ISP 区域", 范围可以嵌套, 查询时最长前缀优先
 	bool loadIspIpDataFile(std::string filename, std::string delim = " ");
 	ISPType getIspType(unsigned long ip);
   AreaType getAreaType(unsigned long ip);
-  IP_TABLE_VALUE getIpTableValue(unsigned long ip);
+  IP_TABLE_VALUE getIpTableValue(unsigned long ip) const;
+  //span为主机字节序, 整段内的查询结果都相同
+  IP_TABLE_VALUE getIpTableValue(unsigned long ip, uint32_t &spanFrom, uint32_t &spanTo) const;
+  //ip为网络字节序的16字节IPv6地址
+  IP_TABLE_VALUE getIpTableValue6(const unsigned char *ip) const;
+  //ips为网络字节序
+  void getIpTableValues(const uint32_t *ips, size_t count, IP_TABLE_VALUE *values) const;
 	static IpTable& instance();
   void addNewIsp(const std::string& name, ISPType isp);
   void removeIsp(const std::string& name);
@@ -30,6 +38,9 @@ public:
 
   static void setDefault(ISPType isp, AreaType area);
 
+  //上次加载时发现的重复、部分重叠和无法解析的记录
+  const std::vector<std::string>& getLoadWarnings() const { return m_loadWarnings; }
+
 private:
 	// 初始化
 	static ISPType m_defaultIsp;
@@ -37,6 +48,7 @@ private:
 
   std::map<std::string, ISPType> m_ispMap;
   std::map<std::string, AreaType> m_areaMap;
+  std::vector<std::string> m_loadWarnings;
 };
 }
 }
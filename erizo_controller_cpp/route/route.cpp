@@ -1,20 +1,84 @@
 #include "route.h"
+#include "route_cache.h"
 
 #include <arpa/inet.h>
 
+#include <algorithm>
+
 DEFINE_LOGGER(Route, "Route");
 
+static const size_t kMaxLoadWarnings = 100;
+
 int Route::init(const std::string &iptable_path)
 {
-    if (!ip_table_.loadIspIpDataFile(iptable_path))
+    std::unique_lock<std::mutex> lock(reload_mux_);
+    std::shared_ptr<const edu::iptable::IpTable> table = loadTable(iptable_path);
+    if (!table)
     {
         ELOG_ERROR("load iptable failed");
         return 1;
     }
 
+    iptable_path_ = iptable_path;
+    std::atomic_store(&ip_table_, table);
+    generation_++;
+    return 0;
+}
+
+int Route::reload()
+{
+    std::unique_lock<std::mutex> lock(reload_mux_);
+    if (iptable_path_.empty())
+    {
+        ELOG_ERROR("reload iptable before init");
+        return 1;
+    }
+
+    std::shared_ptr<const edu::iptable::IpTable> table = loadTable(iptable_path_);
+    if (!table)
+    {
+        ELOG_ERROR("reload iptable %s failed,keep the old one", iptable_path_);
+        return 1;
+    }
+
+    //旧表在最后一个正在查询的线程释放引用后析构
+    std::atomic_store(&ip_table_, table);
+    generation_++;
+    ELOG_INFO("reload iptable %s done,%zu ranges,cache hits %lu misses %lu", iptable_path_, table->indexSize(),
+              RouteCache::hits(), RouteCache::misses());
     return 0;
 }
 
+std::shared_ptr<const edu::iptable::IpTable> Route::loadTable(const std::string &iptable_path)
+{
+    std::shared_ptr<edu::iptable::IpTable> table = std::make_shared<edu::iptable::IpTable>();
+    //iptable_compiler生成的二进制文件直接mmap,否则按文本解析
+    if (edu::iptable::IpTable::isIndexFile(iptable_path.c_str()))
+    {
+        if (!table->loadIndex(iptable_path.c_str()))
+        {
+            ELOG_ERROR("load binary iptable %s failed(version/checksum mismatch?)", iptable_path);
+            return nullptr;
+        }
+        return table;
+    }
+
+    if (!table->loadIspIpDataFile(iptable_path))
+        return nullptr;
+
+    const std::vector<std::string> &warnings = table->getLoadWarnings();
+    for (size_t i = 0; i < warnings.size() && i < kMaxLoadWarnings; i++)
+        ELOG_WARN("iptable %s: %s", iptable_path, warnings[i]);
+    if (warnings.size() > kMaxLoadWarnings)
+        ELOG_WARN("iptable %s: %zu more warnings not shown", iptable_path, warnings.size() - kMaxLoadWarnings);
+    return table;
+}
+
+std::shared_ptr<const edu::iptable::IpTable> Route::getTable()
+{
+    return std::atomic_load(&ip_table_);
+}
+
 Route *Route::instance_ = nullptr;
 
 Route *Route::getInstance()
@@ -26,13 +90,84 @@ Route *Route::getInstance()
 
 edu::iptable::IP_TABLE_VALUE Route::processIP(const std::string &ip)
 {
-    //only support ipv4
+    std::shared_ptr<const edu::iptable::IpTable> table = getTable();
+    if (!table)
+        return edu::iptable::IP_TABLE_VALUE();
+
+    if (ip.find(':') != std::string::npos)
+    {
+        struct in6_addr in6;
+        if (inet_pton(AF_INET6, ip.c_str(), &in6) != 1)
+            return table->getIpTableValue(0);
+
+        //::ffff:a.b.c.d 按IPv4查
+        edu::iptable::IPV6_ADDR addr(in6.s6_addr);
+        if (addr.isV4Mapped())
+            return table->getIpTableValue(htonl(addr.v4()));
+        return table->getIpTableValue6(in6.s6_addr);
+    }
+
     struct in_addr in;
+    in.s_addr = 0;
     inet_pton(AF_INET, ip.c_str(), &in);
-    uint32_t ip_uint = in.s_addr;
-    return ip_table_.getIpTableValue(ip_uint);
+    return table->getIpTableValue(in.s_addr);
+}
+
+edu::iptable::IP_TABLE_VALUE Route::processIP(uint32_t ip)
+{
+    std::shared_ptr<const edu::iptable::IpTable> table = getTable();
+    if (!table)
+        return edu::iptable::IP_TABLE_VALUE();
+    return table->getIpTableValue(ip);
+}
+
+edu::iptable::IP_TABLE_VALUE Route::processIPCached(uint32_t ip)
+{
+    RouteCache *cache = RouteCache::getThreadInstance();
+    uint32_t host_ip = ntohl(ip);
+    //先读generation再取表,reload先换表再加generation,缓存里不会出现旧表的结果
+    uint64_t generation = generation_.load();
+    edu::iptable::IP_TABLE_VALUE value;
+    if (cache->get(host_ip, generation, value))
+        return value;
+
+    std::shared_ptr<const edu::iptable::IpTable> table = getTable();
+    if (!table)
+        return edu::iptable::IP_TABLE_VALUE();
+
+    uint32_t span_from, span_to;
+    value = table->getIpTableValue(ip, span_from, span_to);
+    if (span_from <= (host_ip & 0xffffff00) && (host_ip | 0xff) <= span_to)
+        cache->put(host_ip, generation, value);
+    return value;
+}
+
+void Route::processIPBatch(const std::vector<std::string> &ips, std::vector<edu::iptable::IP_TABLE_VALUE> &values)
+{
+    std::vector<uint32_t> ip_uints(ips.size(), 0);
+    for (size_t i = 0; i < ips.size(); i++)
+    {
+        struct in_addr in;
+        if (inet_pton(AF_INET, ips[i].c_str(), &in) == 1)
+            ip_uints[i] = in.s_addr;
+    }
+
+    values.resize(ips.size());
+    if (!ips.empty())
+        processIPBatch(&ip_uints[0], ip_uints.size(), &values[0]);
+}
+
+void Route::processIPBatch(const uint32_t *ips, size_t count, edu::iptable::IP_TABLE_VALUE *values)
+{
+    std::shared_ptr<const edu::iptable::IpTable> table = getTable();
+    if (!table)
+    {
+        std::fill(values, values + count, edu::iptable::IP_TABLE_VALUE());
+        return;
+    }
+    table->getIpTableValues(ips, count, values);
 }
 
-Route::Route() {}
+Route::Route() : generation_(0) {}
 
 Route::~Route() {}
\ No newline at end of file
@@ -2,6 +2,10 @@
 #define ROUTE_H
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
 
 #include "common/logger.h"
 #include "IpTable.h"
@@ -15,13 +19,31 @@ public:
   ~Route();
 
   int init(const std::string &iptable_path);
+  //重新加载iptable,新表构建完成后整体替换,查询线程不会阻塞
+  int reload();
+  //支持IPv4和IPv6,IPv4-mapped地址按IPv4查
   edu::iptable::IP_TABLE_VALUE processIP(const std::string &ip);
+  //ip为网络字节序(in_addr.s_addr)
+  edu::iptable::IP_TABLE_VALUE processIP(uint32_t ip);
+  //同processIP(uint32_t),先查当前线程的/24缓存(RouteCache)
+  edu::iptable::IP_TABLE_VALUE processIPCached(uint32_t ip);
+  void processIPBatch(const std::vector<std::string> &ips, std::vector<edu::iptable::IP_TABLE_VALUE> &values);
+  //ips为网络字节序(in_addr.s_addr)
+  void processIPBatch(const uint32_t *ips, size_t count, edu::iptable::IP_TABLE_VALUE *values);
 
 private:
   Route();
 
+  std::shared_ptr<const edu::iptable::IpTable> loadTable(const std::string &iptable_path);
+  std::shared_ptr<const edu::iptable::IpTable> getTable();
+
 private:
-  edu::iptable::IpTable ip_table_;
+  //只通过std::atomic_load/std::atomic_store访问
+  std::shared_ptr<const edu::iptable::IpTable> ip_table_;
+  std::string iptable_path_;
+  std::mutex reload_mux_;
+  //每次替换ip_table_后加一,用于让RouteCache失效
+  std::atomic<uint64_t> generation_;
   static Route *instance_;
 };
 
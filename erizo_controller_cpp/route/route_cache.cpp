@@ -0,0 +1,64 @@
+#include "route_cache.h"
+
+std::atomic<uint64_t> RouteCache::hits_(0);
+std::atomic<uint64_t> RouteCache::misses_(0);
+
+RouteCache *RouteCache::getThreadInstance()
+{
+    static thread_local RouteCache instance;
+    return &instance;
+}
+
+RouteCache::RouteCache() : generation_(0)
+{
+    index_.reserve(kCapacity);
+}
+
+void RouteCache::reset(uint64_t generation)
+{
+    lru_.clear();
+    index_.clear();
+    generation_ = generation;
+}
+
+bool RouteCache::get(uint32_t ip, uint64_t generation, edu::iptable::IP_TABLE_VALUE &value)
+{
+    if (generation != generation_)
+        reset(generation);
+
+    auto it = index_.find(ip >> 8);
+    if (it == index_.end())
+    {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    lru_.splice(lru_.begin(), lru_, it->second);
+    value = it->second->second;
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void RouteCache::put(uint32_t ip, uint64_t generation, const edu::iptable::IP_TABLE_VALUE &value)
+{
+    //不是本缓存当前generation的结果直接丢弃
+    if (generation != generation_)
+        return;
+
+    uint32_t key = ip >> 8;
+    auto it = index_.find(key);
+    if (it != index_.end())
+    {
+        it->second->second = value;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return;
+    }
+
+    if (lru_.size() >= kCapacity)
+    {
+        index_.erase(lru_.back().first);
+        lru_.pop_back();
+    }
+    lru_.push_front(std::make_pair(key, value));
+    index_[key] = lru_.begin();
+}
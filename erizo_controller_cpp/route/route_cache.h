@@ -0,0 +1,43 @@
+#ifndef ROUTE_CACHE_H
+#define ROUTE_CACHE_H
+
+#include <list>
+#include <unordered_map>
+#include <atomic>
+#include <utility>
+
+#include "IP_TABLE.h"
+
+//按/24缓存iptable查询结果的LRU,每个线程一份,不加锁
+//只缓存整个/24落在同一条记录(或同一个空隙)里的结果
+class RouteCache
+{
+public:
+  static RouteCache *getThreadInstance();
+
+  //ip为主机字节序,generation不一致时先清空
+  bool get(uint32_t ip, uint64_t generation, edu::iptable::IP_TABLE_VALUE &value);
+  void put(uint32_t ip, uint64_t generation, const edu::iptable::IP_TABLE_VALUE &value);
+
+  //所有线程的累计值
+  static uint64_t hits() { return hits_.load(std::memory_order_relaxed); }
+  static uint64_t misses() { return misses_.load(std::memory_order_relaxed); }
+
+private:
+  RouteCache();
+
+  void reset(uint64_t generation);
+
+private:
+  typedef std::list<std::pair<uint32_t, edu::iptable::IP_TABLE_VALUE>> LruList;
+
+  LruList lru_;
+  std::unordered_map<uint32_t, LruList::iterator> index_;
+  uint64_t generation_;
+
+  static const size_t kCapacity = 4096;
+  static std::atomic<uint64_t> hits_;
+  static std::atomic<uint64_t> misses_;
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef ERIZO_SRC_ERIZO_THREAD_MPSC_QUEUE_H_
+#define ERIZO_SRC_ERIZO_THREAD_MPSC_QUEUE_H_
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+
+namespace erizo {
+
+//
+// Intrusive multi-producer single-consumer queue (Vyukov). push() is
+// wait-free and never takes a lock, so producers do not block behind the
+// consumer's I/O. The consumer sleeps on an eventfd; producers only write
+// to it when the consumer has announced that it is about to sleep.
+//
+// Elements derive from MpscNode and are allocated with new; ownership
+// passes to the queue on push() and back to the caller on pop().
+
+struct MpscNode {
+  std::atomic<MpscNode*> next;
+};
+
+template <typename T>
+class MpscQueue {
+ public:
+  MpscQueue() : head_{&stub_}, tail_{&stub_}, sleeping_{false} {
+    stub_.next.store(nullptr, std::memory_order_relaxed);
+    event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  }
+
+  ~MpscQueue() {
+    while (T* node = pop()) {
+      delete node;
+    }
+    if (event_fd_ >= 0) {
+      close(event_fd_);
+    }
+  }
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  // False when the eventfd could not be created; the consumer would never
+  // be woken, so owners must check this before starting it.
+  bool valid() const { return event_fd_ >= 0; }
+
+  // Any thread.
+  void push(T* node) {
+    link(node);
+    if (sleeping_.exchange(false)) {
+      notify();
+    }
+  }
+
+  // Consumer only. Returns nullptr when the queue is empty, or when a
+  // producer is half way through push(); in that case the producer's
+  // wakeup follows shortly.
+  T* pop() {
+    MpscNode* tail = tail_;
+    MpscNode* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+      if (next == nullptr) {
+        return nullptr;
+      }
+      tail_ = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) {
+      tail_ = next;
+      return static_cast<T*>(tail);
+    }
+    if (tail != head_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    link(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+      tail_ = next;
+      return static_cast<T*>(tail);
+    }
+    return nullptr;
+  }
+
+  // Consumer only. Returns when something may have been pushed, on
+  // notify(), or after timeout_ms (-1 waits forever).
+  void wait(int timeout_ms) {
+    sleeping_.store(true);
+    if (!empty()) {
+      sleeping_.store(false);
+      return;
+    }
+    struct pollfd pfd;
+    pfd.fd = event_fd_;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, timeout_ms);
+    uint64_t value;
+    ssize_t ignored = read(event_fd_, &value, sizeof(value));
+    (void)ignored;
+    sleeping_.store(false);
+  }
+
+  // Any thread. Wakes the consumer unconditionally, e.g. for shutdown.
+  void notify() {
+    uint64_t value = 1;
+    ssize_t ignored = write(event_fd_, &value, sizeof(value));
+    (void)ignored;
+  }
+
+ private:
+  void link(MpscNode* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    MpscNode* prev = head_.exchange(node);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // Consumer only.
+  bool empty() {
+    return tail_ == &stub_ && head_.load() == &stub_;
+  }
+
+ private:
+  MpscNode stub_;
+  std::atomic<MpscNode*> head_;  // last pushed, producers
+  MpscNode* tail_;               // next to pop, consumer
+  std::atomic<bool> sleeping_;
+  int event_fd_;
+};
+
+}  // namespace erizo
+
+#endif  // ERIZO_SRC_ERIZO_THREAD_MPSC_QUEUE_H_
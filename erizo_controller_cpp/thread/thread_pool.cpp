@@ -45,6 +45,10 @@ std::shared_ptr<Worker> ThreadPool::getSequenceWorker(){
   return workers_[index];
 }
 
+std::shared_ptr<Worker> ThreadPool::getWorker(size_t index) {
+  return workers_[index % workers_.size()];
+}
+
 void ThreadPool::close() {
   for (auto worker : workers_) {
     worker->close();
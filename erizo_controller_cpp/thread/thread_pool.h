@@ -16,6 +16,8 @@ class ThreadPool {
 
   std::shared_ptr<Worker> getLessUsedWorker();
   std::shared_ptr<Worker> getSequenceWorker();
+  std::shared_ptr<Worker> getWorker(size_t index);
+  size_t size() const { return workers_.size(); }
   void start();
   void close();
 
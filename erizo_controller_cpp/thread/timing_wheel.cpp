@@ -0,0 +1,90 @@
+#include "timing_wheel.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "clock.h"
+
+using erizo::TimingWheel;
+
+TimingWheel::TimingWheel(std::chrono::milliseconds tick, size_t slot_num)
+    : tick_{tick}, slots_(slot_num), current_{0}, next_id_{1}, running_{false} {
+}
+
+TimingWheel::~TimingWheel() {
+  stop();
+}
+
+void TimingWheel::start() {
+  if (running_.exchange(true)) {
+    return;
+  }
+  thread_ = std::thread(&TimingWheel::run, this);
+}
+
+void TimingWheel::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  thread_.join();
+  std::unique_lock<std::mutex> lock(mutex_);
+  timers_.clear();
+  for (std::vector<TimerId> &slot : slots_) {
+    slot.clear();
+  }
+}
+
+TimingWheel::TimerId TimingWheel::schedule(Task f, std::chrono::milliseconds delay) {
+  // Round up so a timer never fires early; the slot at current_ has
+  // already been visited for this tick.
+  uint64_t ticks = std::max<uint64_t>(1, (delay.count() + tick_.count() - 1) / tick_.count());
+  std::unique_lock<std::mutex> lock(mutex_);
+  TimerId id = next_id_++;
+  timers_[id] = {(ticks - 1) / slots_.size(), std::move(f)};
+  slots_[(current_ + ticks) % slots_.size()].push_back(id);
+  return id;
+}
+
+bool TimingWheel::cancel(TimerId id) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return timers_.erase(id) > 0;
+}
+
+void TimingWheel::run() {
+  // Ticks are counted from start so that slow tasks do not make the wheel drift.
+  time_point next = clock::now() + tick_;
+  while (running_) {
+    std::this_thread::sleep_until(next);
+    std::vector<Task> due;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (next <= clock::now()) {
+        advance(&due);
+        next += tick_;
+      }
+    }
+    for (Task &f : due) {
+      f();
+    }
+  }
+}
+
+void TimingWheel::advance(std::vector<Task> *due) {
+  current_ = (current_ + 1) % slots_.size();
+  std::vector<TimerId> &slot = slots_[current_];
+  size_t kept = 0;
+  for (TimerId id : slot) {
+    auto it = timers_.find(id);
+    if (it == timers_.end()) {
+      continue;
+    }
+    if (it->second.rounds > 0) {
+      it->second.rounds--;
+      slot[kept++] = id;
+      continue;
+    }
+    due->push_back(std::move(it->second.f));
+    timers_.erase(it);
+  }
+  slot.resize(kept);
+}
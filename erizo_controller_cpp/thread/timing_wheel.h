@@ -0,0 +1,58 @@
+#ifndef ERIZO_SRC_ERIZO_THREAD_TIMING_WHEEL_H_
+#define ERIZO_SRC_ERIZO_THREAD_TIMING_WHEEL_H_
+
+#include <atomic>
+#include <chrono>  // NOLINT
+#include <functional>
+#include <mutex>  // NOLINT
+#include <thread>  // NOLINT
+#include <unordered_map>
+#include <vector>
+
+namespace erizo {
+
+//
+// Hashed timing wheel for large numbers of one-shot timeouts that are
+// usually cancelled before they fire. schedule() and cancel() are O(1);
+// each tick only visits the timers hashed into the current slot.
+// Timers fire on the wheel thread, at most one tick late.
+
+class TimingWheel {
+ public:
+  typedef std::function<void()> Task;
+  typedef uint64_t TimerId;
+
+  TimingWheel(std::chrono::milliseconds tick, size_t slot_num);
+  ~TimingWheel();
+
+  void start();
+  // Pending timers are dropped without running.
+  void stop();
+
+  TimerId schedule(Task f, std::chrono::milliseconds delay);
+  // Returns false if the timer has already fired or been cancelled.
+  bool cancel(TimerId id);
+
+ private:
+  struct Timer {
+    uint64_t rounds;
+    Task f;
+  };
+
+  void run();
+  void advance(std::vector<Task> *due);
+
+ private:
+  const std::chrono::milliseconds tick_;
+  std::mutex mutex_;
+  std::vector<std::vector<TimerId>> slots_;  // cancelled ids are removed lazily
+  std::unordered_map<TimerId, Timer> timers_;
+  size_t current_;
+  TimerId next_id_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+};
+
+}  // namespace erizo
+
+#endif  // ERIZO_SRC_ERIZO_THREAD_TIMING_WHEEL_H_
@@ -47,6 +47,8 @@ class Worker : public std::enable_shared_from_this<Worker> {
 
   virtual void scheduleEvery(ScheduledTask f, duration period);
 
+  boost::asio::io_service& getIOService() { return service_; }
+
  private:
   void scheduleEvery(ScheduledTask f, duration period, duration next_delay);
   std::function<void()> safeTask(std::function<void(std::shared_ptr<Worker>)> f);
@@ -1,32 +1,39 @@
 #include "socket_io_client_handler.h"
 
+#include <arpa/inet.h>
+
 #include "route/route.h"
 #include "common/utils.h"
 
 DEFINE_LOGGER(SocketIOClientHandler, "SocketIOClientHandler");
 
 SocketIOClientHandler::SocketIOClientHandler(uWS::WebSocket<uWS::SERVER> *ws,
-                                             const std::function<std::string(SocketIOClientHandler *hdl, const std::string &)> &on_message,
-                                             const std::function<void(SocketIOClientHandler *hdl)> &on_close) : ws_(ws),
+                                             const std::function<std::string(SocketIOClientHandler *hdl, int mid, const std::string &)> &on_message,
+                                             const std::function<void(SocketIOClientHandler *hdl)> &on_close) : client_(std::make_shared<Client>()),
+                                                                                                                ws_(ws),
                                                                                                                 on_message_hdl_(on_message),
                                                                                                                 on_close_hdl_(on_close)
 
 {
+    Client &client = *client_;
     uS::Socket::Address addr = ws->getAddress();
-    client_.id = "cli_" + Utils::getUUID();
-    client_.ip = addr.address;
-    client_.port = addr.port;
-    client_.family = addr.family;
+    client.id = "cli_" + Utils::getUUID();
+    client.ip = addr.address;
+    client.port = addr.port;
+    client.family = addr.family;
 
-    if (client_.family == "IPv4")
+    struct in_addr in;
+    if (client.family == "IPv4" && inet_pton(AF_INET, client.ip.c_str(), &in) == 1)
     {
-        client_.ip_info = Route::getInstance()->processIP(client_.ip);
+        client.ip_info = Route::getInstance()->processIPCached(in.s_addr);
     }
     else
     {
-        std::string ipv4_addr;
-        if (Utils::searchAddress(addr.address, ipv4_addr))
-            client_.ip_info = Route::getInstance()->processIP(ipv4_addr);
+        uint32_t ipv4_addr;
+        if (Utils::searchAddress(client.ip.data(), client.ip.size(), ipv4_addr))
+            client.ip_info = Route::getInstance()->processIPCached(ipv4_addr);
+        else
+            client.ip_info = Route::getInstance()->processIP(client.ip);
     }
 
     Json::Value handshake;
@@ -53,21 +60,17 @@ void SocketIOClientHandler::handleMessage(const std::string &msg)
     if (msg_type != SOCKET_IO_MSG_TYPE::type_event)
         return;
 
-    int mid;
-    bool has_mid = false;
+    int mid = -1;
 
     size_t pos = msg.find_first_of('[');
     if (pos == msg.npos)
         return;
 
     if (pos > 2)
-    {
-        has_mid = true;
         mid = std::stoi(msg.substr(2, pos));
-    }
 
     std::string event = msg.substr(pos);
-    std::string res = on_message_hdl_(this, event);
+    std::string res = on_message_hdl_(this, mid, event);
     if (res == "disconnect")
     {
         sendMessage("41");
@@ -79,7 +82,7 @@ void SocketIOClientHandler::handleMessage(const std::string &msg)
     {
         std::ostringstream oss;
         oss << "43";
-        if (has_mid)
+        if (mid >= 0)
             oss << mid;
         oss << res;
 
@@ -110,7 +113,7 @@ void SocketIOClientHandler::onClose()
 
 void SocketIOClientHandler::sendMessage(const std::string &msg)
 {
-    std::unique_lock<std::mutex>(mux_);
+    std::unique_lock<std::mutex> lock(mux_);
     if (ws_ != nullptr)
         ws_->send(msg.c_str(), msg.length(), uWS::OpCode::TEXT);
 }
@@ -4,6 +4,7 @@
 #include <string>
 #include <functional>
 #include <mutex>
+#include <memory>
 
 #include <uWS/uWS.h>
 #include <json/json.h>
@@ -39,8 +40,9 @@ class SocketIOClientHandler
     };
 
   public:
+    //on_message返回"keep"时由上层稍后通过SocketIOServer::sendAck回复,mid为-1表示没有消息id
     SocketIOClientHandler(uWS::WebSocket<uWS::SERVER> *ws,
-                          const std::function<std::string(SocketIOClientHandler *hdl, const std::string &)> &on_message,
+                          const std::function<std::string(SocketIOClientHandler *hdl, int mid, const std::string &)> &on_message,
                           const std::function<void(SocketIOClientHandler *hdl)> &on_close);
     ~SocketIOClientHandler();
     void onMessage(const std::string &msg);
@@ -50,19 +52,24 @@ class SocketIOClientHandler
     void sendMessage(const std::string &msg);
 
     Client &getClient()
+    {
+        return *client_;
+    }
+    //异步处理时持有,连接关闭后handler被删除但Client仍然有效
+    const std::shared_ptr<Client> &getClientPtr()
     {
         return client_;
     }
     void setWebSocket(uWS::WebSocket<uWS::SERVER> *ws)
     {
-        std::unique_lock<std::mutex>(mux_);
+        std::unique_lock<std::mutex> lock(mux_);
         ws_ = ws;
     }
 
   private:
-    Client client_;
+    std::shared_ptr<Client> client_;
     uWS::WebSocket<uWS::SERVER> *ws_;
-    std::function<std::string(SocketIOClientHandler *hdl, const std::string &)> on_message_hdl_;
+    std::function<std::string(SocketIOClientHandler *hdl, int mid, const std::string &)> on_message_hdl_;
     std::function<void(SocketIOClientHandler *hdl)> on_close_hdl_;
     std::mutex mux_;
 };
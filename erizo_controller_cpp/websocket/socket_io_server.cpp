@@ -11,7 +11,7 @@ SocketIOServer::SocketIOServer() : send_thread_(nullptr),
                                    run_(false),
                                    init_(false)
 {
-    on_message_hdl_ = [this](SocketIOClientHandler *hdl, const std::string &msg) {
+    on_message_hdl_ = [this](SocketIOClientHandler *hdl, int mid, const std::string &msg) {
         ELOG_WARN("receive message:%s,but message handler not set");
         return "disconnect";
     };
@@ -31,6 +31,12 @@ int SocketIOServer::init()
     if (init_)
         return 0;
 
+    if (!send_queue_.valid())
+    {
+        ELOG_ERROR("socket-io send queue create eventfd failed");
+        return 1;
+    }
+
     run_ = true;
     threads_.resize(Config::getInstance()->socket_io_thread_num);
     std::transform(threads_.begin(), threads_.end(), threads_.begin(), [this](std::thread *t) {
@@ -41,9 +47,9 @@ int SocketIOServer::init()
             clients_mux_.unlock();
 
             hub.onConnection([this](uWS::WebSocket<uWS::SERVER> *ws, uWS::HttpRequest req) {
-                SocketIOClientHandler *hdl = new SocketIOClientHandler(ws, std::ref(on_message_hdl_), std::ref(on_close_hdl_));
+                std::shared_ptr<SocketIOClientHandler> hdl = std::make_shared<SocketIOClientHandler>(ws, std::ref(on_message_hdl_), std::ref(on_close_hdl_));
                 std::string client_id = hdl->getClient().id;
-                ws->setUserData(hdl);
+                ws->setUserData(hdl.get());
 
                 std::unique_lock<std::mutex> lock(clients_mux_);
                 clients_[client_id] = hdl;
@@ -72,7 +78,6 @@ int SocketIOServer::init()
 
                 std::unique_lock<std::mutex> lock(clients_mux_);
                 clients_.erase(client_id);
-                delete hdl;
             });
 
             if (Config::getInstance()->ssl)
@@ -104,17 +109,22 @@ int SocketIOServer::init()
     send_thread_ = std::unique_ptr<std::thread>(new std::thread([this]() {
         while (run_)
         {
-            std::unique_lock<std::mutex> lock(send_mux_);
-            while (!send_queue_.empty())
+            SIOData *data;
+            while ((data = send_queue_.pop()) != nullptr)
             {
-                SIOData data = send_queue_.front();
-                send_queue_.pop();
-                std::unique_lock<std::mutex>(clients_mux_);
-                auto it = clients_.find(data.client_id);
-                if (it != clients_.end())
-                    it->second->sendMessage(data.message);
+                std::unique_ptr<SIOData> guard(data);
+                //只在查找时持有clients_mux_,发送时连接建立和关闭不用等待
+                std::shared_ptr<SocketIOClientHandler> hdl;
+                {
+                    std::unique_lock<std::mutex> lock(clients_mux_);
+                    auto it = clients_.find(data->client_id);
+                    if (it != clients_.end())
+                        hdl = it->second;
+                }
+                if (hdl != nullptr)
+                    hdl->sendMessage(data->message);
             }
-            send_cond_.wait(lock);
+            send_queue_.wait(-1);
         }
     }));
 
@@ -129,7 +139,7 @@ void SocketIOServer::close()
 
     run_ = false;
 
-    send_cond_.notify_all();
+    send_queue_.notify();
     send_thread_->join();
     send_thread_.reset();
     send_thread_ = nullptr;
@@ -139,10 +149,7 @@ void SocketIOServer::close()
     });
 
     for (auto it = clients_.begin(); it != clients_.end(); it++)
-    {
         it->second->onClose();
-        delete it->second;
-    }
     clients_.clear();
 
     init_ = false;
@@ -154,14 +161,29 @@ void SocketIOServer::sendEvent(const std::string &client_id, const std::string &
     oss << "42";
     oss << msg;
 
-    std::unique_lock<std::mutex> lock(send_mux_);
-    send_queue_.push({client_id, oss.str()});
-    send_cond_.notify_one();
+    push(client_id, oss.str());
+}
+
+void SocketIOServer::sendAck(const std::string &client_id, int mid, const std::string &msg)
+{
+    std::ostringstream oss;
+    oss << "43";
+    if (mid >= 0)
+        oss << mid;
+    oss << msg;
+
+    push(client_id, oss.str());
 }
 
 void SocketIOServer::closeConnection(const std::string &client_id)
 {
-    std::unique_lock<std::mutex> lock(send_mux_);
-    send_queue_.push({client_id, "41"});
-    send_cond_.notify_one();
+    push(client_id, "41");
+}
+
+void SocketIOServer::push(const std::string &client_id, const std::string &message)
+{
+    SIOData *data = new SIOData;
+    data->client_id = client_id;
+    data->message = message;
+    send_queue_.push(data);
 }
\ No newline at end of file
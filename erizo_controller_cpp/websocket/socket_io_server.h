@@ -8,12 +8,12 @@
 #include <mutex>
 #include <memory>
 #include <map>
-#include <condition_variable>
-#include <queue>
+#include <vector>
 
 #include <uWS/uWS.h>
 
 #include "common/logger.h"
+#include "thread/mpsc_queue.h"
 
 class SocketIOClientHandler;
 
@@ -21,7 +21,7 @@ class SocketIOServer
 {
     DECLARE_LOGGER();
 
-    struct SIOData
+    struct SIOData : public erizo::MpscNode
     {
         std::string client_id;
         std::string message;
@@ -34,7 +34,7 @@ class SocketIOServer
     int init();
     void close();
 
-    void onMessage(const std::function<std::string(SocketIOClientHandler *hdl, const std::string &)> &on_message)
+    void onMessage(const std::function<std::string(SocketIOClientHandler *hdl, int mid, const std::string &)> &on_message)
     {
         on_message_hdl_ = on_message;
     }
@@ -44,18 +44,23 @@ class SocketIOServer
     }
 
     void sendEvent(const std::string &client_id, const std::string &msg);
+    //on_message返回"keep"之后的回复,mid为-1表示没有消息id
+    void sendAck(const std::string &client_id, int mid, const std::string &msg);
     void closeConnection(const std::string &client_id);
 
   private:
-    std::function<std::string(SocketIOClientHandler *hdl, const std::string &)> on_message_hdl_;
+    void push(const std::string &client_id, const std::string &message);
+
+  private:
+    std::function<std::string(SocketIOClientHandler *hdl, int mid, const std::string &)> on_message_hdl_;
     std::function<void(SocketIOClientHandler *hdl)> on_close_hdl_;
 
     std::mutex clients_mux_;
-    std::map<std::string, SocketIOClientHandler *> clients_;
+    //发送线程在锁外发送时持有一份引用,连接关闭后handler在发送结束时才释放
+    std::map<std::string, std::shared_ptr<SocketIOClientHandler>> clients_;
     std::vector<std::thread *> threads_;
-    std::condition_variable send_cond_;
-    std::queue<SIOData> send_queue_;
-    std::mutex send_mux_;
+    //发送方不加锁,发送线程取出后再查找client发送
+    erizo::MpscQueue<SIOData> send_queue_;
 
     std::unique_ptr<std::thread> send_thread_;
     std::atomic<bool> run_;
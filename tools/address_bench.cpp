@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/regex.hpp>
+
+#include "common/utils.h"
+
+//Utils::searchAddress和原来的boost::regex实现在同一批输入上逐条比对,结果必须完全一致,
+//然后对两者做微基准(原实现每次调用都编译正则,另外给出正则只编译一次的结果作参考)
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+const char *kPattern = "(25[0-4]|2[0-4][0-9]|1[0-9][0-9]|[1-9][0-9]|[1-9])[.](25[0-5]|2[0-4][0-9]|1[0-9][0-9]|[1-9][0-9]|[0-9])[.](25[0-5]|2[0-4][0-9]|1[0-9][0-9]|[1-9][0-9]|[0-9])[.](25[0-4]|2[0-4][0-9]|1[0-9][0-9]|[1-9][0-9]|[1-9])";
+
+//原实现
+bool regexSearchAddress(const std::string &str, std::string &ip)
+{
+    boost::regex reg(kPattern);
+
+    std::string::const_iterator start, end;
+    start = str.begin();
+    end = str.end();
+
+    boost::match_results<std::string::const_iterator> what;
+    boost::match_flag_type flags = boost::match_default;
+
+    while (regex_search(start, end, what, reg, flags))
+    {
+        ip = std::string(what[0].first, what[0].second);
+        return true;
+    }
+    return false;
+}
+
+bool cachedRegexSearchAddress(const std::string &str, std::string &ip)
+{
+    static const boost::regex reg(kPattern);
+    boost::smatch what;
+    if (!boost::regex_search(str, what, reg))
+        return false;
+    ip = what.str(0);
+    return true;
+}
+
+std::vector<std::string> makeInputs(size_t random_count, unsigned seed)
+{
+    std::vector<std::string> inputs = {
+        "", "1.2.3.4", "::ffff:1.2.3.4", "::ffff:192.168.1.10", "2001:db8::1", "::1", "0.0.0.0",
+        "255.255.255.255", "254.255.255.254", "255.1.1.1", "1.1.1.255", "1.256.1.1", "01.2.3.4", "1.02.3.4",
+        "1.2.3.04", "1.0.0.1", "10.0.0.0", "1.2.3.2545", "11.2.3.4.5", "1..2.3.4", "1.2.3", "a1.2.3.4b",
+        "123.45.67.89x", "0123.45.67.89", "1.2.3.4.5.6.7.8", "999.1.2.3.4", "25.255.255.25", "2.5.5.2545",
+        "1.2.3.04.5.6.7", "::ffff:0.1.2.3", "::ffff:10.0.0.0:8080", "[::ffff:127.0.0.1]:443"};
+
+    std::mt19937 rng(seed);
+    const char alphabet[] = "0123456789012345678901234567890123456789....:f";
+    std::uniform_int_distribution<size_t> length(0, 40);
+    std::uniform_int_distribution<size_t> pick(0, sizeof(alphabet) - 2);
+    for (size_t i = 0; i < random_count; i++)
+    {
+        std::string s(length(rng), ' ');
+        for (char &c : s)
+            c = alphabet[pick(rng)];
+        inputs.push_back(s);
+    }
+    return inputs;
+}
+
+int check(const std::vector<std::string> &inputs)
+{
+    int mismatch = 0;
+    for (const std::string &s : inputs)
+    {
+        std::string expect, got;
+        bool expect_found = regexSearchAddress(s, expect);
+        bool got_found = Utils::searchAddress(s, got);
+
+        uint32_t addr = 0;
+        bool addr_found = Utils::searchAddress(s.data(), s.size(), addr);
+        struct in_addr in;
+        bool addr_ok = (addr_found == expect_found) &&
+                       (!expect_found || (inet_pton(AF_INET, expect.c_str(), &in) == 1 && in.s_addr == addr));
+
+        if (expect_found != got_found || expect != got || !addr_ok)
+        {
+            if (mismatch < 20)
+                fprintf(stderr, "mismatch on \"%s\": regex %s\"%s\", scanner %s\"%s\"\n", s.c_str(),
+                        expect_found ? "" : "(none) ", expect.c_str(), got_found ? "" : "(none) ", got.c_str());
+            mismatch++;
+        }
+    }
+    return mismatch;
+}
+
+template <typename F>
+double bench(const std::vector<std::string> &inputs, size_t rounds, F func)
+{
+    size_t found = 0;
+    Clock::time_point start = Clock::now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        for (const std::string &s : inputs)
+            found += func(s) ? 1 : 0;
+    }
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    //防止被优化掉
+    if (found == (size_t)-1)
+        printf("\n");
+    return ns / ((double)rounds * inputs.size());
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc > 3)
+    {
+        fprintf(stderr, "usage: %s [random_inputs=100000] [bench_rounds=20000]\n", argv[0]);
+        return 1;
+    }
+    size_t random_count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 100000;
+    size_t rounds = argc > 2 ? strtoull(argv[2], nullptr, 10) : 20000;
+
+    std::vector<std::string> inputs = makeInputs(random_count, 20170601);
+    int mismatch = check(inputs);
+    printf("equivalence: %zu inputs, %d mismatches\n", inputs.size(), mismatch);
+    if (mismatch)
+        return 1;
+
+    //socket_io_client_handler实际遇到的地址形式
+    std::vector<std::string> typical = {"::ffff:192.168.1.10", "::ffff:10.12.3.254", "2001:db8:85a3::8a2e:370:7334", "::1"};
+    std::string ip;
+    uint32_t addr;
+    double scan = bench(typical, rounds, [&](const std::string &s) { return Utils::searchAddress(s.data(), s.size(), addr); });
+    double scan_str = bench(typical, rounds, [&](const std::string &s) { return Utils::searchAddress(s, ip); });
+    double cached = bench(typical, rounds, [&](const std::string &s) { return cachedRegexSearchAddress(s, ip); });
+    double regex = bench(typical, rounds / 100 + 1, [&](const std::string &s) { return regexSearchAddress(s, ip); });
+
+    printf("scanner (uint32)        %10.1f ns/call\n", scan);
+    printf("scanner (string)        %10.1f ns/call\n", scan_str);
+    printf("regex (compiled once)   %10.1f ns/call\n", cached);
+    printf("regex (original)        %10.1f ns/call\n", regex);
+    return 0;
+}
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "model/client.h"
+#include "model/publisher.h"
+#include "model/subscriber.h"
+#include "model/bridge_stream.h"
+
+//房间记录的二进制格式(model/binary_codec.h)和JSON格式对比:
+//每种记录的编码/解码耗时和大小,以及一个全互通房间在redis中记录的总字节数
+//解码一侧JSON走fromJSON(strict模式,和线上读取相同),二进制走fromBinary
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+std::mt19937 rng(20170601);
+
+std::string hexId()
+{
+    static const char kHex[] = "0123456789abcdef";
+    std::string s(32, '0');
+    for (char &c : s)
+        c = kHex[rng() % 16];
+    return s;
+}
+
+std::string ipv4()
+{
+    return std::to_string(rng() % 223 + 1) + "." + std::to_string(rng() % 256) + "." + std::to_string(rng() % 256) + "." +
+           std::to_string(rng() % 254 + 1);
+}
+
+Client makeClient(const std::string &room_id)
+{
+    Client c;
+    c.id = hexId();
+    c.agent_id = hexId();
+    c.erizo_id = hexId();
+    c.bridge_ip = ipv4();
+    c.bridge_port = 30000 + rng() % 10000;
+    c.room_id = room_id;
+    c.ip = "::ffff:" + ipv4();
+    c.port = 1024 + rng() % 60000;
+    c.family = "IPv6";
+    c.reply_to = "amq.gen-" + hexId().substr(0, 22);
+    return c;
+}
+
+Publisher makePublisher(const Client &c)
+{
+    Publisher p;
+    p.id = hexId();
+    p.client_id = c.id;
+    p.erizo_id = c.erizo_id;
+    p.bridge_ip = c.bridge_ip;
+    p.bridge_port = c.bridge_port;
+    p.agent_id = c.agent_id;
+    p.label = "camera";
+    p.video_ssrc = rng();
+    p.audio_ssrc = rng();
+    return p;
+}
+
+Subscriber makeSubscriber(const Client &c, const Publisher &p)
+{
+    Subscriber s;
+    s.id = hexId();
+    s.client_id = c.id;
+    s.erizo_id = c.erizo_id;
+    s.agent_id = c.agent_id;
+    s.subscribe_to = p.id;
+    s.reply_to = c.reply_to;
+    s.is_bridge = (c.agent_id != p.agent_id);
+    return s;
+}
+
+BridgeStream makeBridgeStream(const Publisher &p, const Client &recver)
+{
+    BridgeStream b;
+    b.id = hexId();
+    b.sender_erizo_id = p.erizo_id;
+    b.sender_ip = p.bridge_ip;
+    b.sender_port = p.bridge_port;
+    b.recver_erizo_id = recver.erizo_id;
+    b.recver_ip = recver.bridge_ip;
+    b.recver_port = recver.bridge_port;
+    b.src_stream_id = p.id;
+    b.label = p.label;
+    b.subscribe_count = 1;
+    return b;
+}
+
+double nsPer(Clock::time_point start, size_t n)
+{
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / n;
+}
+
+//逐条往返检查,然后分别计时
+template <typename T>
+bool bench(const char *name, const std::vector<T> &records, size_t iterations)
+{
+    std::vector<std::string> json, binary;
+    size_t json_bytes = 0, binary_bytes = 0;
+    for (const T &r : records)
+    {
+        json.push_back(r.toJSON());
+        binary.push_back(r.toBinary());
+        json_bytes += json.back().size();
+        binary_bytes += binary.back().size();
+
+        T a, b;
+        if (T::parse(json.back(), a) || T::parse(binary.back(), b) || a.toBinary() != binary.back() ||
+            b.toJSON() != json.back())
+        {
+            fprintf(stderr, "%s: round trip mismatch\n", name);
+            return false;
+        }
+    }
+
+    size_t n = 0;
+    size_t sink = 0;
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < iterations; i++)
+        sink += records[i % records.size()].toJSON().size();
+    double json_enc = nsPer(start, iterations);
+
+    start = Clock::now();
+    for (size_t i = 0; i < iterations; i++)
+        sink += records[i % records.size()].toBinary().size();
+    double binary_enc = nsPer(start, iterations);
+
+    T t;
+    start = Clock::now();
+    for (size_t i = 0; i < iterations; i++)
+        n += T::fromJSON(json[i % json.size()], t) ? 0 : 1;
+    double json_dec = nsPer(start, iterations);
+
+    start = Clock::now();
+    for (size_t i = 0; i < iterations; i++)
+        n += T::fromBinary(binary[i % binary.size()], t) ? 0 : 1;
+    double binary_dec = nsPer(start, iterations);
+
+    if (n != iterations * 2 || sink == 0)
+    {
+        fprintf(stderr, "%s: decode failed\n", name);
+        return false;
+    }
+
+    printf("%-13s %6.0f B %6.0f B  %5.1fx | enc %7.0f %7.0f ns %5.1fx | dec %7.0f %7.0f ns %5.1fx\n", name,
+           (double)json_bytes / records.size(), (double)binary_bytes / records.size(), (double)json_bytes / binary_bytes,
+           json_enc, binary_enc, json_enc / binary_enc, json_dec, binary_dec, json_dec / binary_dec);
+    return true;
+}
+
+template <typename T>
+void roomBytes(const std::vector<T> &records, size_t &json_bytes, size_t &binary_bytes)
+{
+    for (const T &r : records)
+    {
+        json_bytes += r.toJSON().size();
+        binary_bytes += r.toBinary().size();
+    }
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc > 4)
+    {
+        fprintf(stderr, "usage: %s [clients=50] [erizo_agents=3] [iterations=200000]\n", argv[0]);
+        return 1;
+    }
+    int client_num = argc > 1 ? atoi(argv[1]) : 50;
+    int agent_num = argc > 2 ? atoi(argv[2]) : 3;
+    size_t iterations = argc > 3 ? strtoull(argv[3], nullptr, 10) : 200000;
+    if (client_num < 2 || agent_num < 1 || iterations == 0)
+    {
+        fprintf(stderr, "need at least 2 clients, 1 erizo_agent and 1 iteration\n");
+        return 1;
+    }
+
+    //全互通房间:每个客户端推一路流并订阅其他所有人,客户端平均分布在各erizo_agent上,
+    //跨agent的订阅每个(流, 接收erizo)一条bridge_stream
+    std::string room_id = hexId();
+    std::vector<Client> agents;
+    for (int i = 0; i < agent_num; i++)
+        agents.push_back(makeClient(room_id));
+
+    std::vector<Client> clients;
+    std::vector<Publisher> publishers;
+    for (int i = 0; i < client_num; i++)
+    {
+        const Client &agent = agents[i % agent_num];
+        Client c = makeClient(room_id);
+        c.agent_id = agent.agent_id;
+        c.erizo_id = agent.erizo_id;
+        c.bridge_ip = agent.bridge_ip;
+        c.bridge_port = agent.bridge_port;
+        clients.push_back(c);
+        publishers.push_back(makePublisher(c));
+    }
+
+    std::vector<Subscriber> subscribers;
+    std::vector<BridgeStream> bridge_streams;
+    for (const Publisher &p : publishers)
+    {
+        for (const Client &c : clients)
+        {
+            if (c.id != p.client_id)
+                subscribers.push_back(makeSubscriber(c, p));
+        }
+        for (const Client &agent : agents)
+        {
+            if (agent.agent_id != p.agent_id)
+                bridge_streams.push_back(makeBridgeStream(p, agent));
+        }
+    }
+
+    printf("%-13s %8s %8s  %6s | %-29s | %s\n", "record", "json", "binary", "ratio", "encode json/binary ratio",
+           "decode json/binary ratio");
+    if (!bench("client", clients, iterations) ||
+        !bench("publisher", publishers, iterations) ||
+        !bench("subscriber", subscribers, iterations) ||
+        !bench("bridge_stream", bridge_streams, iterations))
+        return 1;
+
+    size_t json_bytes = 0, binary_bytes = 0;
+    roomBytes(clients, json_bytes, binary_bytes);
+    roomBytes(publishers, json_bytes, binary_bytes);
+    roomBytes(subscribers, json_bytes, binary_bytes);
+    roomBytes(bridge_streams, json_bytes, binary_bytes);
+    printf("room: %d clients on %d erizo_agents, %zu subscribers, %zu bridge_streams\n", client_num, agent_num,
+           subscribers.size(), bridge_streams.size());
+    printf("room record bytes: json %zu, binary %zu (%.1fx)\n", json_bytes, binary_bytes, (double)json_bytes / binary_bytes);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "route/IpTable.h"
+
+using namespace edu::iptable;
+
+//把文本格式的iptable编译成controller可以直接mmap的二进制文件
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s <iptable> <output>\n", argv[0]);
+        return 1;
+    }
+
+    IpTable table;
+    if (!table.loadIspIpDataFile(argv[1]))
+    {
+        fprintf(stderr, "load %s failed\n", argv[1]);
+        return 1;
+    }
+
+    if (!table.saveIndex(argv[2]))
+    {
+        fprintf(stderr, "write %s failed\n", argv[2]);
+        return 1;
+    }
+
+    //读回来逐条比对,保证生成的文件和文本表查询结果一致
+    IpTable check;
+    if (!check.loadIndex(argv[2]) || check.indexSize() != table.indexSize() || check.index6Size() != table.index6Size())
+    {
+        fprintf(stderr, "verify %s failed\n", argv[2]);
+        return 1;
+    }
+
+    for (IP_TABLE::IP_TABLE_MAP_CONST_IT it = table.begin(); it != table.end(); ++it)
+    {
+        uint32_t ips[2] = {(uint32_t)it->first.from, (uint32_t)it->first.to};
+        for (uint32_t ip : ips)
+        {
+            IP_TABLE_VALUE a = table.getValue(ip);
+            IP_TABLE_VALUE b = check.getValue(ip);
+            if (a.isp != b.isp || a.area != b.area)
+            {
+                fprintf(stderr, "verify %s failed at %u\n", argv[2], ip);
+                return 1;
+            }
+        }
+    }
+
+    printf("%s: %zu ipv4 ranges, %zu ipv6 ranges written to %s\n", argv[1], table.indexSize(), table.index6Size(), argv[2]);
+    return 0;
+}
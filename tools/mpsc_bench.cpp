@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "thread/mpsc_queue.h"
+
+//对比SocketIOServer/AMQPRPC发送队列:MpscQueue和原来的mutex+condvar队列
+//原来的发送线程在持有队列锁时发送,消费者每条消息的处理时间(work_ns)模拟发送耗时
+//输出总吞吐和生产者单次入队耗时,并检查每个生产者的消息按顺序到达
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+struct Message
+{
+    int producer;
+    uint64_t seq;
+};
+
+//原队列按值保存SIOData,MpscQueue的节点需要new出来
+struct Item : public erizo::MpscNode
+{
+    Message msg;
+};
+
+struct Result
+{
+    double seconds;
+    double push_avg_ns;
+    double push_max_ns;
+    bool ordered;
+};
+
+void spin(int64_t ns)
+{
+    if (ns <= 0)
+        return;
+    Clock::time_point end = Clock::now() + std::chrono::nanoseconds(ns);
+    while (Clock::now() < end)
+        ;
+}
+
+//原实现:入队加锁notify_one,消费者持锁取出并处理
+class LockedQueue
+{
+  public:
+    void push(const Message &msg)
+    {
+        std::unique_lock<std::mutex> lock(mux_);
+        queue_.push(msg);
+        cond_.notify_one();
+    }
+
+    template <typename F>
+    void consume(uint64_t total, F func)
+    {
+        uint64_t n = 0;
+        while (n < total)
+        {
+            std::unique_lock<std::mutex> lock(mux_);
+            while (!queue_.empty())
+            {
+                Message msg = queue_.front();
+                queue_.pop();
+                func(msg);
+                n++;
+            }
+            if (n < total)
+                cond_.wait(lock);
+        }
+    }
+
+  private:
+    std::mutex mux_;
+    std::condition_variable cond_;
+    std::queue<Message> queue_;
+};
+
+class LockFreeQueue
+{
+  public:
+    bool valid() const { return queue_.valid(); }
+
+    void push(const Message &msg)
+    {
+        Item *node = new Item;
+        node->msg = msg;
+        queue_.push(node);
+    }
+
+    template <typename F>
+    void consume(uint64_t total, F func)
+    {
+        uint64_t n = 0;
+        while (n < total)
+        {
+            Item *node;
+            while ((node = queue_.pop()) != nullptr)
+            {
+                func(node->msg);
+                delete node;
+                n++;
+            }
+            if (n < total)
+                queue_.wait(-1);
+        }
+    }
+
+  private:
+    erizo::MpscQueue<Item> queue_;
+};
+
+template <typename Q>
+Result run(Q &queue, int producers, uint64_t count, int64_t work_ns)
+{
+    std::vector<uint64_t> next(producers, 0);
+    std::vector<double> push_total(producers, 0), push_max(producers, 0);
+    bool ordered = true;
+    std::atomic<bool> go(false);
+
+    Clock::time_point start;
+    std::thread consumer([&]() {
+        queue.consume(count * producers, [&](const Message &msg) {
+            if (msg.seq != next[msg.producer])
+                ordered = false;
+            next[msg.producer] = msg.seq + 1;
+            spin(work_ns);
+        });
+    });
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++)
+    {
+        threads.push_back(std::thread([&, p]() {
+            while (!go.load())
+                std::this_thread::yield();
+            for (uint64_t i = 0; i < count; i++)
+            {
+                Message msg;
+                msg.producer = p;
+                msg.seq = i;
+                Clock::time_point t = Clock::now();
+                queue.push(msg);
+                double ns = std::chrono::duration<double, std::nano>(Clock::now() - t).count();
+                push_total[p] += ns;
+                if (ns > push_max[p])
+                    push_max[p] = ns;
+            }
+        }));
+    }
+    start = Clock::now();
+    go.store(true);
+    for (std::thread &t : threads)
+        t.join();
+    consumer.join();
+
+    Result r;
+    r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    r.push_avg_ns = 0;
+    r.push_max_ns = 0;
+    for (int p = 0; p < producers; p++)
+    {
+        r.push_avg_ns += push_total[p];
+        if (push_max[p] > r.push_max_ns)
+            r.push_max_ns = push_max[p];
+    }
+    r.push_avg_ns /= (double)count * producers;
+    r.ordered = ordered;
+    for (int p = 0; p < producers; p++)
+    {
+        if (next[p] != count)
+            r.ordered = false;
+    }
+    return r;
+}
+
+void print(const char *name, int producers, uint64_t count, const Result &r)
+{
+    printf("%-12s %8.0f msg/s  push avg %8.0f ns  push max %10.0f ns  %s\n", name,
+           (double)count * producers / r.seconds, r.push_avg_ns, r.push_max_ns, r.ordered ? "ordered" : "OUT OF ORDER");
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc > 4)
+    {
+        fprintf(stderr, "usage: %s [producers=16] [messages_per_producer=200000] [consumer_work_ns=0]\n", argv[0]);
+        return 1;
+    }
+    int producers = argc > 1 ? atoi(argv[1]) : 16;
+    uint64_t count = argc > 2 ? strtoull(argv[2], nullptr, 10) : 200000;
+    int64_t work_ns = argc > 3 ? atoll(argv[3]) : 0;
+    if (producers <= 0 || count == 0)
+    {
+        fprintf(stderr, "producers and messages_per_producer must be positive\n");
+        return 1;
+    }
+
+    printf("producers %d, messages per producer %llu, consumer work %lld ns, cpus %u\n", producers,
+           (unsigned long long)count, (long long)work_ns, std::thread::hardware_concurrency());
+
+    LockedQueue locked;
+    Result a = run(locked, producers, count, work_ns);
+    print("mutex+cond", producers, count, a);
+
+    LockFreeQueue mpsc;
+    if (!mpsc.valid())
+    {
+        fprintf(stderr, "create eventfd failed\n");
+        return 1;
+    }
+    Result b = run(mpsc, producers, count, work_ns);
+    print("MpscQueue", producers, count, b);
+
+    return (a.ordered && b.ordered) ? 0 : 1;
+}